@@ -0,0 +1,31 @@
+(begin
+    ; allocation of small values: conses, closures with their envs, strings
+    (define (build n acc)
+        (if (= n 0)
+            acc
+            (build (- n 1) (cons n acc))))
+
+    (define (adders n acc)
+        (if (= n 0)
+            acc
+            (adders (- n 1) (cons (lambda (x) (+ x n)) acc))))
+
+    (define (run name thunk)
+        (define start (current-time))
+        (define result (thunk))
+        (display name)
+        (display ": ")
+        (display result)
+        (display " in ")
+        (display (- (current-time) start))
+        (displayln "ms"))
+
+    (run "cons 100000" (lambda () (length (build 100000 '()))))
+    (run "closures 30000" (lambda () (length (adders 30000 '()))))
+    (run "map 5 x 20000"
+         (lambda ()
+             (define lst (build 20000 '()))
+             (length (map (lambda (x) (list x x))
+                          (map (lambda (x) (* x 2))
+                               (map (lambda (x) (+ x 1)) lst))))))
+)
@@ -0,0 +1,25 @@
+(begin
+    ; numeric code, most of the time is spent in + - < =
+    (define (fib n)
+        (if (< n 2)
+            n
+            (+ (fib (- n 1)) (fib (- n 2)))))
+
+    (define (sum-squares n acc)
+        (if (= n 0)
+            acc
+            (sum-squares (- n 1) (+ acc (* n n)))))
+
+    (define (run name thunk)
+        (define start (current-time))
+        (define result (thunk))
+        (display name)
+        (display ": ")
+        (display result)
+        (display " in ")
+        (display (- (current-time) start))
+        (displayln "ms"))
+
+    (run "fib 20" (lambda () (fib 20)))
+    (run "sum-squares 100000" (lambda () (sum-squares 100000 0)))
+)
@@ -0,0 +1,29 @@
+(begin
+    ; a big live heap and lots of short-lived garbage (run with --gc-stats)
+    (define (build n acc)
+        (if (= n 0)
+            acc
+            (build (- n 1) (cons n acc))))
+
+    (define (churn n acc)
+        (if (= n 0)
+            acc
+            (churn (- n 1) (+ acc (length (build 50 '()))))))
+
+    (define (run name thunk)
+        (define start (current-time))
+        (define result (thunk))
+        (display name)
+        (display ": ")
+        (display result)
+        (display " in ")
+        (display (- (current-time) start))
+        (displayln "ms"))
+
+    (define live (make-vector 200 '()))
+    (run "live 200 x 2000"
+         (lambda ()
+             (set! live (vector-map (lambda (x) (build 2000 '())) live))
+             (vector-length live)))
+    (run "churn 100000 x 50" (lambda () (churn 100000 0)))
+)
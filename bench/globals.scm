@@ -0,0 +1,31 @@
+(begin
+    ; the time per round should stay the same as more globals get defined
+    (define (make-defines n acc)
+        (if (> n 0)
+            (make-defines (- n 1) (cons (list 'define (gensym) n) acc))
+            (cons 'begin acc)))
+
+    (define counter 0)
+
+    (define (work n)
+        (if (> n 0)
+            (begin
+                (set! counter (car (cons n counter)))
+                (work (- n 1)))))
+
+    (define (round defined)
+        (define start (current-time))
+        (work 2000)
+        (display defined)
+        (display " globals: ")
+        (display (- (current-time) start))
+        (displayln "ms"))
+
+    (round 0)
+    (eval (make-defines 500 '()))
+    (round 500)
+    (eval (make-defines 1500 '()))
+    (round 2000)
+    (eval (make-defines 2000 '()))
+    (round 4000)
+)
@@ -0,0 +1,35 @@
+(begin
+    ; hash tables, inserts and lookups of numbers and lists
+    (define (fill! ht from to key)
+        (when (< from to)
+            (hash-set! ht (key from) from)
+            (fill! ht (+ from 1) to key)))
+
+    (define (sum-refs ht from to key acc)
+        (if (< from to)
+            (sum-refs ht (+ from 1) to key (+ acc (hash-ref ht (key from))))
+            acc))
+
+    (define (run name thunk)
+        (define start (current-time))
+        (define result (thunk))
+        (display name)
+        (display ": ")
+        (display result)
+        (display " in ")
+        (display (- (current-time) start))
+        (displayln "ms"))
+
+    (define numbers (make-hash eq?))
+    (define lists (make-hash equal?))
+    (define (identity n) n)
+
+    (run "eq? set+ref 20000"
+         (lambda ()
+             (fill! numbers 0 20000 identity)
+             (sum-refs numbers 0 20000 identity 0)))
+    (run "equal? set+ref 2000"
+         (lambda ()
+             (fill! lists 0 2000 list)
+             (sum-refs lists 0 2000 list 0)))
+)
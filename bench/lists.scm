@@ -0,0 +1,39 @@
+(begin
+    ; list library, most of the time is spent in map, filter and the folds
+    (define (build n acc)
+        (if (= n 0)
+            acc
+            (build (- n 1) (cons n acc))))
+
+    (define (run name thunk)
+        (define start (current-time))
+        (define result (thunk))
+        (display name)
+        (display ": ")
+        (display result)
+        (display " in ")
+        (display (- (current-time) start))
+        (displayln "ms"))
+
+    (define lst (build 2000 '()))
+
+    (run "map+foldl 2000 x 20"
+         (lambda ()
+             (define (loop i acc)
+                 (if (= i 0)
+                     acc
+                     (loop (- i 1)
+                           (+ acc (foldl + 0 (map (lambda (x) (* x 2)) lst))))))
+             (loop 20 0)))
+    (run "filter+foldr 2000 x 20"
+         (lambda ()
+             (define (loop i acc)
+                 (if (= i 0)
+                     acc
+                     (loop (- i 1)
+                           (+ acc (foldr + 0 (filter (lambda (x) (< x 1000))
+                                                     lst))))))
+             (loop 20 0)))
+    (run "list-ref+length 2000"
+         (lambda () (+ (list-ref lst 1999) (length lst))))
+)
@@ -0,0 +1,30 @@
+(begin
+    ; major collections of a big heap (run with --gc-stats and --gc-threads=<n>)
+    (define (build n acc)
+        (if (= n 0)
+            acc
+            (build (- n 1) (cons n acc))))
+
+    (define (run name thunk)
+        (define start (current-time))
+        (define result (thunk))
+        (display name)
+        (display ": ")
+        (display result)
+        (display " in ")
+        (display (- (current-time) start))
+        (displayln "ms"))
+
+    (define live (make-vector 400 '()))
+    (run "live 400 x 50000"
+         (lambda ()
+             (set! live (vector-map (lambda (x) (build 50000 '())) live))
+             (vector-length live)))
+    (define (collect n)
+        (if (= n 0)
+            'done
+            (begin
+                (gc)
+                (collect (- n 1)))))
+    (run "gc x 5" (lambda () (collect 5)))
+)
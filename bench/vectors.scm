@@ -0,0 +1,38 @@
+(begin
+    ; vector library, conversions and bulk operations
+    (define (build n acc)
+        (if (= n 0)
+            acc
+            (build (- n 1) (cons n acc))))
+
+    (define (run name thunk)
+        (define start (current-time))
+        (define result (thunk))
+        (display name)
+        (display ": ")
+        (display result)
+        (display " in ")
+        (display (- (current-time) start))
+        (displayln "ms"))
+
+    (define lst (build 1000 '()))
+    (define vec (list->vector lst))
+
+    (define (repeat i thunk)
+        (when (> i 0)
+            (thunk)
+            (repeat (- i 1) thunk)))
+
+    (run "list->vector+vector->list 1000 x 20"
+         (lambda ()
+             (repeat 20 (lambda () (vector->list (list->vector lst))))
+             (length (vector->list vec))))
+    (run "vector-map 1000 x 20"
+         (lambda ()
+             (repeat 20 (lambda () (vector-map (lambda (x) (+ x 1)) vec)))
+             (vector-length (vector-map (lambda (x) (+ x 1)) vec))))
+    (run "vector-append+fill! 1000 x 20"
+         (lambda ()
+             (repeat 20 (lambda () (vector-fill! (vector-append vec vec) 0)))
+             (vector-length (vector-append vec vec))))
+)
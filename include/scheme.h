@@ -1,7 +1,8 @@
 #ifndef _scheme_h
 #define _scheme_h
 
-#include <stdlib.h>  // size_t
+#include <stdbool.h>  // bool
+#include <stdlib.h>   // size_t
 
 // semantic versioning
 #define SCM_VERSION_MAJOR 0
@@ -27,6 +28,40 @@ typedef void (*scm_error_fn)(vm_t *vm, int line, int column,
 // A function used by scm for loading/importing scripts
 typedef void (*scm_load_fn)(vm_t *vm, env_t *env, const char *path);
 
+// Pauses of the garbage collector
+typedef enum {
+    // a minor collection (of the young values only)
+    SCM_GC_MINOR,
+    // a whole major collection
+    SCM_GC_MAJOR,
+    // one step of an incremental major collection
+    SCM_GC_STEP
+} scm_gc_pause_t;
+
+// A function called after every pause of the garbage collector
+// <time> is the duration of the pause in seconds
+// It's called in the middle of an allocation, so it can't use the VM
+typedef void (*scm_gc_fn)(vm_t *vm, scm_gc_pause_t pause, double time);
+
+// A function called when the heap is full even after a full collection
+// (it's over heap_size_max or there is no memory for more pages)
+// <size> is the size of the allocation which doesn't fit
+// It can free memory of its own or raise vm->config.heap_size_max and
+// return true to try again, it's called again if that's not enough
+// If it returns false, the VM reports the error and aborts
+// It's called in the middle of an allocation, so it can't use the VM
+typedef bool (*scm_oom_fn)(vm_t *vm, size_t size);
+
+// Engines for evaluating scm code
+typedef enum {
+    // walks the read cons cells directly
+    SCM_ENGINE_TREE,
+    // compiles each top-level form (with the lambdas in it) to bytecode
+    // when it's evaluated and runs that, functions made some other way
+    // are compiled on their first call
+    SCM_ENGINE_BYTECODE
+} scm_engine_t;
+
 // Configuration struct for VM creation
 typedef struct {
     // A function for allocating, reallocating and freeing memory
@@ -46,6 +81,59 @@ typedef struct {
 
     // Heap growth
     double heap_growth;
+
+    // Maximum size of the heap (in bytes), 0 means no limit
+    size_t heap_size_max;
+
+    // Back the heap with transparent huge pages where the OS has them
+    // (needs MMAP in config.h)
+    bool heap_huge_pages;
+
+    // Fraction of the time the GC should take (between 0 and 1)
+    // The heap grows so that major collections run just as often as needed,
+    // based on the measured allocation rate and duration of collections
+    // 0 means that the heap grows by heap_growth after a major collection
+    double gc_cpu_fraction;
+
+    // The heap doesn't grow over this size (in bytes) unless the live values
+    // need it, collections run more often instead (0 means no limit)
+    size_t heap_size_soft_max;
+
+    // Number of major collections in a row after which the pages of a heap
+    // much bigger than needed are given back (0 means never)
+    unsigned gc_release_after;
+
+    // Size of the young generation (allocated since the last collection)
+    // which triggers a minor collection
+    size_t nursery_size;
+
+    // Maximum duration of one step of a major collection (in microseconds)
+    // 0 means that major collections stop everything until they're done
+    unsigned gc_step_time;
+
+    // Number of threads marking values in a major collection which stops
+    // everything (0 and 1 mean just the thread running the VM)
+    // realloc_fn has to be thread-safe if it's more than 1
+    unsigned gc_threads;
+
+    // Sweep the garbage on a thread of its own while the program runs
+    // (realloc_fn has to be thread-safe then)
+    bool gc_sweep_thread;
+
+    // A function called after every pause of the GC (can be NULL)
+    scm_gc_fn gc_fn;
+
+    // A function called when the heap is full (can be NULL)
+    scm_oom_fn oom_fn;
+
+    // Evaluation engine
+    scm_engine_t engine;
+
+    // Maximum size of the evaluation stack (values and call frames)
+    // This is what limits the depth of recursion (except for procedures
+    // called from C, by builtins like map or by macros, which can be
+    // nested only 4096 times)
+    size_t stack_max;
 } scm_config_t;
 
 // Loads a default config into the config struct
@@ -59,6 +147,7 @@ vm_t *vm_new(scm_config_t *config);
 void vm_free(vm_t *vm);
 
 // (re)allocates a pointer, uses vm->config.realloc_fn inside
+// It returns NULL only when <new_size> is 0 (see scm_oom_fn)
 void *vm_realloc(vm_t *vm, void *ptr, size_t old_size, size_t new_size);
 
 // garbage collect
@@ -0,0 +1,914 @@
+#include <stdio.h>   // fprintf, stderr
+#include <string.h>  // strcmp
+
+#include "code.h"
+#include "resolve.h"  // resolve, params_valid
+#include "scheme.h"
+#include "value.h"
+#include "vm.h"
+#include "write.h"  // write
+
+/* /== ------------ ==\ */
+/* *** the compiler *** */
+/* \== ------------ ==/ */
+
+// Local variables visible while compiling
+// (they may shadow special forms and macros)
+typedef struct _scope_t {
+    // either parameters of a lambda (a list, possibly dotted, or a symbol)
+    // or bindings of a let ((var val) ...)
+    value_t vars;
+    bool bindings;
+
+    struct _scope_t *up;
+} scope_t;
+
+typedef struct {
+    vm_t *vm;
+
+    // the code we're emitting to
+    code_t *code;
+
+    // environment for looking up macros and special forms
+    env_t *env;
+
+    scope_t *scope;
+
+    // the current number of values on the stack
+    uint32_t depth;
+} compiler_t;
+
+static void compile(compiler_t *c, value_t val, bool tail);
+static void compile_body(compiler_t *c, value_t body, bool tail);
+
+/* *** emitting *** */
+
+static void emit_byte(compiler_t *c, uint8_t byte) {
+    code_t *code = c->code;
+    if (code->count + 1 > code->capacity) {
+        uint32_t capacity = code->capacity ? code->capacity << 1 : 16;
+        code->bytes = (uint8_t *) vm_realloc(c->vm, code->bytes,
+                                             code->capacity * sizeof(uint8_t),
+                                             capacity * sizeof(uint8_t));
+        code->capacity = capacity;
+    }
+    code->bytes[code->count++] = byte;
+}
+
+static void emit_short(compiler_t *c, uint16_t arg) {
+    emit_byte(c, arg & 0xff);
+    emit_byte(c, (arg >> 8) & 0xff);
+}
+
+// Emits <op> which changes the stack size by <effect>
+static void emit_op(compiler_t *c, opcode_t op, int effect) {
+    emit_byte(c, (uint8_t) op);
+
+    c->depth += effect;
+    if (c->depth > c->code->max_stack) {
+        c->code->max_stack = c->depth;
+    }
+}
+
+static void emit_op_arg(compiler_t *c, opcode_t op, uint32_t arg, int effect) {
+    emit_op(c, op, effect);
+    emit_short(c, (uint16_t) arg);
+}
+
+// Adds <val> to the constant pool if it's not already present
+static uint32_t constant_add(compiler_t *c, value_t val) {
+    code_t *code = c->code;
+    for (uint32_t i = 0; i < code->num_constants; i++) {
+        if (IS_EQ(code->constants[i], val)) {
+            return i;
+        }
+    }
+
+    if (code->num_constants > UINT16_MAX) {
+        error_runtime(c->vm, "compile: too many constants (%d is max)!",
+                      UINT16_MAX + 1);
+        return 0;
+    }
+
+    if (code->num_constants + 1 > code->constants_capacity) {
+        // <val> may be new (a code object or a resolved variable)
+        // and it has to survive the gc
+        vm_t *vm = c->vm;
+        value_t *top = vm->stack_top;
+        if (!vm_stack_check(vm, 1)) {
+            return 0;
+        }
+        *vm->stack_top++ = val;
+        uint32_t capacity =
+            code->constants_capacity ? code->constants_capacity << 1 : 8;
+        code->constants = (value_t *) vm_realloc(
+            vm, code->constants, code->constants_capacity * sizeof(value_t),
+            capacity * sizeof(value_t));
+        code->constants_capacity = capacity;
+        vm_stack_restore(vm, top);
+    }
+    code->constants[code->num_constants] = val;
+    vm_write_barrier(c->vm, &code->p, val);
+    return code->num_constants++;
+}
+
+static void emit_const(compiler_t *c, value_t val) {
+    emit_op_arg(c, OP_CONST, constant_add(c, val), 1);
+}
+
+// Emits a forward jump and returns the position of its offset
+static uint32_t emit_jump(compiler_t *c, opcode_t op, int effect) {
+    emit_op_arg(c, op, 0xffff, effect);
+    return c->code->count - 2;
+}
+
+// Makes the jump with offset at <at> jump to the current position
+static void patch_jump(compiler_t *c, uint32_t at) {
+    uint32_t offset = c->code->count - (at + 2);
+    if (offset > UINT16_MAX) {
+        error_runtime(c->vm, "compile: jump is too long!");
+    }
+    c->code->bytes[at] = offset & 0xff;
+    c->code->bytes[at + 1] = (offset >> 8) & 0xff;
+}
+
+/* *** scopes *** */
+
+static bool is_local(compiler_t *c, symbol_t *sym) {
+    for (scope_t *scope = c->scope; scope != NULL; scope = scope->up) {
+        value_t iter = scope->vars;
+        for (; IS_CONS(iter); iter = AS_CONS(iter)->cdr) {
+            value_t var = AS_CONS(iter)->car;
+            if (scope->bindings) {
+                var = AS_CONS(var)->car;
+            }
+            if (IS_EQ(var, PTR_VAL(sym))) {
+                return true;
+            }
+        }
+        if (IS_EQ(iter, PTR_VAL(sym))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* *** special forms *** */
+
+// Compiles a lambda into a new code object and emits its creation
+static void compile_lambda(compiler_t *c, value_t params, value_t body) {
+    code_t *code = code_new(c->vm, params, body);
+    uint32_t index = constant_add(c, PTR_VAL(code));
+
+    scope_t scope = {params, false, c->scope};
+    compiler_t child = {c->vm, code, c->env, &scope, 0};
+
+    compile_body(&child, body, true);
+    emit_op(&child, OP_RETURN, -1);
+
+    emit_op_arg(c, OP_LAMBDA, index, 1);
+}
+
+static bool compile_if(compiler_t *c, value_t args, bool tail) {
+    // (if <condition> <then> <otherwise...>)
+    if (cons_len(args) < 2) {
+        return false;
+    }
+    value_t condition = AS_CONS(args)->car;
+    value_t then = AS_CONS(AS_CONS(args)->cdr)->car;
+    value_t otherwise = AS_CONS(AS_CONS(args)->cdr)->cdr;
+
+    compile(c, condition, false);
+    uint32_t else_jump = emit_jump(c, OP_JUMP_IF_FALSE, -1);
+
+    compile(c, then, tail);
+    uint32_t end_jump = emit_jump(c, OP_JUMP, 0);
+
+    patch_jump(c, else_jump);
+    c->depth--;
+    if (IS_NIL(otherwise)) {
+        emit_const(c, FALSE_VAL);
+    } else {
+        compile_body(c, otherwise, tail);
+    }
+    patch_jump(c, end_jump);
+    return true;
+}
+
+static bool compile_define(compiler_t *c, value_t args) {
+    int32_t len = cons_len(args);
+    if (len < 1) {
+        return false;
+    }
+    value_t target = AS_CONS(args)->car;
+
+    if (IS_SYMBOL(target) && len == 2) {  // (define <name> <body>)
+        compile(c, AS_CONS(AS_CONS(args)->cdr)->car, false);
+        emit_op_arg(c, OP_DEFINE, constant_add(c, target), 0);
+        return true;
+    } else if (IS_CONS(target) && IS_SYMBOL(AS_CONS(target)->car) &&
+               params_valid(AS_CONS(target)->cdr)) {
+        // (define (<name> <params...>) <body...>)
+        compile_lambda(c, AS_CONS(target)->cdr, AS_CONS(args)->cdr);
+        emit_op_arg(c, OP_DEFINE, constant_add(c, AS_CONS(target)->car), 0);
+        return true;
+    }
+    return false;
+}
+
+static bool compile_set(compiler_t *c, value_t args) {
+    // (set! <sym> <expr>)
+    if (cons_len(args) != 2) {
+        return false;
+    }
+    value_t target = AS_CONS(args)->car;
+    if (IS_LOCAL(target)) {
+        compile(c, AS_CONS(AS_CONS(args)->cdr)->car, false);
+        emit_op_arg(c, OP_SET_LOCAL, constant_add(c, target), 0);
+        return true;
+    } else if (IS_SYMBOL(target)) {
+        compile(c, AS_CONS(AS_CONS(args)->cdr)->car, false);
+        emit_op_arg(c, OP_SET, constant_add(c, target), 0);
+        return true;
+    }
+    return false;
+}
+
+static bool compile_let(compiler_t *c, value_t args, bool tail) {
+    // (let ((a 10) (b 20) ...) <exprs...>)
+    if (cons_len(args) < 2) {
+        return false;
+    }
+    value_t bindings = AS_CONS(args)->car;
+    int32_t count = cons_len(bindings);
+    if (count < 0 || count > UINT16_MAX) {
+        return false;
+    }
+    value_t binding, iter;
+    if (count > 0) {
+        SCM_FOREACH (binding, AS_CONS(bindings), iter) {
+            if (!IS_CONS(binding) || cons_len(binding) != 2 ||
+                !IS_SYMBOL(AS_CONS(binding)->car)) {
+                return false;
+            }
+        }
+        SCM_FOREACH (binding, AS_CONS(bindings), iter) {
+            compile(c, AS_CONS(AS_CONS(binding)->cdr)->car, false);
+        }
+    }
+
+    emit_op_arg(c, OP_LET, constant_add(c, bindings), -count);
+    emit_short(c, (uint16_t) count);
+
+    scope_t scope = {bindings, true, c->scope};
+    c->scope = &scope;
+    compile_body(c, AS_CONS(args)->cdr, tail);
+    c->scope = scope.up;
+
+    emit_op(c, OP_POP_ENV, 0);
+    return true;
+}
+
+// Compiles the arguments <args> of (and ...) or (or ...)
+// and:  the first #f makes the whole form #f
+// or:   the first #t makes the whole form #t
+static void compile_logic_args(compiler_t *c, uint32_t name, value_t args,
+                               bool is_and) {
+    compile(c, AS_CONS(args)->car, false);
+    emit_op_arg(c, OP_CHECK_BOOL, name, 0);
+
+    value_t rest = AS_CONS(args)->cdr;
+    if (IS_NIL(rest)) {
+        // the last argument is the result
+        return;
+    }
+
+    uint32_t next = emit_jump(c, OP_JUMP_IF_FALSE, -1);
+    if (is_and) {
+        compile_logic_args(c, name, rest, is_and);
+    } else {
+        emit_const(c, TRUE_VAL);
+    }
+    uint32_t end = emit_jump(c, OP_JUMP, 0);
+
+    patch_jump(c, next);
+    c->depth--;
+    if (is_and) {
+        emit_const(c, FALSE_VAL);
+    } else {
+        compile_logic_args(c, name, rest, is_and);
+    }
+    patch_jump(c, end);
+}
+
+// Compiles (and <args...>) or (or <args...>)
+static bool compile_logic(compiler_t *c, value_t head, value_t args,
+                          bool is_and) {
+    int32_t count = cons_len(args);
+    if (count < 0) {
+        return false;
+    }
+    if (count == 0) {
+        emit_const(c, BOOL_VAL(is_and));
+        return true;
+    }
+
+    compile_logic_args(c, constant_add(c, head), args, is_and);
+    return true;
+}
+
+// Tries to compile a special form <form> (with head <sym>) inline
+// Returns false if the form is not known or malformed
+static bool compile_special(compiler_t *c, symbol_t *sym, value_t form,
+                            bool tail) {
+    const char *name = sym->name;
+    value_t args = AS_CONS(form)->cdr;
+
+    if (strcmp(name, "quote") == 0) {
+        if (cons_len(args) != 1) {
+            return false;
+        }
+        emit_const(c, AS_CONS(args)->car);
+        return true;
+    } else if (strcmp(name, "if") == 0) {
+        return compile_if(c, args, tail);
+    } else if (strcmp(name, "define") == 0) {
+        return compile_define(c, args);
+    } else if (strcmp(name, "set!") == 0) {
+        return compile_set(c, args);
+    } else if (strcmp(name, "lambda") == 0) {
+        if (cons_len(args) < 1 || !params_valid(AS_CONS(args)->car)) {
+            return false;
+        }
+        compile_lambda(c, AS_CONS(args)->car, AS_CONS(args)->cdr);
+        return true;
+    } else if (strcmp(name, "begin") == 0) {
+        if (cons_len(args) < 0) {
+            return false;
+        }
+        compile_body(c, args, tail);
+        return true;
+    } else if (strcmp(name, "let") == 0) {
+        return compile_let(c, args, tail);
+    } else if (strcmp(name, "and") == 0) {
+        return compile_logic(c, PTR_VAL(sym), args, true);
+    } else if (strcmp(name, "or") == 0) {
+        return compile_logic(c, PTR_VAL(sym), args, false);
+    }
+    return false;
+}
+
+/* *** expressions *** */
+
+// Compiles an application, special forms and macros
+// not known at compile time are dealt with at runtime by FORM
+// <special> is true if the head was a special form when compiling,
+// the arguments are not compiled then
+static void compile_call(compiler_t *c, value_t form, bool tail,
+                         bool special) {
+    value_t args = AS_CONS(form)->cdr;
+    int32_t argc = cons_len(args);
+    bool proper = argc >= 0 && argc <= UINT16_MAX;
+    if (!proper && !special) {
+        error_runtime(c->vm, "compile: arguments are not a proper list!");
+    }
+    if (!proper || special) {
+        argc = 0;
+    }
+
+    compile(c, AS_CONS(form)->car, false);
+
+    emit_op_arg(c, OP_FORM, constant_add(c, form), 0);
+    uint32_t skip = c->code->count;
+    emit_short(c, 0xffff);
+
+    value_t arg, iter;
+    if (argc > 0) {
+        SCM_FOREACH (arg, AS_CONS(args), iter) { compile(c, arg, false); }
+    }
+    emit_op_arg(c, tail ? OP_TAIL_CALL : OP_CALL, argc, -argc);
+
+    patch_jump(c, skip);
+}
+
+static void compile_cons(compiler_t *c, value_t form, bool tail) {
+    value_t head = AS_CONS(form)->car;
+
+    if (IS_SYMBOL(head) && !is_local(c, AS_SYMBOL(head))) {
+        value_t found = lookup(c->env, AS_SYMBOL(head));
+
+        if (IS_MACRO(found)) {
+            // expand the macro once, now
+            vm_t *vm = c->vm;
+            value_t *top = vm->stack_top;
+            if (!vm_stack_check(vm, 1)) {
+                emit_const(c, UNDEFINED_VAL);
+                return;
+            }
+            value_t expanded = expand(vm, c->env, form);
+            *vm->stack_top++ = expanded;
+            compile(c, expanded, tail);
+            vm_stack_restore(vm, top);
+            return;
+        }
+
+        if (IS_SPECIAL(found)) {
+            if (AS_PRIMITIVE(found)->name != AS_SYMBOL(head) ||
+                !compile_special(c, AS_SYMBOL(head), form, tail)) {
+                compile_call(c, form, tail, true);
+            }
+            return;
+        }
+    }
+
+    compile_call(c, form, tail, false);
+}
+
+static void compile(compiler_t *c, value_t val, bool tail) {
+    if (IS_SYMBOL(val)) {
+        emit_op_arg(c, OP_GET, constant_add(c, val), 1);
+    } else if (IS_LOCAL(val)) {
+        emit_op_arg(c, OP_GET_LOCAL, constant_add(c, val), 1);
+    } else if (IS_EXPANSION(val)) {
+        compile(c, AS_EXPANSION(val)->expanded, tail);
+    } else if (IS_CONS(val)) {
+        compile_cons(c, val, tail);
+    } else {
+        // self-evaluating
+        emit_const(c, val);
+    }
+}
+
+// Compiles expressions in order, leaving the last one on the stack
+static void compile_body(compiler_t *c, value_t body, bool tail) {
+    if (!IS_CONS(body)) {
+        emit_const(c, VOID_VAL);
+        return;
+    }
+    for (value_t iter = body; IS_CONS(iter); iter = AS_CONS(iter)->cdr) {
+        bool last = !IS_CONS(AS_CONS(iter)->cdr);
+        compile(c, AS_CONS(iter)->car, tail && last);
+        if (!last) {
+            emit_op(c, OP_POP, -1);
+        }
+    }
+}
+
+code_t *code_compile_function(vm_t *vm, function_t *func) {
+    if (func->code != NULL) {
+        return func->code;
+    }
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 1)) {
+        return NULL;
+    }
+
+    code_t *code = code_new(vm, func->params, func->body);
+    *vm->stack_top++ = PTR_VAL(code);
+
+    scope_t scope = {func->params, false, NULL};
+    compiler_t c = {vm, code, func->env, &scope, 0};
+
+    compile_body(&c, func->body, true);
+    emit_op(&c, OP_RETURN, -1);
+
+    vm_stack_restore(vm, top);
+    func->code = code;
+    vm_write_barrier(vm, &func->p, PTR_VAL(code));
+    return code;
+}
+
+/* /== ------------------------ ==\ */
+/* *** the bytecode interpreter *** */
+/* \== ------------------------ ==/ */
+
+// Throws away all frames above <entry> (an unrecoverable error)
+static value_t unwind(vm_t *vm, size_t entry) {
+    vm_stack_restore(vm, vm->frames[entry].base);
+    vm->num_frames = entry;
+    return UNDEFINED_VAL;
+}
+
+// Pushes a new frame running <code> in <env>
+// (<base> is where the stack returns to after it)
+static bool frame_push(vm_t *vm, code_t *code, env_t *env, value_t *base) {
+    if (!vm_stack_check(vm, code->max_stack)) {
+        return false;
+    }
+    frame_t *frame = vm_push_frame(vm);
+    if (frame == NULL) {
+        return false;
+    }
+    frame->code = code;
+    frame->ip = code->bytes;
+    frame->env = env;
+    frame->base = base;
+    frame->rest = NIL_VAL;
+    frame->argc = 0;
+    frame->next = NULL;
+    return true;
+}
+
+// If <val> is an unnamed function, names it <sym>
+static inline void function_name(vm_t *vm, value_t val, value_t sym) {
+    if (IS_FUNCTION(val) && AS_FUNCTION(val)->name == NULL) {
+        AS_FUNCTION(val)->name = AS_SYMBOL(sym);
+        vm_write_barrier(vm, AS_PTR(val), sym);
+    }
+}
+
+// Runs the topmost frame until the frame <entry> returns
+static value_t run(vm_t *vm, size_t entry) {
+    frame_t *frame;
+    uint8_t *ip;
+    value_t *constants;
+
+#define LOAD_FRAME()                             \
+    do {                                         \
+        frame = &vm->frames[vm->num_frames - 1]; \
+        ip = frame->ip;                          \
+        constants = frame->code->constants;      \
+    } while (false)
+#define STORE_FRAME() (frame->ip = ip)
+// frames may have been reallocated by a nested call
+#define REFRESH_FRAME() (frame = &vm->frames[vm->num_frames - 1])
+
+#define READ_SHORT() (ip += 2, (uint16_t)(ip[-2] | (ip[-1] << 8)))
+#define PUSH(val) (*vm->stack_top++ = (val))
+#define POP() (*--vm->stack_top)
+#define PEEK(n) (vm->stack_top[-1 - (n)])
+
+#if COMPUTED_GOTO
+#define OPCODE_LABEL(name) &&code_##name,
+    static void *dispatch_table[] = {OPCODES(OPCODE_LABEL)};
+#undef OPCODE_LABEL
+
+#define INTERPRET_LOOP DISPATCH();
+#define CASE_CODE(name) code_##name
+#define DISPATCH() goto *dispatch_table[*ip++]
+#else
+#define INTERPRET_LOOP \
+    loop:              \
+    switch (*ip++)
+#define CASE_CODE(name) case OP_##name
+#define DISPATCH() goto loop
+#endif
+
+    LOAD_FRAME();
+
+    INTERPRET_LOOP {
+        CASE_CODE(CONST) : {
+            PUSH(constants[READ_SHORT()]);
+            DISPATCH();
+        }
+
+        CASE_CODE(GET) : {
+            symbol_t *sym = AS_SYMBOL(constants[READ_SHORT()]);
+            value_t val = find(frame->env, sym);
+            if (IS_UNDEFINED(val)) {
+                error_runtime(vm, "|eval: Can't eval %s - symbol not bound!",
+                              sym->name);
+            }
+            PUSH(val);
+            DISPATCH();
+        }
+
+        CASE_CODE(SET) : {
+            symbol_t *sym = AS_SYMBOL(constants[READ_SHORT()]);
+            value_t result = find_replace(vm, frame->env, sym, PEEK(0));
+            if (IS_UNDEFINED(result)) {
+                error_runtime(vm,
+                              "set!: assignment not allowed - %s is undefined!",
+                              sym->name);
+            }
+            PEEK(0) = VOID_VAL;
+            DISPATCH();
+        }
+
+        CASE_CODE(GET_LOCAL) : {
+            local_t *local = AS_LOCAL(constants[READ_SHORT()]);
+            value_t val = local_get(frame->env, local);
+            if (IS_UNDEFINED(val)) {
+                error_runtime(vm, "|eval: Can't eval %s - symbol not bound!",
+                              local->name->name);
+            }
+            PUSH(val);
+            DISPATCH();
+        }
+
+        CASE_CODE(SET_LOCAL) : {
+            local_t *local = AS_LOCAL(constants[READ_SHORT()]);
+            value_t result = local_set(vm, frame->env, local, PEEK(0));
+            if (IS_UNDEFINED(result)) {
+                error_runtime(vm,
+                              "set!: assignment not allowed - %s is undefined!",
+                              local->name->name);
+            }
+            PEEK(0) = VOID_VAL;
+            DISPATCH();
+        }
+
+        CASE_CODE(DEFINE) : {
+            value_t sym = constants[READ_SHORT()];
+            function_name(vm, PEEK(0), sym);
+            variable_add(vm, frame->env, AS_SYMBOL(sym), PEEK(0));
+            PEEK(0) = VOID_VAL;
+            DISPATCH();
+        }
+
+        CASE_CODE(POP) : {
+            vm->stack_top--;
+            DISPATCH();
+        }
+
+        CASE_CODE(JUMP) : {
+            uint16_t offset = READ_SHORT();
+            ip += offset;
+            DISPATCH();
+        }
+
+        CASE_CODE(JUMP_IF_FALSE) : {
+            uint16_t offset = READ_SHORT();
+            value_t condition = POP();
+            if (!AS_BOOL(condition)) {
+                ip += offset;
+            }
+            DISPATCH();
+        }
+
+        CASE_CODE(CHECK_BOOL) : {
+            symbol_t *name = AS_SYMBOL(constants[READ_SHORT()]);
+            if (!IS_BOOL(PEEK(0))) {
+                error_runtime(vm, "%s: argument is not a bool!", name->name);
+            }
+            DISPATCH();
+        }
+
+        CASE_CODE(LAMBDA) : {
+            code_t *code = AS_CODE(constants[READ_SHORT()]);
+            function_t *func =
+                function_new(vm, frame->env, code->params, code->body);
+            func->code = code;
+            PUSH(PTR_VAL(func));
+            DISPATCH();
+        }
+
+        CASE_CODE(FORM) : {
+            value_t form = constants[READ_SHORT()];
+            uint16_t offset = READ_SHORT();
+            value_t fn = PEEK(0);
+
+            if (IS_SPECIAL(fn)) {
+                STORE_FRAME();
+                value_t args = AS_CONS(form)->cdr;
+                value_t result =
+                    special_call(vm, frame->env, AS_PRIMITIVE(fn), args);
+                REFRESH_FRAME();
+                PEEK(0) = result;
+                ip += offset;
+            } else if (IS_MACRO(fn)) {
+                // a macro we didn't know about when compiling
+                STORE_FRAME();
+                value_t *top = vm->stack_top;
+                if (!vm_stack_check(vm, 1)) {
+                    return unwind(vm, entry);
+                }
+                value_t args = AS_CONS(form)->cdr;
+                value_t *expanded = vm->stack_top++;
+                *expanded = NIL_VAL;
+                *expanded = apply(vm, frame->env, fn, args);
+                REFRESH_FRAME();
+                value_t result = eval(vm, frame->env, *expanded);
+                REFRESH_FRAME();
+                vm_stack_restore(vm, top);
+                PEEK(0) = result;
+                ip += offset;
+            }
+            DISPATCH();
+        }
+
+        CASE_CODE(CALL) : {
+            uint16_t argc = READ_SHORT();
+            value_t *slot = vm->stack_top - argc - 1;
+            value_t fn = *slot;
+            STORE_FRAME();
+
+            if (IS_FUNCTION(fn)) {
+                function_t *func = AS_FUNCTION(fn);
+                code_t *code = code_compile_function(vm, func);
+                if (code == NULL) {
+                    return unwind(vm, entry);
+                }
+                env_t *env = env_push(vm, func->env, func->params, argc, slot + 1);
+                vm->stack_top = slot;
+                if (!frame_push(vm, code, env, slot)) {
+                    return unwind(vm, entry);
+                }
+                LOAD_FRAME();
+            } else {
+                if (!IS_PROCEDURE(fn)) {
+                    error_runtime(vm,
+                                  "|eval: Car of eval'd cons is not a procedure!");
+                }
+                value_t result = call(vm, frame->env, fn, argc, slot + 1);
+                REFRESH_FRAME();
+                vm->stack_top = slot;
+                PUSH(result);
+            }
+            DISPATCH();
+        }
+
+        CASE_CODE(TAIL_CALL) : {
+            uint16_t argc = READ_SHORT();
+            value_t *slot = vm->stack_top - argc - 1;
+            value_t fn = *slot;
+            STORE_FRAME();
+
+            if (IS_FUNCTION(fn)) {
+                function_t *func = AS_FUNCTION(fn);
+                code_t *code = code_compile_function(vm, func);
+                if (code == NULL) {
+                    return unwind(vm, entry);
+                }
+                env_t *env = env_push(vm, func->env, func->params, argc, slot + 1);
+                REFRESH_FRAME();
+
+                // the new function replaces the current one
+                vm_stack_restore(vm, frame->base);
+                if (!vm_stack_check(vm, code->max_stack)) {
+                    return unwind(vm, entry);
+                }
+                frame->code = code;
+                frame->ip = code->bytes;
+                frame->env = env;
+                LOAD_FRAME();
+                DISPATCH();
+            }
+
+            if (!IS_PROCEDURE(fn)) {
+                error_runtime(vm,
+                              "|eval: Car of eval'd cons is not a procedure!");
+            }
+            value_t result = call(vm, frame->env, fn, argc, slot + 1);
+            REFRESH_FRAME();
+            vm->stack_top = slot;
+            PUSH(result);
+            goto do_return;
+        }
+
+        CASE_CODE(RETURN) :
+        do_return : {
+            value_t result = POP();
+            vm_stack_restore(vm, frame->base);
+            vm->num_frames--;
+            if (vm->num_frames == entry) {
+                return result;
+            }
+            PUSH(result);
+            LOAD_FRAME();
+            DISPATCH();
+        }
+
+        CASE_CODE(LET) : {
+            value_t bindings = constants[READ_SHORT()];
+            uint16_t count = READ_SHORT();
+            value_t *vals = vm->stack_top - count;
+
+            env_t *env = env_new(vm, bindings, true, count, frame->env);
+            frame->env = env;
+
+            for (uint16_t i = 0; i < count; i++) {
+                value_t sym = AS_CONS(AS_CONS(bindings)->car)->car;
+                function_name(vm, vals[i], sym);
+                env->slots[i] = vals[i];
+                bindings = AS_CONS(bindings)->cdr;
+            }
+            vm->stack_top = vals;
+            DISPATCH();
+        }
+
+        CASE_CODE(POP_ENV) : {
+            frame->env = frame->env->up;
+            DISPATCH();
+        }
+    }
+
+    // unreachable
+    return UNDEFINED_VAL;
+
+#undef LOAD_FRAME
+#undef STORE_FRAME
+#undef REFRESH_FRAME
+#undef READ_SHORT
+#undef PUSH
+#undef POP
+#undef PEEK
+#undef INTERPRET_LOOP
+#undef CASE_CODE
+#undef DISPATCH
+}
+
+/* *** entry points *** */
+
+// Returns true if <val> is (begin ...) with the builtin begin
+static bool is_begin(env_t *env, value_t val) {
+    if (!IS_CONS(val) || !IS_SYMBOL(AS_CONS(val)->car)) {
+        return false;
+    }
+    symbol_t *sym = AS_SYMBOL(AS_CONS(val)->car);
+    value_t found = lookup(env, sym);
+    return IS_SPECIAL(found) && AS_PRIMITIVE(found)->name == sym &&
+           strcmp(sym->name, "begin") == 0 && cons_len(val) > 0;
+}
+
+value_t code_eval(vm_t *vm, env_t *env, value_t val) {
+    value_t *top = vm->stack_top;
+    if (!vm_native_check(vm) || !vm_stack_check(vm, 2)) {
+        return UNDEFINED_VAL;
+    }
+    value_t *slot = vm->stack_top++;
+    *slot = val;
+
+    value_t result = VOID_VAL;
+    if (is_begin(env, val)) {
+        // Forms in (begin ...) are compiled one after another
+        // so that macros defined in them can be used later on
+        value_t arg, iter;
+        SCM_FOREACH (arg, AS_CONS(AS_CONS(val)->cdr), iter) {
+            result = code_eval(vm, env, arg);
+        }
+        vm_stack_restore(vm, top);
+        return result;
+    }
+
+    *slot = val = resolve(vm, env, val);
+
+    code_t *code = code_new(vm, NIL_VAL, val);
+    *vm->stack_top++ = PTR_VAL(code);
+
+    compiler_t c = {vm, code, env, NULL, 0};
+    compile(&c, val, true);
+    emit_op(&c, OP_RETURN, -1);
+
+    size_t entry = vm->num_frames;
+    if (frame_push(vm, code, env, vm->stack_top)) {
+        vm->native_depth++;
+        result = run(vm, entry);
+        vm->native_depth--;
+    } else {
+        result = UNDEFINED_VAL;
+    }
+
+    vm_stack_restore(vm, top);
+    return result;
+}
+
+value_t code_call(vm_t *vm, function_t *func, int argc, value_t *args) {
+    if (!vm_native_check(vm)) {
+        return UNDEFINED_VAL;
+    }
+    code_t *code = code_compile_function(vm, func);
+    if (code == NULL) {
+        return UNDEFINED_VAL;
+    }
+    env_t *env = env_push(vm, func->env, func->params, argc, args);
+
+    size_t entry = vm->num_frames;
+    if (!frame_push(vm, code, env, vm->stack_top)) {
+        return UNDEFINED_VAL;
+    }
+    vm->native_depth++;
+    value_t result = run(vm, entry);
+    vm->native_depth--;
+    return result;
+}
+
+#if DEBUG
+void code_dump(FILE *f, code_t *code) {
+    static const char *names[] = {
+#define OPCODE_NAME(name) #name,
+        OPCODES(OPCODE_NAME)
+#undef OPCODE_NAME
+    };
+    static const int num_args[] = {1, 1, 1, 1, 1, 1, 0, 1, 1,
+                                   1, 1, 2, 1, 1, 0, 2, 0};
+
+    for (uint32_t i = 0; i < code->count;) {
+        uint8_t op = code->bytes[i];
+        fprintf(f, "%4u %-14s", i, names[op]);
+        i++;
+        for (int j = 0; j < num_args[op]; j++) {
+            uint16_t arg = code->bytes[i] | (code->bytes[i + 1] << 8);
+            fprintf(f, " %u", arg);
+            i += 2;
+        }
+        if (op == OP_CONST || op == OP_GET || op == OP_SET ||
+            op == OP_GET_LOCAL || op == OP_SET_LOCAL || op == OP_DEFINE) {
+            fprintf(f, "  ; ");
+            write(f, code->constants[code->bytes[i - 2] |
+                                     (code->bytes[i - 1] << 8)]);
+        }
+        fprintf(f, "\n");
+    }
+}
+#endif  // DEBUG
@@ -0,0 +1,71 @@
+#ifndef _code_h
+#define _code_h
+
+#include <stdio.h>  // FILE
+
+#include "config.h"
+#include "scheme.h"
+#include "value.h"  // code_t, function_t, value_t
+
+// All opcodes of the bytecode interpreter
+// Operands are 16-bit unsigned integers (little-endian)
+//
+// CONST <k>          pushes the constant <k>
+// GET <k>            pushes the value of the variable (symbol constant <k>)
+// SET <k>            pops a value and assigns it to the variable <k>
+// GET_LOCAL <k>      pushes the value of the local variable
+//                    (resolved reference constant <k>, see resolve.h)
+// SET_LOCAL <k>      pops a value and assigns it to the local variable <k>
+// DEFINE <k>         pops a value and defines the variable <k> with it
+// POP                pops a value
+// JUMP <n>           jumps <n> bytes forward
+// JUMP_IF_FALSE <n>  pops a value, if it's false, jumps <n> bytes forward
+// CHECK_BOOL <k>     errors if the top isn't a bool (<k> is the name)
+// LAMBDA <k>         creates a function from the code constant <k>
+// FORM <k> <n>       if the top is a special form or a macro,
+//                    evaluates the form constant <k> with it and jumps <n>
+// CALL <n>           calls the value below <n> arguments
+// TAIL_CALL <n>      the same as CALL, but reuses the current frame
+// RETURN             returns the top from the current frame
+// LET <k> <n>        binds <n> values to the symbols in constant <k>
+//                    in a new environment
+// POP_ENV            leaves the environment created by LET
+#define OPCODES(X) \
+    X(CONST)       \
+    X(GET)         \
+    X(SET)         \
+    X(GET_LOCAL)   \
+    X(SET_LOCAL)   \
+    X(DEFINE)      \
+    X(POP)         \
+    X(JUMP)        \
+    X(JUMP_IF_FALSE) \
+    X(CHECK_BOOL)  \
+    X(LAMBDA)      \
+    X(FORM)        \
+    X(CALL)        \
+    X(TAIL_CALL)   \
+    X(RETURN)      \
+    X(LET)         \
+    X(POP_ENV)
+
+#define OPCODE_ENUM(name) OP_##name,
+typedef enum { OPCODES(OPCODE_ENUM) } opcode_t;
+#undef OPCODE_ENUM
+
+// Compiles the function <func> if it wasn't compiled yet
+code_t *code_compile_function(vm_t *vm, function_t *func);
+
+// Compiles <val> and evaluates it in <env>
+value_t code_eval(vm_t *vm, env_t *env, value_t val);
+
+// Calls the function (or macro) <func>
+// with <argc> evaluated arguments in <args>
+value_t code_call(vm_t *vm, function_t *func, int argc, value_t *args);
+
+#if DEBUG
+// Prints the bytecode of <code> to <f>
+void code_dump(FILE *f, code_t *code);
+#endif  // DEBUG
+
+#endif  // _code_h
@@ -11,4 +11,62 @@
 #define NOGC 0
 #endif
 
+// Allocate every value but conses with config.realloc_fn instead of
+// the pools (useful with valgrind or sanitizers, which then see each value)
+#ifndef NOPOOL
+#define NOPOOL 0
+#endif
+
+// Map the chunks of pages of the heap with mmap instead of allocating them
+// with config.realloc_fn, so that they can be given back a page at a time
+// (and backed by huge pages, see heap_huge_pages in scm_config_t)
+#ifndef MMAP
+#if defined(__unix__) || defined(__APPLE__)
+#define MMAP 1
+#else
+#define MMAP 0
+#endif
+#endif
+
+// Scan the native stack and the registers for values in collections
+// (conservatively - a word which looks like a pointer into a value keeps
+// it alive), so that C code called by eval can keep values in locals
+// without pushing them to the value stack, needs setjmp to spill
+// the registers and a stack which grows down
+#ifndef CONSERVATIVE
+#define CONSERVATIVE 0
+#endif
+
+// Measure the pauses of the GC and the time between them with
+// a monotonic clock (clock_gettime), otherwise with clock(), which is
+// the CPU time of all threads (the marking ones and the sweeper too)
+#ifndef MONOTONIC_CLOCK
+#if defined(__unix__) || defined(__APPLE__)
+#define MONOTONIC_CLOCK 1
+#else
+#define MONOTONIC_CLOCK 0
+#endif
+#endif
+
+// Mark values with several threads in major collections
+// (see gc_threads in scm_config_t), needs POSIX threads
+// and the atomic builtins of GCC/Clang
+#ifndef THREADS
+#if defined(__GNUC__) && (defined(__unix__) || defined(__APPLE__))
+#define THREADS 1
+#else
+#define THREADS 0
+#endif
+#endif
+
+// Use computed gotos for dispatching in the bytecode interpreter
+// (needs the "labels as values" extension of GCC/Clang)
+#ifndef COMPUTED_GOTO
+#if defined(__GNUC__)
+#define COMPUTED_GOTO 1
+#else
+#define COMPUTED_GOTO 0
+#endif
+#endif
+
 #endif  // _config_h
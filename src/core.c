@@ -1,9 +1,11 @@
 #include <math.h>    // fmod
 #include <stdarg.h>  // va_list
 #include <stdio.h>   // FILE
+#include <string.h>  // memcpy
 #include <time.h>    // clock(), CLOCKS_PER_SECOND
 
 #include "core.h"
+#include "resolve.h"  // resolve_lambda, resolve_define, resolve_let
 #include "scheme.h"
 #include "value.h"
 #include "vm.h"
@@ -11,9 +13,8 @@
 
 // Checks if there are exactly n arguments (if at_least is false)
 //                  or at least n arguments (if at_least is true)
-bool arity_check(vm_t *vm, const char *fn_name, value_t args, int n,
+bool arity_check(vm_t *vm, const char *fn_name, int argc, int n,
                  bool at_least) {
-    int argc = cons_len(args);
     if (!at_least) {  // exactly
         if (argc != n) {
             error_runtime(vm, "%s: not enough args: %d expected, %d given!",
@@ -40,11 +41,13 @@ bool arity_check(vm_t *vm, const char *fn_name, value_t args, int n,
 // as C functions 'builtin_<name>'.
 // These still have to be put into scm_config_default to be registered!
 #define BUILTIN_NUM_FN(name, op)                                            \
-    static value_t builtin_##name(vm_t *vm, env_t *env, value_t args) {     \
-        value_t eargs = eval_list(vm, env, args);                           \
-        arity_check(vm, "builtin" #op, eargs, 2, false);                    \
-        value_t a = AS_CONS(eargs)->car;                                    \
-        value_t b = AS_CONS(AS_CONS(eargs)->cdr)->car;                      \
+    static value_t builtin_##name(vm_t *vm, env_t *env, int argc,           \
+                                  value_t *args) {                          \
+        if (!arity_check(vm, "builtin" #op, argc, 2, false)) {              \
+            return UNDEFINED_VAL;                                           \
+        }                                                                   \
+        value_t a = args[0];                                                \
+        value_t b = args[1];                                                \
         if (!IS_NUM(a) || !IS_NUM(b)) {                                     \
             error_runtime(vm, "builtin" #op ": argument is not a number!"); \
             return NIL_VAL;                                                 \
@@ -57,12 +60,13 @@ BUILTIN_NUM_FN(mul, *)
 BUILTIN_NUM_FN(sub, -)
 BUILTIN_NUM_FN(div, /)
 
-static value_t builtin_rem(vm_t *vm, env_t *env, value_t args) {
+static value_t builtin_rem(vm_t *vm, env_t *env, int argc, value_t *args) {
     // (remainder <n> <m>) => n `rem` m
-    value_t eargs = eval_list(vm, env, args);
-    arity_check(vm, "remainder", args, 2, false);
-    value_t n = AS_CONS(eargs)->car;
-    value_t m = AS_CONS(AS_CONS(eargs)->cdr)->car;
+    if (!arity_check(vm, "remainder", argc, 2, false)) {
+        return UNDEFINED_VAL;
+    }
+    value_t n = args[0];
+    value_t m = args[1];
 
     if (!IS_NUM(n) || !IS_NUM(m)) {
         error_runtime(vm, "remainder: argument is not a number!");
@@ -73,11 +77,13 @@ static value_t builtin_rem(vm_t *vm, env_t *env, value_t args) {
 }
 
 #define BUILTIN_NUM_COMP(name, op, scm_name)                                \
-    static value_t builtin_num_##name(vm_t *vm, env_t *env, value_t args) { \
-        value_t eargs = eval_list(vm, env, args);                           \
-        arity_check(vm, scm_name, eargs, 2, false);                         \
-        value_t a = AS_CONS(eargs)->car;                                    \
-        value_t b = AS_CONS(AS_CONS(eargs)->cdr)->car;                      \
+    static value_t builtin_num_##name(vm_t *vm, env_t *env, int argc,       \
+                                      value_t *args) {                      \
+        if (!arity_check(vm, scm_name, argc, 2, false)) {                   \
+            return UNDEFINED_VAL;                                           \
+        }                                                                   \
+        value_t a = args[0];                                                \
+        value_t b = args[1];                                                \
         if (!IS_NUM(a) || !IS_NUM(b)) {                                     \
             error_runtime(vm, #scm_name ": argument is not a number!");     \
             return NIL_VAL;                                                 \
@@ -89,60 +95,126 @@ BUILTIN_NUM_COMP(gt, >, "builtin>")
 BUILTIN_NUM_COMP(lt, <, "builtin<")
 BUILTIN_NUM_COMP(eq, ==, "builtin=")
 
+// Checks that all <argc> arguments in <args> of <fn_name> are numbers
+static bool num_args_check(vm_t *vm, const char *fn_name, int argc,
+                           value_t *args) {
+    for (int i = 0; i < argc; i++) {
+        if (!IS_NUM(args[i])) {
+            error_runtime(vm, "%s: argument is not a number!", fn_name);
+            return false;
+        }
+    }
+    return true;
+}
+
+// The variadic numeric procedures are C functions 'builtin_num_<name>'.
+// None of them allocates anything, two numbers are the fast path.
+
+// (<op> <n...>) => <init> <op> n1 <op> n2 ...
+#define NUM_FOLD_FN(name, op, init, scm_name)                            \
+    static value_t builtin_num_##name(vm_t *vm, env_t *env, int argc,    \
+                                      value_t *args) {                   \
+        if (argc == 2 && IS_NUM(args[0]) && IS_NUM(args[1])) {           \
+            return NUM_VAL(AS_NUM(args[0]) op AS_NUM(args[1]));          \
+        }                                                                \
+        if (!num_args_check(vm, scm_name, argc, args)) {                 \
+            return NIL_VAL;                                              \
+        }                                                                \
+        double result = init;                                            \
+        for (int i = 0; i < argc; i++) {                                 \
+            result = result op AS_NUM(args[i]);                          \
+        }                                                                \
+        return NUM_VAL(result);                                          \
+    }
+
+// (<op> <n>) => <init> <op> n
+// (<op> <n> <m...>) => n <op> (m1 <fold_op> m2 ...)
+#define NUM_INVERSE_FN(name, op, fold_op, init, scm_name)                \
+    static value_t builtin_num_##name(vm_t *vm, env_t *env, int argc,    \
+                                      value_t *args) {                   \
+        if (argc == 2 && IS_NUM(args[0]) && IS_NUM(args[1])) {           \
+            return NUM_VAL(AS_NUM(args[0]) op AS_NUM(args[1]));          \
+        }                                                                \
+        if (!arity_check(vm, scm_name, argc, 1, true) ||                 \
+            !num_args_check(vm, scm_name, argc, args)) {                 \
+            return NIL_VAL;                                              \
+        }                                                                \
+        if (argc == 1) {                                                 \
+            return NUM_VAL(init op AS_NUM(args[0]));                     \
+        }                                                                \
+        double rest = AS_NUM(args[1]);                                   \
+        for (int i = 2; i < argc; i++) {                                 \
+            rest = rest fold_op AS_NUM(args[i]);                         \
+        }                                                                \
+        return NUM_VAL(AS_NUM(args[0]) op rest);                         \
+    }
+
+// (<op> <n...>) => #t if (n1 <op> n2), (n2 <op> n3), ... all hold
+#define NUM_COMPARE_FN(name, op, scm_name)                               \
+    static value_t builtin_num_##name(vm_t *vm, env_t *env, int argc,    \
+                                      value_t *args) {                   \
+        if (argc == 2 && IS_NUM(args[0]) && IS_NUM(args[1])) {           \
+            return BOOL_VAL(AS_NUM(args[0]) op AS_NUM(args[1]));         \
+        }                                                                \
+        if (!num_args_check(vm, scm_name, argc, args)) {                 \
+            return NIL_VAL;                                              \
+        }                                                                \
+        for (int i = 1; i < argc; i++) {                                 \
+            if (!(AS_NUM(args[i - 1]) op AS_NUM(args[i]))) {             \
+                return FALSE_VAL;                                        \
+            }                                                            \
+        }                                                                \
+        return TRUE_VAL;                                                 \
+    }
+
+NUM_FOLD_FN(add, +, 0, "+")
+NUM_FOLD_FN(mul, *, 1, "*")
+NUM_INVERSE_FN(sub, -, +, 0, "-")
+NUM_INVERSE_FN(div, /, *, 1, "/")
+
+NUM_COMPARE_FN(eq_all, ==, "=")
+NUM_COMPARE_FN(lt_all, <, "<")
+NUM_COMPARE_FN(gt_all, >, ">")
+NUM_COMPARE_FN(le_all, <=, "<=")
+NUM_COMPARE_FN(ge_all, >=, ">=")
+
 /* *** core - types and predicates *** */
 
 // Checks for eq? using the val_eq function from value.h
 // BEWARE: It assumes transitivity (tries only a == b && b == c && c == d ...)
-static value_t eq(vm_t *vm, env_t *env, value_t args) {
-    if (IS_NIL(args)) {
-        return TRUE_VAL;
-    }
-    value_t eargs = eval_list(vm, env, args);
-    value_t prev = NIL_VAL;
-    value_t arg, iter;
-    SCM_FOREACH (arg, AS_CONS(eargs), iter) {
-        if (!IS_NIL(prev)) {
-            // if we find a pair where the 'eq?' relation doesn't hold,
-            // return false
-            if (!val_eq(prev, arg)) {
-                return FALSE_VAL;
-            }
+static value_t eq(vm_t *vm, env_t *env, int argc, value_t *args) {
+    for (int i = 1; i < argc; i++) {
+        // if we find a pair where the 'eq?' relation doesn't hold,
+        // return false
+        if (!val_eq(args[i - 1], args[i])) {
+            return FALSE_VAL;
         }
-        prev = arg;
     }
     return TRUE_VAL;
 }
 
 // Checks for equal? using the val_equal function from value.h
 // BEWARE: It assumes transitivity (tries only a == b && b == c && c == d ...)
-static value_t equal(vm_t *vm, env_t *env, value_t args) {
-    if (IS_NIL(args)) {
-        return TRUE_VAL;
-    }
-    value_t eargs = eval_list(vm, env, args);
-    value_t prev = NIL_VAL;
-    value_t arg, iter;
-    SCM_FOREACH (arg, AS_CONS(eargs), iter) {
-        if (!IS_NIL(prev)) {
-            // if we find a pair where the 'equal?' relation doesn't hold,
-            // return false
-            if (!val_equal(prev, arg)) {
-                return FALSE_VAL;
-            }
+static value_t equal(vm_t *vm, env_t *env, int argc, value_t *args) {
+    for (int i = 1; i < argc; i++) {
+        // if we find a pair where the 'equal?' relation doesn't hold,
+        // return false
+        if (!val_equal(args[i - 1], args[i])) {
+            return FALSE_VAL;
         }
-        prev = arg;
     }
     return TRUE_VAL;
 }
 
 // these ARE NOT added to environment automatically
 // therefore any change here must be done also in <scm_env_default> fn
-#define TYPE_PREDICATE_FN(type, is_type_fn)                                \
-    static value_t builtin_is_##type(vm_t *vm, env_t *env, value_t args) { \
-        value_t eargs = eval_list(vm, env, args);                          \
-        arity_check(vm, #type "?", eargs, 1, false);                       \
-        value_t a = AS_CONS(eargs)->car;                                   \
-        return BOOL_VAL(is_type_fn(a));                                    \
+#define TYPE_PREDICATE_FN(type, is_type_fn)                            \
+    static value_t builtin_is_##type(vm_t *vm, env_t *env, int argc,   \
+                                     value_t *args) {                  \
+        if (!arity_check(vm, #type "?", argc, 1, false)) {             \
+            return UNDEFINED_VAL;                                      \
+        }                                                              \
+        return BOOL_VAL(is_type_fn(args[0]));                          \
     }
 
 TYPE_PREDICATE_FN(cons, IS_CONS)
@@ -152,47 +224,72 @@ TYPE_PREDICATE_FN(string, IS_STRING)
 TYPE_PREDICATE_FN(symbol, IS_SYMBOL)
 TYPE_PREDICATE_FN(procedure, IS_PROCEDURE)
 TYPE_PREDICATE_FN(vector, IS_VECTOR)
+TYPE_PREDICATE_FN(hash, IS_HASHTABLE)
 TYPE_PREDICATE_FN(environment, IS_ENV)
 
-static value_t builtin_void(vm_t *vm, env_t *env, value_t args) {
+static value_t builtin_void(vm_t *vm, env_t *env, int argc, value_t *args) {
     return VOID_VAL;
 }
 
-static value_t builtin_undefined(vm_t *vm, env_t *env, value_t args) {
+static value_t builtin_undefined(vm_t *vm, env_t *env, int argc,
+                                 value_t *args) {
     return UNDEFINED_VAL;
 }
 
 /* *** core - special constructs - flow control *** */
 
-static value_t builtin_define(vm_t *vm, env_t *env, value_t args) {
+// The special forms evaluate their subexpressions in frames of eval
+// (see special_fn), the functions getting the values are *_next
+
+// Gets the value <val> of (define <name> <body>)
+static value_t define_next(vm_t *vm, frame_t *frame, value_t val,
+                           env_t **tail_env) {
+    symbol_t *sym = AS_SYMBOL(AS_CONS(frame->rest)->car);
+
+    if (IS_FUNCTION(val)) {
+        // If <body> is a nameless function, set its name to <name>
+        // (we won't do any renaming...)
+        function_t *func = AS_FUNCTION(val);
+        if (func->name == NULL) {
+            func->name = sym;
+            vm_write_barrier(vm, &func->p, PTR_VAL(sym));
+        }
+    }
+    variable_add(vm, frame->env, sym, val);
+
+    special_frame_pop(vm, frame);
+    return VOID_VAL;
+}
+
+static value_t builtin_define(vm_t *vm, env_t *env, value_t args,
+                              env_t **tail_env) {
     cons_t *rest = AS_CONS(args);
 
     if (IS_SYMBOL(rest->car)) {  // (define <name> <body>)
-        symbol_t *sym = AS_SYMBOL(rest->car);
-        value_t body = AS_CONS(rest->cdr)->car;
-        value_t val = eval(vm, env, body);
-
-        if (IS_FUNCTION(val)) {
-            // If <body> is a nameless function, set its name to <name>
-            // (we won't do any renaming...)
-            function_t *func = AS_FUNCTION(val);
-            if (func->name == NULL) {
-                func->name = sym;
-            }
+        if (special_frame_push(vm, env, args, define_next) == NULL) {
+            return UNDEFINED_VAL;
         }
-        variable_add(vm, env, sym, val);
-
-        return VOID_VAL;
+        *tail_env = env;
+        return AS_CONS(rest->cdr)->car;
     } else if (IS_CONS(rest->car)) {  // (define (<name> <params...>) <body...>)
+        // the resolved copy of <args> (see resolve.h) is kept on the stack
+        value_t *top = vm->stack_top;
+        if (!vm_stack_check(vm, 1)) {
+            return UNDEFINED_VAL;
+        }
+        *vm->stack_top++ = args = resolve_define(vm, env, args);
+        rest = AS_CONS(args);
+
         symbol_t *sym = AS_SYMBOL(AS_CONS(rest->car)->car);
         value_t params = AS_CONS(rest->car)->cdr;
         cons_t *body = AS_CONS(rest->cdr);
 
-        function_t *func = function_new(vm, env, params, PTR_VAL(body));
+        function_t *func = function_new(vm, env, params, CONS_VAL(body));
         func->name = sym;
 
         variable_add(vm, env, sym, PTR_VAL(func));
 
+        vm_stack_restore(vm, top);
         return VOID_VAL;
     } else {
         error_runtime(vm, "define: is wrong - first argument has to be"
@@ -201,26 +298,22 @@ static value_t builtin_define(vm_t *vm, env_t *env, value_t args) {
     }
 }
 
-static value_t lambda(vm_t *vm, env_t *env, value_t args) {
+static value_t lambda(vm_t *vm, env_t *env, value_t args,
+                      env_t **tail_env) {
     // (lambda (<params...>) <body...>)
 
-    if (IS_NIL(AS_CONS(args)->car)) {
-        // no parameters -> (lambda () <body...>)
-        value_t body = AS_CONS(args)->cdr;
-        function_t *func = function_new(vm, env, NIL_VAL, body);
-        return PTR_VAL(func);
-    }
-
-    if (IS_SYMBOL(AS_CONS(args)->car)) {
-        // variadic -> (lambda param <body...>)
-        value_t param = AS_CONS(args)->car;
-        value_t body = AS_CONS(args)->cdr;
-        function_t *func = function_new(vm, env, param, body);
-        return PTR_VAL(func);
+    // the resolved copy of <args> (see resolve.h) is kept on the stack
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 1)) {
+        return UNDEFINED_VAL;
     }
+    *vm->stack_top++ = args = resolve_lambda(vm, env, args);
 
+    // no parameters -> (lambda () <body...>)
+    // variadic -> (lambda param <body...>)
     // TODO: Rewrite using SCM_FOREACH macro
-    for (cons_t *cons = AS_CONS(AS_CONS(args)->car);;
+    value_t params = AS_CONS(args)->car;
+    for (cons_t *cons = AS_CONS(params); IS_CONS(params);
          cons = AS_CONS(cons->cdr)) {
         if (!IS_CONS(cons->cdr) && !IS_NIL(cons->cdr) && IS_SYMBOL(cons->cdr)) {
             // variadic (lambda (a b . rest) <body...>)
@@ -229,6 +322,7 @@ static value_t lambda(vm_t *vm, env_t *env, value_t args) {
 
         if (!IS_SYMBOL(cons->car)) {
             error_runtime(vm, "lambda: all parameters must be symbols!");
+            vm_stack_restore(vm, top);
             return NIL_VAL;
         }
 
@@ -238,23 +332,23 @@ static value_t lambda(vm_t *vm, env_t *env, value_t args) {
         }
     }
 
-    value_t params = AS_CONS(args)->car;
     value_t body = AS_CONS(args)->cdr;
     function_t *func = function_new(vm, env, params, body);
+    vm_stack_restore(vm, top);
     return PTR_VAL(func);
 }
 
-// (if <condition> <then> <otherwise> ...)
-static value_t builtin_if(vm_t *vm, env_t *env, value_t args) {
-    arity_check(vm, "if", args, 2, true);
-
-    // First evaluate <condition>
-    value_t condition = eval(vm, env, AS_CONS(args)->car);
+// Gets the value <condition> of the condition of if
+static value_t if_next(vm_t *vm, frame_t *frame, value_t condition,
+                       env_t **tail_env) {
+    value_t args = frame->rest;
+    env_t *env = frame->env;
+    special_frame_pop(vm, frame);
 
     // if it's true, return <then>
     if (AS_BOOL(condition)) {
-        value_t then = AS_CONS(AS_CONS(args)->cdr)->car;
-        return eval(vm, env, then);
+        *tail_env = env;
+        return AS_CONS(AS_CONS(args)->cdr)->car;
     }
 
     // If missing <otherwise> and <condition> is false, return false
@@ -264,43 +358,125 @@ static value_t builtin_if(vm_t *vm, env_t *env, value_t args) {
 
     // Else do <otherwise>
     value_t otherwise = AS_CONS(AS_CONS(args)->cdr)->cdr;
-    return begin(vm, env, otherwise);
+    return begin_tail(vm, env, otherwise, tail_env);
 }
 
-static value_t builtin_set(vm_t *vm, env_t *env, value_t args) {
-    // (set! <sym> <expr>)
-    arity_check(vm, "set!", args, 2, false);
-    value_t arg = AS_CONS(args)->car;
-    if (!IS_SYMBOL(arg)) {
-        error_runtime(vm, "set!: first argument must be a symbol!");
-        return NIL_VAL;
+// (if <condition> <then> <otherwise> ...)
+static value_t builtin_if(vm_t *vm, env_t *env, value_t args,
+                          env_t **tail_env) {
+    if (!arity_check(vm, "if", cons_len(args), 2, true)) {
+        return UNDEFINED_VAL;
     }
 
-    symbol_t *sym = AS_SYMBOL(arg);
+    // First evaluate <condition>
+    if (special_frame_push(vm, env, args, if_next) == NULL) {
+        return UNDEFINED_VAL;
+    }
+    *tail_env = env;
+    return AS_CONS(args)->car;
+}
 
-    arg = AS_CONS(AS_CONS(args)->cdr)->car;
-    value_t val = eval(vm, env, arg);
-    value_t result = find_replace(env, sym, val);
+// Gets the value <val> of (set! <sym> <expr>)
+static value_t set_next(vm_t *vm, frame_t *frame, value_t val,
+                        env_t **tail_env) {
+    value_t target = AS_CONS(frame->rest)->car;
+    env_t *env = frame->env;
+
+    symbol_t *sym;
+    value_t result;
+    if (IS_LOCAL(target)) {
+        sym = AS_LOCAL(target)->name;
+        result = local_set(vm, env, AS_LOCAL(target), val);
+    } else {
+        sym = AS_SYMBOL(target);
+        result = find_replace(vm, env, sym, val);
+    }
 
     if (IS_UNDEFINED(result)) {
         error_runtime(vm, "set!: assignment not allowed - %s is undefined!",
                       sym->name);
     }
 
+    special_frame_pop(vm, frame);
     return VOID_VAL;
 }
 
-static value_t builtin_let(vm_t *vm, env_t *env, value_t args) {
+static value_t builtin_set(vm_t *vm, env_t *env, value_t args,
+                           env_t **tail_env) {
+    // (set! <sym> <expr>)
+    if (!arity_check(vm, "set!", cons_len(args), 2, false)) {
+        return UNDEFINED_VAL;
+    }
+    value_t target = AS_CONS(args)->car;
+    if (!IS_SYMBOL(target) && !IS_LOCAL(target)) {
+        error_runtime(vm, "set!: first argument must be a symbol!");
+        return NIL_VAL;
+    }
+
+    if (special_frame_push(vm, env, args, set_next) == NULL) {
+        return UNDEFINED_VAL;
+    }
+    *tail_env = env;
+    return AS_CONS(AS_CONS(args)->cdr)->car;
+}
+
+// Makes the env of the let of <frame> with the values of the bindings
+// on its stack and returns the body to be evaluated in it
+static value_t let_body(vm_t *vm, frame_t *frame, env_t **tail_env) {
+    value_t *base = frame->base;
+    value_t args = base[0];
+    int count = frame->argc;
+
+    env_t *new_env =
+        env_new(vm, AS_CONS(args)->car, true, count, frame->env);
+    for (int i = 0; i < count; i++) {
+        new_env->slots[i] = base[1 + i];
+    }
+
+    special_frame_pop(vm, frame);
+    return begin_tail(vm, new_env, AS_CONS(args)->cdr, tail_env);
+}
+
+// Gets the value <val> of the first binding in frame->rest
+static value_t let_next(vm_t *vm, frame_t *frame, value_t val,
+                        env_t **tail_env) {
+    value_t var = AS_CONS(AS_CONS(frame->rest)->car)->car;
+
+    // If value in binding is an unnamed function,
+    // set it's name to var in binding
+    if (IS_FUNCTION(val)) {
+        function_t *func = AS_FUNCTION(val);
+        symbol_t *sym = AS_SYMBOL(var);
+        if (func->name == NULL) {
+            func->name = sym;
+            vm_write_barrier(vm, &func->p, var);
+        }
+    }
+    vm_stack_restore(vm, frame->base + 1 + frame->argc);
+    *vm->stack_top++ = val;
+    frame->argc++;
+
+    frame->rest = AS_CONS(frame->rest)->cdr;
+    if (IS_NIL(frame->rest)) {
+        return let_body(vm, frame, tail_env);
+    }
+    *tail_env = frame->env;
+    return AS_CONS(AS_CONS(AS_CONS(frame->rest)->car)->cdr)->car;
+}
+
+static value_t builtin_let(vm_t *vm, env_t *env, value_t args,
+                           env_t **tail_env) {
     // (let ((a 10) (b 20) ...) <exprs...>)
-    arity_check(vm, "let", args, 2, true);
+    if (!arity_check(vm, "let", cons_len(args), 2, true)) {
+        return UNDEFINED_VAL;
+    }
     value_t bindings = AS_CONS(args)->car;
-    if (!IS_CONS(bindings) && !IS_NIL(bindings)) {
+    if ((!IS_CONS(bindings) && !IS_NIL(bindings)) || cons_len(bindings) < 0) {
         error_runtime(vm, "let: bindings (first argument) must be a list!");
         return UNDEFINED_VAL;
     }
+    int32_t len = cons_len(bindings);
 
-    value_t vars = NIL_VAL;
-    value_t vals = NIL_VAL;
     if (!IS_NIL(bindings)) {
         value_t binding, iter;
         SCM_FOREACH (binding, AS_CONS(bindings), iter) {
@@ -309,61 +485,64 @@ static value_t builtin_let(vm_t *vm, env_t *env, value_t args) {
                               "let: binding is not of type (variable value)!");
                 return UNDEFINED_VAL;
             }
-            value_t var = AS_CONS(binding)->car;
-            value_t val = AS_CONS(AS_CONS(binding)->cdr)->car;
-            if (!IS_SYMBOL(var)) {
+            if (!IS_SYMBOL(AS_CONS(binding)->car)) {
                 error_runtime(vm,
                               "let: left side of the binding is not a symbol!");
                 return UNDEFINED_VAL;
             }
-            value_t temp = cons_fn(vm, var, vars);
-            vars = temp;
-
-            value_t val_eval = eval(vm, env, val);
-
-            // If value in binding is an unnamed function,
-            // set it's name to var in binding
-            if (IS_FUNCTION(val_eval)) {
-                function_t *func = AS_FUNCTION(val_eval);
-                symbol_t *sym = AS_SYMBOL(var);
-                if (func->name == NULL) {
-                    func->name = sym;
-                }
-            }
-            temp = cons_fn(vm, val_eval, vals);
-            vals = temp;
         }
     }
 
-    env_t *new_env = env_push(vm, env, vars, vals);
-    value_t body = AS_CONS(args)->cdr;
-    return begin(vm, new_env, body);
+    // the resolved copy of <args> (see resolve.h) and the values
+    // of the bindings are kept on the stack of the frame
+    if (!vm_stack_check(vm, len + 1)) {
+        return UNDEFINED_VAL;
+    }
+    if (special_frame_push(vm, env, NIL_VAL, let_next) == NULL) {
+        return UNDEFINED_VAL;
+    }
+    value_t *base = vm->stack_top++;
+    *base = NIL_VAL;
+    *base = args = resolve_let(vm, env, args);
+
+    frame_t *frame = &vm->frames[vm->num_frames - 1];
+    bindings = AS_CONS(args)->car;
+    if (IS_NIL(bindings)) {
+        return let_body(vm, frame, tail_env);
+    }
+    frame->rest = bindings;
+    *tail_env = env;
+    return AS_CONS(AS_CONS(AS_CONS(bindings)->car)->cdr)->car;
 }
 
 /* *** core - I/O *** */
 
-static value_t builtin_write(vm_t *vm, env_t *env, value_t args) {
-    value_t eargs = eval_list(vm, env, args);
-    arity_check(vm, "write", eargs, 1, false);
-    write(stdout, AS_CONS(eargs)->car);
+static value_t builtin_write(vm_t *vm, env_t *env, int argc, value_t *args) {
+    if (!arity_check(vm, "write", argc, 1, false)) {
+        return UNDEFINED_VAL;
+    }
+    write(stdout, args[0]);
     return VOID_VAL;
 }
 
-static value_t builtin_display(vm_t *vm, env_t *env, value_t args) {
-    value_t eargs = eval_list(vm, env, args);
-    arity_check(vm, "display", eargs, 1, false);
-    display(stdout, AS_CONS(eargs)->car);
+static value_t builtin_display(vm_t *vm, env_t *env, int argc,
+                               value_t *args) {
+    if (!arity_check(vm, "display", argc, 1, false)) {
+        return UNDEFINED_VAL;
+    }
+    display(stdout, args[0]);
     return VOID_VAL;
 }
 
-static value_t builtin_newline(vm_t *vm, env_t *env, value_t args) {
-    arity_check(vm, "newline", args, 0, false);
+static value_t builtin_newline(vm_t *vm, env_t *env, int argc,
+                               value_t *args) {
+    arity_check(vm, "newline", argc, 0, false);
     fprintf(stdout, "\n");
     return VOID_VAL;
 }
 
-static value_t builtin_read(vm_t *vm, env_t *env, value_t args) {
-    arity_check(vm, "read", args, 0, false);
+static value_t builtin_read(vm_t *vm, env_t *env, int argc, value_t *args) {
+    arity_check(vm, "read", argc, 0, false);
     char line[1024];
     if (!fgets(line, 1024, stdin)) {
         return EOF_VAL;
@@ -371,10 +550,11 @@ static value_t builtin_read(vm_t *vm, env_t *env, value_t args) {
     return read_source(vm, line);
 }
 
-static value_t builtin_load(vm_t *vm, env_t *env, value_t args) {
-    value_t eargs = eval_list(vm, env, args);
-    arity_check(vm, "load", eargs, 1, false);
-    value_t arg = AS_CONS(eargs)->car;
+static value_t builtin_load(vm_t *vm, env_t *env, int argc, value_t *args) {
+    if (!arity_check(vm, "load", argc, 1, false)) {
+        return UNDEFINED_VAL;
+    }
+    value_t arg = args[0];
     if (!IS_STRING(arg)) {
         error_runtime(vm, "load: argument must be a string!");
         return UNDEFINED_VAL;
@@ -388,53 +568,70 @@ static value_t builtin_load(vm_t *vm, env_t *env, value_t args) {
 
 // TODO: When we have better macros, replace these :)
 
+// Gets the value <val> of the first argument in frame->rest
+// of and (<is_and>) or or, the next one is evaluated unless it decides
+static value_t logic_next(vm_t *vm, frame_t *frame, value_t val,
+                          env_t **tail_env, bool is_and) {
+    if (!IS_BOOL(val)) {
+        error_runtime(vm, is_and ? "and: argument is not a bool!"
+                                 : "or: argument is not a bool!");
+        special_frame_pop(vm, frame);
+        return UNDEFINED_VAL;
+    }
+
+    frame->rest = AS_CONS(frame->rest)->cdr;
+    if (AS_BOOL(val) != is_and || !IS_CONS(frame->rest)) {
+        special_frame_pop(vm, frame);
+        return val;
+    }
+    *tail_env = frame->env;
+    return AS_CONS(frame->rest)->car;
+}
+
+static value_t or_next(vm_t *vm, frame_t *frame, value_t val,
+                       env_t **tail_env) {
+    return logic_next(vm, frame, val, tail_env, false);
+}
+
+static value_t and_next(vm_t *vm, frame_t *frame, value_t val,
+                        env_t **tail_env) {
+    return logic_next(vm, frame, val, tail_env, true);
+}
+
 // Tries to evaluate arguments sequentially (short-circuits)
 // If any arg is #t, returns #t, else #f
 // (or #t (error "err")) => #t
-static value_t builtin_or(vm_t *vm, env_t *env, value_t args) {
+static value_t builtin_or(vm_t *vm, env_t *env, value_t args,
+                          env_t **tail_env) {
     if (IS_NIL(args)) {
         return FALSE_VAL;
     }
-    value_t arg, iter;
-    SCM_FOREACH (arg, AS_CONS(args), iter) {
-        value_t earg = eval(vm, env, arg);
-        if (!IS_BOOL(earg)) {
-            error_runtime(vm, "or: argument is not a bool!");
-            return UNDEFINED_VAL;
-        }
-
-        if (IS_TRUE(earg)) {
-            return TRUE_VAL;
-        }
+    if (special_frame_push(vm, env, args, or_next) == NULL) {
+        return UNDEFINED_VAL;
     }
-    return FALSE_VAL;
+    *tail_env = env;
+    return AS_CONS(args)->car;
 }
 
 // Tries to evaluate arguments sequentially (short-circuits)
 // If any arg is #f, returns #f, else #t
 // (and #f (error "err")) => #f
-static value_t builtin_and(vm_t *vm, env_t *env, value_t args) {
+static value_t builtin_and(vm_t *vm, env_t *env, value_t args,
+                           env_t **tail_env) {
     if (IS_NIL(args)) {
         return TRUE_VAL;
     }
-    value_t arg, iter;
-    SCM_FOREACH (arg, AS_CONS(args), iter) {
-        value_t earg = eval(vm, env, arg);
-        if (!IS_BOOL(earg)) {
-            error_runtime(vm, "and: argument is not a bool!");
-            return UNDEFINED_VAL;
-        }
-
-        if (IS_FALSE(earg)) {
-            return FALSE_VAL;
-        }
+    if (special_frame_push(vm, env, args, and_next) == NULL) {
+        return UNDEFINED_VAL;
     }
-    return TRUE_VAL;
+    *tail_env = env;
+    return AS_CONS(args)->car;
 }
 
 /* *** core - macros, eval *** */
 
-static value_t define_macro(vm_t *vm, env_t *env, value_t args) {
+static value_t define_macro(vm_t *vm, env_t *env, value_t args,
+                            env_t **tail_env) {
     // (define-macro (<name> <params...>) <body...>)
     cons_t *rest = AS_CONS(args);
     if (!IS_CONS(rest->car)) {
@@ -446,7 +643,7 @@ static value_t define_macro(vm_t *vm, env_t *env, value_t args) {
     value_t params = AS_CONS(rest->car)->cdr;
     cons_t *body = AS_CONS(rest->cdr);
 
-    function_t *macro = macro_new(vm, env, params, PTR_VAL(body));
+    function_t *macro = macro_new(vm, env, params, CONS_VAL(body));
     macro->name = sym;
 
     variable_add(vm, env, sym, PTR_VAL(macro));
@@ -454,260 +651,1417 @@ static value_t define_macro(vm_t *vm, env_t *env, value_t args) {
     return VOID_VAL;
 }
 
-static value_t builtin_eval(vm_t *vm, env_t *env, value_t args) {
-    value_t eargs = eval_list(vm, env, args);
-    arity_check(vm, "eval", eargs, 1, true);
-    value_t first = AS_CONS(eargs)->car;
-    if (cons_len(eargs) == 2) {
-        value_t second = AS_CONS(AS_CONS(eargs)->cdr)->car;
+static value_t builtin_eval(vm_t *vm, env_t *env, int argc, value_t *args) {
+    if (!arity_check(vm, "eval", argc, 1, true)) {
+        return UNDEFINED_VAL;
+    }
+    value_t first = args[0];
+    if (argc == 2) {
+        value_t second = args[1];
         return eval(vm, (env_t *) AS_PTR(second), first);
     } else {
         return eval(vm, env, first);
     }
 }
 
-static value_t builtin_apply(vm_t *vm, env_t *env, value_t args) {
-    arity_check(vm, "apply", args, 2, false);
-    value_t eargs = eval_list(vm, env, args);
-    value_t fn = AS_CONS(eargs)->car;
-    value_t fn_args = AS_CONS(AS_CONS(eargs)->cdr)->car;
-    return apply(vm, env, fn, fn_args);
+static value_t builtin_apply(vm_t *vm, env_t *env, int argc, value_t *args) {
+    if (!arity_check(vm, "apply", argc, 2, false)) {
+        return UNDEFINED_VAL;
+    }
+    return apply(vm, env, args[0], args[1]);
 }
 
-static value_t builtin_expand(vm_t *vm, env_t *env, value_t args) {
-    arity_check(vm, "expand", args, 1, false);
+static value_t builtin_expand(vm_t *vm, env_t *env, value_t args,
+                              env_t **tail_env) {
+    if (!arity_check(vm, "expand", cons_len(args), 1, false)) {
+        return UNDEFINED_VAL;
+    }
     return expand(vm, env, AS_CONS(args)->car);
 }
 
-static value_t builtin_gensym(vm_t *vm, env_t *env, value_t args) {
-    arity_check(vm, "gensym", args, 0, false);
+static value_t builtin_gensym(vm_t *vm, env_t *env, int argc,
+                              value_t *args) {
+    arity_check(vm, "gensym", argc, 0, false);
     char buffer[16];
     snprintf(buffer, sizeof(buffer), "g%u", vm->gensym_count++);
     return PTR_VAL(symbol_new(vm, buffer, 16));
 }
 
-static value_t quote(vm_t *vm, env_t *env, value_t args) {
-    arity_check(vm, "quote", args, 1, false);
+static value_t quote(vm_t *vm, env_t *env, value_t args,
+                     env_t **tail_env) {
+    if (!arity_check(vm, "quote", cons_len(args), 1, false)) {
+        return UNDEFINED_VAL;
+    }
     return AS_CONS(args)->car;
 }
 
 /* *** core - list functions *** */
 
-static value_t builtin_cons(vm_t *vm, env_t *env, value_t args) {
-    arity_check(vm, "cons", args, 2, false);
-
-    value_t car = eval(vm, env, AS_CONS(args)->car);
-    value_t cdr = eval(vm, env, AS_CONS(AS_CONS(args)->cdr)->car);
+static value_t builtin_cons(vm_t *vm, env_t *env, int argc, value_t *args) {
+    if (!arity_check(vm, "cons", argc, 2, false)) {
+        return UNDEFINED_VAL;
+    }
 
-    value_t cons = cons_fn(vm, car, cdr);
+    value_t cons = cons_fn(vm, args[0], args[1]);
     return cons;
 }
 
-static value_t builtin_car(vm_t *vm, env_t *env, value_t args) {
-    value_t eargs = eval_list(vm, env, args);
-    arity_check(vm, "car", eargs, 1, false);
-    value_t a = AS_CONS(eargs)->car;
+static value_t builtin_car(vm_t *vm, env_t *env, int argc, value_t *args) {
+    if (!arity_check(vm, "car", argc, 1, false)) {
+        return UNDEFINED_VAL;
+    }
+    value_t a = args[0];
     if (!IS_CONS(a)) {
         error_runtime(vm, "car: argument is not a cons cell!");
+        return UNDEFINED_VAL;
     }
     return AS_CONS(a)->car;
 }
 
-static value_t builtin_cdr(vm_t *vm, env_t *env, value_t args) {
-    value_t eargs = eval_list(vm, env, args);
-    arity_check(vm, "cdr", eargs, 1, false);
-    value_t a = AS_CONS(eargs)->car;
+static value_t builtin_cdr(vm_t *vm, env_t *env, int argc, value_t *args) {
+    if (!arity_check(vm, "cdr", argc, 1, false)) {
+        return UNDEFINED_VAL;
+    }
+    value_t a = args[0];
     if (!IS_CONS(a)) {
         error_runtime(vm, "cdr: argument is not a cons cell!");
+        return UNDEFINED_VAL;
     }
     return AS_CONS(a)->cdr;
 }
 
-static value_t builtin_length(vm_t *vm, env_t *env, value_t args) {
-    value_t eargs = eval_list(vm, env, args);
-    arity_check(vm, "builtin-length", eargs, 1, false);
-    return NUM_VAL(cons_len(AS_CONS(eargs)->car));
+static value_t builtin_length(vm_t *vm, env_t *env, int argc,
+                              value_t *args) {
+    if (!arity_check(vm, "builtin-length", argc, 1, false)) {
+        return UNDEFINED_VAL;
+    }
+    return NUM_VAL(cons_len(args[0]));
 }
 
+// A list which is being built from the front to the back (see eval_list)
+// The list and the newest element are kept in two slots on the stack
+typedef struct {
+    value_t *slots;
+    cons_t *tail;
+} list_builder_t;
 
-/* *** core - vector functions *** */
+static bool list_builder_init(vm_t *vm, list_builder_t *builder) {
+    if (!vm_stack_check(vm, 2)) {
+        return false;
+    }
+    builder->slots = vm->stack_top;
+    vm->stack_top += 2;
+    builder->slots[0] = NIL_VAL;
+    builder->slots[1] = NIL_VAL;
+    builder->tail = NULL;
+    return true;
+}
 
-static value_t builtin_vec_length(vm_t *vm, env_t *env, value_t args) {
-    // (vector-length <vec>)
-    value_t eargs = eval_list(vm, env, args);
-    arity_check(vm, "vector-length", eargs, 1, false);
-    value_t arg = AS_CONS(eargs)->car;
-    if (!IS_VECTOR(arg)) {
-        error_runtime(vm, "vector-length: argument must be a vector");
-        return UNDEFINED_VAL;
+// Adds <val> to the end of the list in <builder>
+static void list_builder_add(vm_t *vm, list_builder_t *builder, value_t val) {
+    builder->slots[1] = val;
+    value_t cons = cons_fn(vm, val, NIL_VAL);
+    if (builder->tail == NULL) {
+        builder->slots[0] = cons;
+    } else {
+        builder->tail->cdr = cons;
+        vm_cons_barrier(vm, builder->tail, cons);
     }
-    return NUM_VAL(AS_VECTOR(arg)->count);
+    builder->tail = AS_CONS(cons);
 }
 
-static value_t builtin_vec_ref(vm_t *vm, env_t *env, value_t args) {
-    // (vector-ref! <vec> <k>)
-    value_t eargs = eval_list(vm, env, args);
-    arity_check(vm, "vector-ref", eargs, 2, false);
-    value_t first = AS_CONS(eargs)->car;
-    value_t second = AS_CONS(AS_CONS(eargs)->cdr)->car;
-    if (!IS_VECTOR(first)) {
-        error_runtime(vm, "vector-ref: first argument must be a vector");
-        return UNDEFINED_VAL;
+// Returns the list in <builder>, unrooting it
+static value_t list_builder_finish(vm_t *vm, list_builder_t *builder) {
+    value_t list = builder->slots[0];
+    vm_stack_restore(vm, builder->slots);
+    return list;
+}
+
+// Checks that <val> (the argument of <fn_name>) is a proper list
+static bool list_check(vm_t *vm, const char *fn_name, value_t val) {
+    if (cons_len(val) < 0) {
+        error_runtime(vm, "%s: argument is not 'list?'", fn_name);
+        return false;
     }
-    vector_t *vec = AS_VECTOR(first);
-    if (!IS_INT(second) ||
-        !(AS_INT(second) >= 0 && AS_INT(second) < vec->count)) {
-        error_runtime(
-            vm, "vector-ref: second argument must be a valid integer in range");
+    return true;
+}
+
+static bool procedure_check(vm_t *vm, const char *fn_name, value_t val) {
+    if (!IS_PROCEDURE(val)) {
+        error_runtime(vm, "%s: first argument must be a procedure", fn_name);
+        return false;
+    }
+    return true;
+}
+
+static value_t builtin_list_length(vm_t *vm, env_t *env, int argc,
+                                   value_t *args) {
+    // (length <lst>)
+    if (!arity_check(vm, "length", argc, 1, false) ||
+        !list_check(vm, "length", args[0])) {
         return UNDEFINED_VAL;
     }
-    return vec->data[AS_INT(second)];
+    return NUM_VAL(cons_len(args[0]));
 }
 
-static value_t builtin_vec_set(vm_t *vm, env_t *env, value_t args) {
-    // (vector-set! <vec> <k> <obj>)
-    value_t eargs = eval_list(vm, env, args);
-    arity_check(vm, "vector-set!", eargs, 3, false);
-    value_t first = AS_CONS(eargs)->car;
-    value_t second = AS_CONS(AS_CONS(eargs)->cdr)->car;
-    value_t third = AS_CONS(AS_CONS(AS_CONS(eargs)->cdr)->cdr)->car;
-    if (!IS_VECTOR(first)) {
-        error_runtime(vm, "vector-set!: first argument must be a vector");
+static value_t builtin_list_copy(vm_t *vm, env_t *env, int argc,
+                                 value_t *args) {
+    // (list-copy <lst>)
+    if (!arity_check(vm, "list-copy", argc, 1, false) ||
+        !list_check(vm, "list-copy", args[0])) {
         return UNDEFINED_VAL;
     }
-    vector_t *vec = AS_VECTOR(first);
-    if (!IS_INT(second) ||
-        !(AS_INT(second) >= 0 && AS_INT(second) < vec->count)) {
-        error_runtime(
-            vm,
-            "vector-set!: second argument must be a valid integer in range");
+    list_builder_t builder;
+    if (!list_builder_init(vm, &builder)) {
         return UNDEFINED_VAL;
     }
-    vec->data[AS_INT(second)] = third;
-    return VOID_VAL;
+    for (value_t iter = args[0]; IS_CONS(iter); iter = AS_CONS(iter)->cdr) {
+        list_builder_add(vm, &builder, AS_CONS(iter)->car);
+    }
+    return list_builder_finish(vm, &builder);
 }
 
-static value_t builtin_vec_make(vm_t *vm, env_t *env, value_t args) {
-    // (make-vector <k> <fill>)
-    value_t eargs = eval_list(vm, env, args);
-    arity_check(vm, "make-vector", eargs, 2, false);
-    value_t first = AS_CONS(eargs)->car;
-    value_t second = AS_CONS(AS_CONS(eargs)->cdr)->car;
-    if (!IS_INT(first) || AS_INT(first) < 0) {
-        error_runtime(
-            vm, "make-vector: first argument must be a positive integer!");
+static value_t builtin_list_reverse(vm_t *vm, env_t *env, int argc,
+                                    value_t *args) {
+    // (reverse <lst>)
+    if (!arity_check(vm, "reverse", argc, 1, false) ||
+        !list_check(vm, "reverse", args[0])) {
         return UNDEFINED_VAL;
     }
-    uint32_t count = AS_INT(first);
-    vector_t *vec = vector_new(vm, count);
-    for (uint32_t i = 0; i < count; i++) {
-        vec->data[i] = second;
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 1)) {
+        return UNDEFINED_VAL;
     }
-    return PTR_VAL(vec);
+    value_t *result = vm->stack_top++;
+    *result = NIL_VAL;
+    for (value_t iter = args[0]; IS_CONS(iter); iter = AS_CONS(iter)->cdr) {
+        *result = cons_fn(vm, AS_CONS(iter)->car, *result);
+    }
+    value_t list = *result;
+    vm_stack_restore(vm, top);
+    return list;
 }
 
-/* *** core - other library functions *** */
+static value_t builtin_list_append(vm_t *vm, env_t *env, int argc,
+                                   value_t *args) {
+    // (append <lst> ...)
+    if (argc == 0) {
+        return NIL_VAL;
+    }
+    for (int i = 0; i < argc - 1; i++) {
+        if (!list_check(vm, "append", args[i])) {
+            return UNDEFINED_VAL;
+        }
+    }
 
-static value_t builtin_error(vm_t *vm, env_t *env, value_t args) {
-    value_t eargs = eval_list(vm, env, args);
-    arity_check(vm, "error", eargs, 1, false);
-    value_t arg = AS_CONS(eargs)->car;
-    if (!IS_STRING(arg)) {
-        error_runtime(vm, "error: argument must be a string");
+    // all lists but the last one are copied
+    list_builder_t builder;
+    if (!list_builder_init(vm, &builder)) {
         return UNDEFINED_VAL;
     }
-    error_runtime(vm, AS_STRING(arg)->value);
-    return VOID_VAL;
+    for (int i = 0; i < argc - 1; i++) {
+        for (value_t iter = args[i]; IS_CONS(iter);
+             iter = AS_CONS(iter)->cdr) {
+            list_builder_add(vm, &builder, AS_CONS(iter)->car);
+        }
+    }
+    if (builder.tail == NULL) {
+        builder.slots[0] = args[argc - 1];
+    } else {
+        builder.tail->cdr = args[argc - 1];
+        vm_cons_barrier(vm, builder.tail, args[argc - 1]);
+    }
+    return list_builder_finish(vm, &builder);
 }
 
-static value_t builtin_time(vm_t *vm, env_t *env, value_t args) {
-    arity_check(vm, "current-time", args, 0, false);
-    return NUM_VAL((double) clock() / (CLOCKS_PER_SEC / 1000.0F));
+static value_t builtin_list_map(vm_t *vm, env_t *env, int argc,
+                                value_t *args) {
+    // (map <fn> <lst>)
+    if (!arity_check(vm, "map", argc, 2, false) ||
+        !procedure_check(vm, "map", args[0]) ||
+        !list_check(vm, "map", args[1])) {
+        return UNDEFINED_VAL;
+    }
+    list_builder_t builder;
+    if (!list_builder_init(vm, &builder)) {
+        return UNDEFINED_VAL;
+    }
+    for (value_t iter = args[1]; IS_CONS(iter); iter = AS_CONS(iter)->cdr) {
+        value_t val = call(vm, env, args[0], 1, &AS_CONS(iter)->car);
+        list_builder_add(vm, &builder, val);
+    }
+    return list_builder_finish(vm, &builder);
 }
 
-// Exits the program - this procedure is really harsh
-// TODO: Can we just stop the interpret loop and exit more gracefully?
-static value_t builtin_exit(vm_t *vm, env_t *env, value_t args) {
-    // (exit <status>)
-    value_t eargs = eval_list(vm, env, args);
-    arity_check(vm, "exit", eargs, 1, false);
-    value_t arg = AS_CONS(eargs)->car;
-    if (!IS_INT(arg)) {
-        error_runtime(vm, "exit: argument must be an integer");
+static value_t builtin_list_filter(vm_t *vm, env_t *env, int argc,
+                                   value_t *args) {
+    // (filter <fn> <lst>)
+    if (!arity_check(vm, "filter", argc, 2, false) ||
+        !procedure_check(vm, "filter", args[0]) ||
+        !list_check(vm, "filter", args[1])) {
         return UNDEFINED_VAL;
     }
-    int exit_status = AS_INT(arg);
-    vm_free(vm);
-    exit(exit_status);
+    list_builder_t builder;
+    if (!list_builder_init(vm, &builder)) {
+        return UNDEFINED_VAL;
+    }
+    for (value_t iter = args[1]; IS_CONS(iter); iter = AS_CONS(iter)->cdr) {
+        value_t val = AS_CONS(iter)->car;
+        if (!IS_FALSE(call(vm, env, args[0], 1, &val))) {
+            list_builder_add(vm, &builder, val);
+        }
+    }
+    return list_builder_finish(vm, &builder);
 }
 
-static value_t builtin_hash(vm_t *vm, env_t *env, value_t args) {
-    value_t eargs = eval_list(vm, env, args);
-    arity_check(vm, "hash", eargs, 1, false);
-
-    value_t arg = AS_CONS(eargs)->car;
-    if (IS_VAL(arg) || IS_STRING(arg) || IS_SYMBOL(arg)) {
-        return NUM_VAL(hash_value(arg));
+static value_t builtin_list_foldl(vm_t *vm, env_t *env, int argc,
+                                  value_t *args) {
+    // (foldl <fn> <acc> <lst>)
+    if (!arity_check(vm, "foldl", argc, 3, false) ||
+        !procedure_check(vm, "foldl", args[0]) ||
+        !list_check(vm, "foldl", args[2])) {
+        return UNDEFINED_VAL;
     }
-    error_runtime(vm, "hash: cannot hash non-immutable type");
-    return UNDEFINED_VAL;
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 2)) {
+        return UNDEFINED_VAL;
+    }
+    // (fn acc x), the accumulator is kept on the stack
+    value_t *fn_args = vm->stack_top;
+    vm->stack_top += 2;
+    fn_args[0] = fn_args[1] = NIL_VAL;
+    value_t acc = args[1];
+    for (value_t iter = args[2]; IS_CONS(iter); iter = AS_CONS(iter)->cdr) {
+        fn_args[0] = acc;
+        fn_args[1] = AS_CONS(iter)->car;
+        acc = call(vm, env, args[0], 2, fn_args);
+    }
+    vm_stack_restore(vm, top);
+    return acc;
 }
 
-/* *** debug functions *** */
-
-#if DEBUG
+static value_t builtin_list_foldr(vm_t *vm, env_t *env, int argc,
+                                  value_t *args) {
+    // (foldr <fn> <acc> <lst>)
+    if (!arity_check(vm, "foldr", argc, 3, false) ||
+        !procedure_check(vm, "foldr", args[0]) ||
+        !list_check(vm, "foldr", args[2])) {
+        return UNDEFINED_VAL;
+    }
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 3)) {
+        return UNDEFINED_VAL;
+    }
+    // the list is reversed first, so that it's folded without recursion
+    value_t *reversed = vm->stack_top++;
+    *reversed = NIL_VAL;
+    for (value_t iter = args[2]; IS_CONS(iter); iter = AS_CONS(iter)->cdr) {
+        *reversed = cons_fn(vm, AS_CONS(iter)->car, *reversed);
+    }
 
-static value_t builtin_env_cur(vm_t *vm, env_t *env, value_t args) {
-    arity_check(vm, "current-environment", args, 0, false);
-    return PTR_VAL(env);
+    // (fn x acc)
+    value_t *fn_args = vm->stack_top;
+    vm->stack_top += 2;
+    fn_args[0] = fn_args[1] = NIL_VAL;
+    value_t acc = args[1];
+    for (value_t iter = *reversed; IS_CONS(iter); iter = AS_CONS(iter)->cdr) {
+        fn_args[0] = AS_CONS(iter)->car;
+        fn_args[1] = acc;
+        acc = call(vm, env, args[0], 2, fn_args);
+    }
+    vm_stack_restore(vm, top);
+    return acc;
 }
 
-static value_t builtin_env_top(vm_t *vm, env_t *env, value_t args) {
-    arity_check(vm, "top-level-environment", args, 0, false);
-    return PTR_VAL(vm->top_env);
+// Checks that <val> (the index argument of <fn_name>) is a non-negative integer
+static bool index_check(vm_t *vm, const char *fn_name, value_t val) {
+    if (!IS_INT(val) || AS_INT(val) < 0) {
+        error_runtime(vm, "%s: index must be a non-negative integer", fn_name);
+        return false;
+    }
+    return true;
 }
 
-static value_t builtin_env_vars(vm_t *vm, env_t *env, value_t args) {
-    // (environment-variables <env>)
-    value_t eargs = eval_list(vm, env, args);
-    arity_check(vm, "environment-variables", eargs, 1, false);
-    if (!IS_ENV(AS_CONS(eargs)->car)) {
-        error_runtime(vm,
-                      "environment-variables: argument must be an environment");
+static value_t builtin_list_drop(vm_t *vm, env_t *env, int argc,
+                                 value_t *args) {
+    // (drop <n> <lst>)
+    if (!arity_check(vm, "drop", argc, 2, false) ||
+        !index_check(vm, "drop", args[0])) {
         return UNDEFINED_VAL;
     }
-    return AS_ENV(AS_CONS(eargs)->car)->variables;
+    // dropping more than there is returns an empty list
+    value_t iter = args[1];
+    for (int64_t i = AS_INT(args[0]); i > 0 && IS_CONS(iter); i--) {
+        iter = AS_CONS(iter)->cdr;
+    }
+    return iter;
 }
 
-static value_t builtin_env_up(vm_t *vm, env_t *env, value_t args) {
-    // (environment-parent <env>)
-    value_t eargs = eval_list(vm, env, args);
-    arity_check(vm, "environment-parent", eargs, 1, false);
-    if (!IS_ENV(AS_CONS(eargs)->car)) {
-        write(stderr, AS_CONS(eargs)->car);
-        error_runtime(vm,
-                      "environment-parent: argument must be an environment");
+static value_t builtin_list_tail(vm_t *vm, env_t *env, int argc,
+                                 value_t *args) {
+    // (list-tail <lst> <k>)
+    if (!arity_check(vm, "list-tail", argc, 2, false) ||
+        !index_check(vm, "list-tail", args[1])) {
         return UNDEFINED_VAL;
     }
-    env_t *e = AS_ENV(AS_CONS(eargs)->car);
-    if (e->up == NULL) {
-        return NIL_VAL;
-    }
-    return PTR_VAL(e->up);
+    value_t iter = args[0];
+    for (int64_t i = AS_INT(args[1]); i > 0; i--) {
+        if (!IS_CONS(iter)) {
+            error_runtime(vm, "list-tail: list is too short");
+            return UNDEFINED_VAL;
+        }
+        iter = AS_CONS(iter)->cdr;
+    }
+    return iter;
+}
+
+static value_t builtin_list_ref(vm_t *vm, env_t *env, int argc,
+                                value_t *args) {
+    // (list-ref <lst> <k>)
+    if (!arity_check(vm, "list-ref", argc, 2, false) ||
+        !index_check(vm, "list-ref", args[1])) {
+        return UNDEFINED_VAL;
+    }
+    value_t iter = args[0];
+    for (int64_t i = AS_INT(args[1]); i > 0 && IS_CONS(iter); i--) {
+        iter = AS_CONS(iter)->cdr;
+    }
+    if (!IS_CONS(iter)) {
+        error_runtime(vm, "list-ref: index out of range");
+        return UNDEFINED_VAL;
+    }
+    return AS_CONS(iter)->car;
+}
+
+// Returns the first sublist of <lst> starting with a value equal to <x>
+// (or NIL_VAL if there is none)
+static value_t list_member(value_t lst, value_t x, bool use_equal) {
+    for (; IS_CONS(lst); lst = AS_CONS(lst)->cdr) {
+        value_t val = AS_CONS(lst)->car;
+        if (use_equal ? val_equal(val, x) : val_eq(val, x)) {
+            return lst;
+        }
+    }
+    return NIL_VAL;
+}
+
+static value_t builtin_list_is_member(vm_t *vm, env_t *env, int argc,
+                                      value_t *args) {
+    // (member? <lst> <x>)
+    if (!arity_check(vm, "member?", argc, 2, false)) {
+        return UNDEFINED_VAL;
+    }
+    return BOOL_VAL(!IS_NIL(list_member(args[0], args[1], true)));
+}
+
+// Defines (<name> <x> <lst>), returning the sublist or #f
+#define LIST_MEMBER_FN(fn_name, name, use_equal)                           \
+    static value_t builtin_list_##fn_name(vm_t *vm, env_t *env, int argc, \
+                                          value_t *args) {                \
+        if (!arity_check(vm, name, argc, 2, false)) {                     \
+            return UNDEFINED_VAL;                                         \
+        }                                                                 \
+        value_t lst = list_member(args[1], args[0], use_equal);           \
+        return IS_NIL(lst) ? FALSE_VAL : lst;                             \
+    }
+
+LIST_MEMBER_FN(memq, "memq", false)
+LIST_MEMBER_FN(member, "member", true)
+
+#undef LIST_MEMBER_FN
+
+// Defines (<name> <x> <alist>), returning the first pair with <x> or #f
+#define LIST_ASSOC_FN(fn_name, name, use_equal)                            \
+    static value_t builtin_list_##fn_name(vm_t *vm, env_t *env, int argc, \
+                                          value_t *args) {                \
+        if (!arity_check(vm, name, argc, 2, false)) {                     \
+            return UNDEFINED_VAL;                                         \
+        }                                                                 \
+        for (value_t iter = args[1]; IS_CONS(iter);                       \
+             iter = AS_CONS(iter)->cdr) {                                 \
+            value_t pair = AS_CONS(iter)->car;                            \
+            if (!IS_CONS(pair)) {                                         \
+                error_runtime(vm, name ": elements must be pairs");       \
+                return UNDEFINED_VAL;                                     \
+            }                                                             \
+            value_t key = AS_CONS(pair)->car;                             \
+            if (use_equal ? val_equal(key, args[0])                       \
+                          : val_eq(key, args[0])) {                       \
+                return pair;                                              \
+            }                                                             \
+        }                                                                 \
+        return FALSE_VAL;                                                 \
+    }
+
+LIST_ASSOC_FN(assq, "assq", false)
+LIST_ASSOC_FN(assoc, "assoc", true)
+
+#undef LIST_ASSOC_FN
+
+
+/* *** core - vector functions *** */
+
+static value_t builtin_vec_length(vm_t *vm, env_t *env, int argc,
+                                  value_t *args) {
+    // (vector-length <vec>)
+    if (!arity_check(vm, "vector-length", argc, 1, false)) {
+        return UNDEFINED_VAL;
+    }
+    value_t arg = args[0];
+    if (!IS_VECTOR(arg)) {
+        error_runtime(vm, "vector-length: argument must be a vector");
+        return UNDEFINED_VAL;
+    }
+    return NUM_VAL(AS_VECTOR(arg)->count);
+}
+
+static value_t builtin_vec_ref(vm_t *vm, env_t *env, int argc,
+                               value_t *args) {
+    // (vector-ref! <vec> <k>)
+    if (!arity_check(vm, "vector-ref", argc, 2, false)) {
+        return UNDEFINED_VAL;
+    }
+    value_t first = args[0];
+    value_t second = args[1];
+    if (!IS_VECTOR(first)) {
+        error_runtime(vm, "vector-ref: first argument must be a vector");
+        return UNDEFINED_VAL;
+    }
+    vector_t *vec = AS_VECTOR(first);
+    if (!IS_INT(second) ||
+        !(AS_INT(second) >= 0 && AS_INT(second) < vec->count)) {
+        error_runtime(
+            vm, "vector-ref: second argument must be a valid integer in range");
+        return UNDEFINED_VAL;
+    }
+    return vec->data[AS_INT(second)];
+}
+
+static value_t builtin_vec_set(vm_t *vm, env_t *env, int argc,
+                               value_t *args) {
+    // (vector-set! <vec> <k> <obj>)
+    if (!arity_check(vm, "vector-set!", argc, 3, false)) {
+        return UNDEFINED_VAL;
+    }
+    value_t first = args[0];
+    value_t second = args[1];
+    value_t third = args[2];
+    if (!IS_VECTOR(first)) {
+        error_runtime(vm, "vector-set!: first argument must be a vector");
+        return UNDEFINED_VAL;
+    }
+    vector_t *vec = AS_VECTOR(first);
+    if (!IS_INT(second) ||
+        !(AS_INT(second) >= 0 && AS_INT(second) < vec->count)) {
+        error_runtime(
+            vm,
+            "vector-set!: second argument must be a valid integer in range");
+        return UNDEFINED_VAL;
+    }
+    vec->data[AS_INT(second)] = third;
+    vm_write_barrier(vm, &vec->p, third);
+    return VOID_VAL;
+}
+
+static value_t builtin_vec_make(vm_t *vm, env_t *env, int argc,
+                                value_t *args) {
+    // (make-vector <k> <fill>)
+    if (!arity_check(vm, "make-vector", argc, 2, false)) {
+        return UNDEFINED_VAL;
+    }
+    value_t first = args[0];
+    value_t second = args[1];
+    if (!IS_INT(first) || AS_INT(first) < 0) {
+        error_runtime(
+            vm, "make-vector: first argument must be a positive integer!");
+        return UNDEFINED_VAL;
+    }
+    uint32_t count = AS_INT(first);
+    vector_t *vec = vector_new(vm, count);
+    for (uint32_t i = 0; i < count; i++) {
+        vec->data[i] = second;
+    }
+    return PTR_VAL(vec);
+}
+
+// Checks that the argument <val> of <fn_name> is a vector
+static bool vector_check(vm_t *vm, const char *fn_name, value_t val) {
+    if (!IS_VECTOR(val)) {
+        error_runtime(vm, "%s: argument must be a vector", fn_name);
+        return false;
+    }
+    return true;
+}
+
+// Makes a new vector from <count> values (copied from <data>)
+// <data> must not move, it's rooted by the caller
+static vector_t *vector_from(vm_t *vm, uint32_t count, value_t *data) {
+    vector_t *vec = vector_new(vm, count);
+    if (count > 0) {
+        memcpy(vec->data, data, sizeof(value_t) * count);
+    }
+    return vec;
+}
+
+static value_t builtin_vec_vector(vm_t *vm, env_t *env, int argc,
+                                  value_t *args) {
+    // (vector <obj> ...)
+    return PTR_VAL(vector_from(vm, argc, args));
+}
+
+static value_t builtin_vec_from_list(vm_t *vm, env_t *env, int argc,
+                                     value_t *args) {
+    // (list->vector <lst>)
+    if (!arity_check(vm, "list->vector", argc, 1, false)) {
+        return UNDEFINED_VAL;
+    }
+    int32_t count = cons_len(args[0]);
+    if (count < 0) {
+        error_runtime(vm, "list->vector: argument is not 'list?'");
+        return UNDEFINED_VAL;
+    }
+    vector_t *vec = vector_new(vm, count);
+    value_t iter = args[0];
+    for (int32_t i = 0; i < count; i++) {
+        vec->data[i] = AS_CONS(iter)->car;
+        iter = AS_CONS(iter)->cdr;
+    }
+    return PTR_VAL(vec);
+}
+
+static value_t builtin_vec_to_list(vm_t *vm, env_t *env, int argc,
+                                   value_t *args) {
+    // (vector->list <vec>)
+    if (!arity_check(vm, "vector->list", argc, 1, false) ||
+        !vector_check(vm, "vector->list", args[0])) {
+        return UNDEFINED_VAL;
+    }
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 1)) {
+        return UNDEFINED_VAL;
+    }
+    // built from the back, so it's just consing
+    value_t *result = vm->stack_top++;
+    *result = NIL_VAL;
+    vector_t *vec = AS_VECTOR(args[0]);
+    for (uint32_t i = vec->count; i > 0; i--) {
+        *result = cons_fn(vm, vec->data[i - 1], *result);
+    }
+    value_t list = *result;
+    vm_stack_restore(vm, top);
+    return list;
+}
+
+static value_t builtin_vec_map(vm_t *vm, env_t *env, int argc,
+                               value_t *args) {
+    // (vector-map <fn> <vec>)
+    if (!arity_check(vm, "vector-map", argc, 2, false) ||
+        !vector_check(vm, "vector-map", args[1])) {
+        return UNDEFINED_VAL;
+    }
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 1)) {
+        return UNDEFINED_VAL;
+    }
+    vector_t *vec = AS_VECTOR(args[1]);
+    vector_t *result = vector_new(vm, vec->count);
+    for (uint32_t i = 0; i < result->count; i++) {
+        result->data[i] = UNDEFINED_VAL;
+    }
+    *vm->stack_top++ = PTR_VAL(result);
+
+    // <fn> may change <vec>, so it's checked every time
+    for (uint32_t i = 0; i < result->count && i < vec->count; i++) {
+        value_t elem = vec->data[i];
+        result->data[i] = call(vm, env, args[0], 1, &elem);
+        vm_write_barrier(vm, &result->p, result->data[i]);
+    }
+    vm_stack_restore(vm, top);
+    return PTR_VAL(result);
+}
+
+static value_t builtin_vec_for_each(vm_t *vm, env_t *env, int argc,
+                                    value_t *args) {
+    // (vector-for-each <fn> <vec>)
+    if (!arity_check(vm, "vector-for-each", argc, 2, false) ||
+        !vector_check(vm, "vector-for-each", args[1])) {
+        return UNDEFINED_VAL;
+    }
+    vector_t *vec = AS_VECTOR(args[1]);
+    for (uint32_t i = 0; i < vec->count; i++) {
+        value_t elem = vec->data[i];
+        call(vm, env, args[0], 1, &elem);
+    }
+    return VOID_VAL;
+}
+
+static value_t builtin_vec_fill(vm_t *vm, env_t *env, int argc,
+                                value_t *args) {
+    // (vector-fill! <vec> <fill>)
+    if (!arity_check(vm, "vector-fill!", argc, 2, false) ||
+        !vector_check(vm, "vector-fill!", args[0])) {
+        return UNDEFINED_VAL;
+    }
+    vector_t *vec = AS_VECTOR(args[0]);
+    for (uint32_t i = 0; i < vec->count; i++) {
+        vec->data[i] = args[1];
+    }
+    vm_write_barrier(vm, &vec->p, args[1]);
+    return VOID_VAL;
+}
+
+static value_t builtin_vec_append(vm_t *vm, env_t *env, int argc,
+                                  value_t *args) {
+    // (vector-append <vec> ...)
+    uint32_t count = 0;
+    for (int i = 0; i < argc; i++) {
+        if (!IS_VECTOR(args[i])) {
+            error_runtime(vm, "vector-append: arguments must be vectors!");
+            return UNDEFINED_VAL;
+        }
+        count += AS_VECTOR(args[i])->count;
+    }
+    vector_t *result = vector_new(vm, count);
+    value_t *data = result->data;
+    for (int i = 0; i < argc; i++) {
+        vector_t *vec = AS_VECTOR(args[i]);
+        if (vec->count > 0) {
+            memcpy(data, vec->data, sizeof(value_t) * vec->count);
+            data += vec->count;
+        }
+    }
+    return PTR_VAL(result);
+}
+
+// Checks the range [<start>, <end>) of <vec> given to <fn_name>
+static bool vector_range_check(vm_t *vm, const char *fn_name, vector_t *vec,
+                               value_t start, value_t end) {
+    if (!IS_INT(start) || !IS_INT(end) || AS_INT(start) < 0 ||
+        AS_INT(start) > AS_INT(end) || AS_INT(end) > vec->count) {
+        error_runtime(vm, "%s: range must be valid integers in range",
+                      fn_name);
+        return false;
+    }
+    return true;
+}
+
+static value_t builtin_vec_copy(vm_t *vm, env_t *env, int argc,
+                                value_t *args) {
+    // (vector-copy <vec> [<start> [<end>]])
+    if (argc < 1 || argc > 3) {
+        error_runtime(vm, "vector-copy: takes 1 to 3 arguments");
+        return UNDEFINED_VAL;
+    }
+    if (!vector_check(vm, "vector-copy", args[0])) {
+        return UNDEFINED_VAL;
+    }
+    vector_t *vec = AS_VECTOR(args[0]);
+    value_t start = argc > 1 ? args[1] : NUM_VAL(0);
+    value_t end = argc > 2 ? args[2] : NUM_VAL(vec->count);
+    if (!vector_range_check(vm, "vector-copy", vec, start, end)) {
+        return UNDEFINED_VAL;
+    }
+    return PTR_VAL(vector_from(vm, AS_INT(end) - AS_INT(start),
+                               vec->data + AS_INT(start)));
+}
+
+static value_t builtin_vec_sub(vm_t *vm, env_t *env, int argc,
+                               value_t *args) {
+    // (subvector <vec> <start> <end>)
+    if (!arity_check(vm, "subvector", argc, 3, false) ||
+        !vector_check(vm, "subvector", args[0]) ||
+        !vector_range_check(vm, "subvector", AS_VECTOR(args[0]), args[1],
+                            args[2])) {
+        return UNDEFINED_VAL;
+    }
+    vector_t *vec = AS_VECTOR(args[0]);
+    return PTR_VAL(vector_from(vm, AS_INT(args[2]) - AS_INT(args[1]),
+                               vec->data + AS_INT(args[1])));
 }
 
-static value_t builtin_gc(vm_t *vm, env_t *env, value_t args) {
+static value_t builtin_vec_grow(vm_t *vm, env_t *env, int argc,
+                                value_t *args) {
+    // (vector-grow <vec> <k>)
+    if (!arity_check(vm, "vector-grow", argc, 2, false) ||
+        !vector_check(vm, "vector-grow", args[0])) {
+        return UNDEFINED_VAL;
+    }
+    vector_t *vec = AS_VECTOR(args[0]);
+    if (!IS_INT(args[1]) || AS_INT(args[1]) < vec->count) {
+        error_runtime(vm, "vector-grow: second argument must be an integer "
+                          "not less than the length");
+        return UNDEFINED_VAL;
+    }
+    // the new elements are unspecified, they are void here
+    uint32_t count = AS_INT(args[1]);
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 1)) {
+        return UNDEFINED_VAL;
+    }
+    vector_t *result = vector_from(vm, vec->count, vec->data);
+    *vm->stack_top++ = PTR_VAL(result);
+    if (count > result->capacity) {
+        result->data = (value_t *) vm_realloc(
+            vm, result->data, sizeof(value_t) * result->capacity,
+            sizeof(value_t) * count);
+        result->capacity = count;
+    }
+    while (result->count < count) {
+        vector_push(vm, result, VOID_VAL);
+    }
+    vm_stack_restore(vm, top);
+    return PTR_VAL(result);
+}
+
+static value_t builtin_vec_push(vm_t *vm, env_t *env, int argc,
+                                value_t *args) {
+    // (vector-push! <vec> <obj>)
+    if (!arity_check(vm, "vector-push!", argc, 2, false) ||
+        !vector_check(vm, "vector-push!", args[0])) {
+        return UNDEFINED_VAL;
+    }
+    vector_push(vm, AS_VECTOR(args[0]), args[1]);
+    return VOID_VAL;
+}
+
+/* *** core - hash tables *** */
+
+#define HASHTABLE_MIN_CAPACITY 8
+
+static bool hashtable_entry_empty(hashtable_entry_t *entry) {
+    return IS_UNDEFINED(entry->key) && IS_UNDEFINED(entry->value);
+}
+
+static bool hashtable_entry_used(hashtable_entry_t *entry) {
+    return !IS_UNDEFINED(entry->key);
+}
+
+// Hashes <key> consistently with the equality predicate of <ht>
+static uint32_t hashtable_hash(hashtable_t *ht, value_t key) {
+    if (IS_PRIMITIVE(ht->eq) && AS_PRIMITIVE(ht->eq)->fn == eq) {
+        return hash_value_eq(key);
+    }
+    return hash_value(key);
+}
+
+// Compares the keys <a> and <b> using the equality predicate of <ht>
+static bool hashtable_key_equal(vm_t *vm, env_t *env, hashtable_t *ht,
+                                value_t a, value_t b) {
+    if (IS_PRIMITIVE(ht->eq) && AS_PRIMITIVE(ht->eq)->fn == eq) {
+        return val_eq(a, b);
+    }
+    if (IS_PRIMITIVE(ht->eq) && AS_PRIMITIVE(ht->eq)->fn == equal) {
+        return val_equal(a, b);
+    }
+    value_t keys[2] = {a, b};
+    value_t result = call(vm, env, ht->eq, 2, keys);
+    return !IS_FALSE(result);
+}
+
+// Finds the index of <key> in <ht>, returns true if it's there
+// If it's not, <*index> is where it should be inserted
+// (or -1 if <ht> has no free entry)
+static bool hashtable_find(vm_t *vm, env_t *env, hashtable_t *ht,
+                           value_t key, int64_t *index) {
+    *index = -1;
+    if (ht->capacity == 0) {
+        return false;
+    }
+    uint32_t hash = hashtable_hash(ht, key);
+    for (uint32_t i = 0; i < ht->capacity; i++) {
+        // the predicate may be a scheme procedure, so the entries
+        // are read again each time
+        uint32_t probe = (hash + i) & (ht->capacity - 1);
+        hashtable_entry_t *entry = &ht->entries[probe];
+        if (hashtable_entry_empty(entry)) {
+            if (*index < 0) {
+                *index = probe;
+            }
+            return false;
+        }
+        if (!hashtable_entry_used(entry)) {
+            // the first tombstone is reused
+            if (*index < 0) {
+                *index = probe;
+            }
+        } else if (hashtable_key_equal(vm, env, ht, entry->key, key)) {
+            *index = probe;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Moves all entries of <ht> to new <capacity> entries
+// (a power of two big enough for all of them)
+static bool hashtable_resize(vm_t *vm, hashtable_t *ht, uint32_t capacity) {
+    hashtable_entry_t *entries = (hashtable_entry_t *) vm_realloc(
+        vm, NULL, 0, sizeof(hashtable_entry_t) * capacity);
+    if (entries == NULL) {
+        return false;
+    }
+    for (uint32_t i = 0; i < capacity; i++) {
+        entries[i].key = UNDEFINED_VAL;
+        entries[i].value = UNDEFINED_VAL;
+    }
+
+    // the keys are all different, no need to compare them
+    for (uint32_t i = 0; i < ht->capacity; i++) {
+        hashtable_entry_t *entry = &ht->entries[i];
+        if (!hashtable_entry_used(entry)) {
+            continue;
+        }
+        uint32_t probe = hashtable_hash(ht, entry->key) & (capacity - 1);
+        while (!hashtable_entry_empty(&entries[probe])) {
+            probe = (probe + 1) & (capacity - 1);
+        }
+        entries[probe] = *entry;
+    }
+
+    vm_realloc(vm, ht->entries, sizeof(hashtable_entry_t) * ht->capacity, 0);
+    ht->entries = entries;
+    ht->capacity = capacity;
+    ht->tombstones = 0;
+    return true;
+}
+
+// Returns the smallest capacity for <count> entries
+static uint32_t hashtable_capacity_for(uint32_t count) {
+    uint32_t capacity = HASHTABLE_MIN_CAPACITY;
+    // keep the load factor under 3/4
+    while (count * 4 > capacity * 3) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+// Checks that the argument <val> of <fn_name> is a hash table
+static bool hashtable_check(vm_t *vm, const char *fn_name, value_t val) {
+    if (!IS_HASHTABLE(val)) {
+        error_runtime(vm, "%s: first argument must be a hash table", fn_name);
+        return false;
+    }
+    return true;
+}
+
+// Makes a hash table for (<fn_name> <eq>) which doesn't keep <weak> alive
+static value_t hashtable_make(vm_t *vm, const char *fn_name, int argc,
+                              value_t *args, hashtable_weak_t weak) {
+    if (!arity_check(vm, fn_name, argc, 1, false)) {
+        return UNDEFINED_VAL;
+    }
+    if (!IS_PROCEDURE(args[0])) {
+        error_runtime(vm, "%s: argument must be a procedure", fn_name);
+        return UNDEFINED_VAL;
+    }
+    return PTR_VAL(hashtable_new(vm, args[0], weak));
+}
+
+static value_t builtin_hash_make(vm_t *vm, env_t *env, int argc,
+                                 value_t *args) {
+    // (make-hash <eq>)
+    return hashtable_make(vm, "make-hash", argc, args, HASHTABLE_STRONG);
+}
+
+static value_t builtin_hash_make_weak_keys(vm_t *vm, env_t *env, int argc,
+                                           value_t *args) {
+    // (make-weak-key-hash <eq>)
+    return hashtable_make(vm, "make-weak-key-hash", argc, args,
+                          HASHTABLE_WEAK_KEYS);
+}
+
+static value_t builtin_hash_make_weak_values(vm_t *vm, env_t *env, int argc,
+                                             value_t *args) {
+    // (make-weak-value-hash <eq>)
+    return hashtable_make(vm, "make-weak-value-hash", argc, args,
+                          HASHTABLE_WEAK_VALUES);
+}
+
+static value_t builtin_hash_eq(vm_t *vm, env_t *env, int argc,
+                               value_t *args) {
+    // (hash-eq <ht>)
+    if (!arity_check(vm, "hash-eq", argc, 1, false) ||
+        !hashtable_check(vm, "hash-eq", args[0])) {
+        return UNDEFINED_VAL;
+    }
+    return AS_HASHTABLE(args[0])->eq;
+}
+
+static value_t builtin_hash_count(vm_t *vm, env_t *env, int argc,
+                                  value_t *args) {
+    // (hash-count <ht>)
+    if (!arity_check(vm, "hash-count", argc, 1, false) ||
+        !hashtable_check(vm, "hash-count", args[0])) {
+        return UNDEFINED_VAL;
+    }
+    return NUM_VAL(AS_HASHTABLE(args[0])->count);
+}
+
+static value_t builtin_hash_capacity(vm_t *vm, env_t *env, int argc,
+                                     value_t *args) {
+    // (hash-capacity <ht>)
+    if (!arity_check(vm, "hash-capacity", argc, 1, false) ||
+        !hashtable_check(vm, "hash-capacity", args[0])) {
+        return UNDEFINED_VAL;
+    }
+    return NUM_VAL(AS_HASHTABLE(args[0])->capacity);
+}
+
+static value_t builtin_hash_exists(vm_t *vm, env_t *env, int argc,
+                                   value_t *args) {
+    // (hash-exists? <ht> <key>)
+    if (!arity_check(vm, "hash-exists?", argc, 2, false) ||
+        !hashtable_check(vm, "hash-exists?", args[0])) {
+        return UNDEFINED_VAL;
+    }
+    int64_t index;
+    return BOOL_VAL(hashtable_find(vm, env, AS_HASHTABLE(args[0]), args[1],
+                                   &index));
+}
+
+static value_t builtin_hash_ref(vm_t *vm, env_t *env, int argc,
+                                value_t *args) {
+    // (hash-ref <ht> <key>)
+    if (!arity_check(vm, "hash-ref", argc, 2, false) ||
+        !hashtable_check(vm, "hash-ref", args[0])) {
+        return UNDEFINED_VAL;
+    }
+    hashtable_t *ht = AS_HASHTABLE(args[0]);
+    int64_t index;
+    if (!hashtable_find(vm, env, ht, args[1], &index)) {
+        error_runtime(vm, "Key is not present in hash!");
+        return UNDEFINED_VAL;
+    }
+    return ht->entries[index].value;
+}
+
+static value_t builtin_hash_set(vm_t *vm, env_t *env, int argc,
+                                value_t *args) {
+    // (hash-set! <ht> <key> <value>)
+    if (!arity_check(vm, "hash-set!", argc, 3, false) ||
+        !hashtable_check(vm, "hash-set!", args[0])) {
+        return UNDEFINED_VAL;
+    }
+    if (IS_UNDEFINED(args[1])) {
+        error_runtime(vm, "hash-set!: key can't be undefined");
+        return UNDEFINED_VAL;
+    }
+    hashtable_t *ht = AS_HASHTABLE(args[0]);
+    int64_t index;
+    if (hashtable_find(vm, env, ht, args[1], &index)) {
+        ht->entries[index].value = args[2];
+        vm_write_barrier(vm, &ht->p, args[2]);
+        return VOID_VAL;
+    }
+
+    if ((ht->count + ht->tombstones + 1) * 4 > ht->capacity * 3) {
+        // tombstones are dropped, it grows only if it's full of entries
+        if (!hashtable_resize(vm, ht, hashtable_capacity_for(ht->count + 1))) {
+            return UNDEFINED_VAL;
+        }
+        hashtable_find(vm, env, ht, args[1], &index);
+    }
+    if (index < 0) {
+        error_runtime(vm, "Cannot insert to hash!");
+        return UNDEFINED_VAL;
+    }
+
+    hashtable_entry_t *entry = &ht->entries[index];
+    if (!hashtable_entry_empty(entry)) {
+        ht->tombstones--;
+    }
+    entry->key = args[1];
+    entry->value = args[2];
+    vm_write_barrier(vm, &ht->p, args[1]);
+    vm_write_barrier(vm, &ht->p, args[2]);
+    ht->count++;
+    return VOID_VAL;
+}
+
+static value_t builtin_hash_delete(vm_t *vm, env_t *env, int argc,
+                                   value_t *args) {
+    // (hash-delete! <ht> <key>)
+    if (!arity_check(vm, "hash-delete!", argc, 2, false) ||
+        !hashtable_check(vm, "hash-delete!", args[0])) {
+        return UNDEFINED_VAL;
+    }
+    hashtable_t *ht = AS_HASHTABLE(args[0]);
+    int64_t index;
+    if (!hashtable_find(vm, env, ht, args[1], &index)) {
+        return VOID_VAL;
+    }
+    ht->entries[index].key = UNDEFINED_VAL;
+    ht->entries[index].value = TRUE_VAL;
+    ht->count--;
+    ht->tombstones++;
+
+    // shrink if it's mostly empty
+    if (ht->capacity > HASHTABLE_MIN_CAPACITY &&
+        ht->count < ht->capacity / 4) {
+        hashtable_resize(vm, ht, hashtable_capacity_for(ht->count * 2));
+    }
+    return VOID_VAL;
+}
+
+static value_t builtin_hash_resize(vm_t *vm, env_t *env, int argc,
+                                   value_t *args) {
+    // (hash-resize! <ht> <capacity>)
+    if (!arity_check(vm, "hash-resize!", argc, 2, false) ||
+        !hashtable_check(vm, "hash-resize!", args[0])) {
+        return UNDEFINED_VAL;
+    }
+    if (!IS_INT(args[1]) || AS_INT(args[1]) < 0) {
+        error_runtime(vm, "hash-resize!: second argument must be "
+                          "a non-negative integer");
+        return UNDEFINED_VAL;
+    }
+    hashtable_t *ht = AS_HASHTABLE(args[0]);
+
+    // the capacity is rounded up to hold all the entries
+    uint32_t capacity = hashtable_capacity_for(ht->count);
+    while (capacity < AS_INT(args[1])) {
+        capacity <<= 1;
+    }
+    hashtable_resize(vm, ht, capacity);
+    return VOID_VAL;
+}
+
+static value_t builtin_hash_walk(vm_t *vm, env_t *env, int argc,
+                                 value_t *args) {
+    // (hash-walk <ht> <fn>)
+    if (!arity_check(vm, "hash-walk", argc, 2, false) ||
+        !hashtable_check(vm, "hash-walk", args[0])) {
+        return UNDEFINED_VAL;
+    }
+    hashtable_t *ht = AS_HASHTABLE(args[0]);
+
+    // the entry is kept on the stack (a weak table doesn't keep it alive)
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 2)) {
+        return UNDEFINED_VAL;
+    }
+    value_t *pair = vm->stack_top;
+    vm->stack_top += 2;
+
+    // <fn> may change the table, so it's indexed every time
+    for (uint32_t i = 0; i < ht->capacity; i++) {
+        hashtable_entry_t *entry = &ht->entries[i];
+        if (hashtable_entry_used(entry)) {
+            pair[0] = entry->key;
+            pair[1] = entry->value;
+            call(vm, env, args[1], 2, pair);
+        }
+    }
+    vm_stack_restore(vm, top);
+    return VOID_VAL;
+}
+
+static value_t builtin_hash_alist(vm_t *vm, env_t *env, int argc,
+                                  value_t *args) {
+    // (hash->alist <ht>)
+    if (!arity_check(vm, "hash->alist", argc, 1, false) ||
+        !hashtable_check(vm, "hash->alist", args[0])) {
+        return UNDEFINED_VAL;
+    }
+    hashtable_t *ht = AS_HASHTABLE(args[0]);
+
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 4)) {
+        return UNDEFINED_VAL;
+    }
+    value_t *result = vm->stack_top++;
+    value_t *pair = vm->stack_top++;
+    // a weak table doesn't keep the entry alive while the pair is allocated
+    value_t *entry_vals = vm->stack_top;
+    vm->stack_top += 2;
+    *result = NIL_VAL;
+    *pair = NIL_VAL;
+    entry_vals[0] = NIL_VAL;
+    entry_vals[1] = NIL_VAL;
+    for (uint32_t i = 0; i < ht->capacity; i++) {
+        hashtable_entry_t *entry = &ht->entries[i];
+        if (hashtable_entry_used(entry)) {
+            entry_vals[0] = entry->key;
+            entry_vals[1] = entry->value;
+            *pair = cons_fn(vm, entry_vals[0], entry_vals[1]);
+            *result = cons_fn(vm, *pair, *result);
+        }
+    }
+
+    value_t alist = *result;
+    vm_stack_restore(vm, top);
+    return alist;
+}
+
+/* *** core - weak references and the GC *** */
+
+static value_t builtin_weak_box_make(vm_t *vm, env_t *env, int argc,
+                                     value_t *args) {
+    // (make-weak-box <obj>)
+    if (!arity_check(vm, "make-weak-box", argc, 1, false)) {
+        return UNDEFINED_VAL;
+    }
+    return PTR_VAL(weakbox_new(vm, args[0]));
+}
+
+static value_t builtin_is_weak_box(vm_t *vm, env_t *env, int argc,
+                                   value_t *args) {
+    // (weak-box? <obj>)
+    if (!arity_check(vm, "weak-box?", argc, 1, false)) {
+        return UNDEFINED_VAL;
+    }
+    return BOOL_VAL(IS_WEAKBOX(args[0]));
+}
+
+static value_t builtin_weak_box_value(vm_t *vm, env_t *env, int argc,
+                                      value_t *args) {
+    // (weak-box-value <box>)
+    // #f once the value was collected
+    if (!arity_check(vm, "weak-box-value", argc, 1, false)) {
+        return UNDEFINED_VAL;
+    }
+    if (!IS_WEAKBOX(args[0])) {
+        error_runtime(vm, "weak-box-value: argument must be a weak box");
+        return UNDEFINED_VAL;
+    }
+    return AS_WEAKBOX(args[0])->value;
+}
+
+static value_t builtin_finalizer_add(vm_t *vm, env_t *env, int argc,
+                                     value_t *args) {
+    // (register-finalizer! <obj> <fn>)
+    // <fn> is called with <obj> by run-finalizers once <obj> is collected
+    if (!arity_check(vm, "register-finalizer!", argc, 2, false)) {
+        return UNDEFINED_VAL;
+    }
+    if (IS_VAL(args[0])) {
+        error_runtime(vm, "register-finalizer!: first argument "
+                          "can't be a number or a constant");
+        return UNDEFINED_VAL;
+    }
+    if (!IS_PROCEDURE(args[1])) {
+        error_runtime(vm,
+                      "register-finalizer!: second argument must be a "
+                      "procedure");
+        return UNDEFINED_VAL;
+    }
+    vm_finalizer_add(vm, args[0], args[1]);
+    return VOID_VAL;
+}
+
+static value_t builtin_gc(vm_t *vm, env_t *env, int argc, value_t *args) {
+    // (gc)
+    // a major collection clears the weak references to everything unreachable
     vm_gc(vm);
     return NIL_VAL;
 }
+
+static value_t builtin_gc_stats(vm_t *vm, env_t *env, int argc,
+                                value_t *args) {
+    // (gc-stats)
+    // an assoc list of the statistics of the GC (times are in seconds)
+    if (!arity_check(vm, "gc-stats", argc, 0, false)) {
+        return UNDEFINED_VAL;
+    }
+    // (taken before the list is allocated, which can run the GC)
+    gc_stats_t *stats = &vm->gc_stats;
+    struct {
+        const char *name;
+        double value;
+    } fields[] = {
+        {"minor-count", (double) stats->minor_count},
+        {"minor-time", stats->minor_time},
+        {"minor-max", stats->minor_max},
+        {"minor-scanned", (double) stats->minor_scanned},
+        {"major-count", (double) stats->major_count},
+        {"major-time", stats->major_time},
+        {"major-max", stats->major_max},
+        {"step-count", (double) stats->step_count},
+        {"step-time", stats->step_time},
+        {"step-max", stats->step_max},
+        {"step-budget", (double) vm->config.gc_step_time / 1000000},
+        {"remark-scanned", (double) stats->remark_scanned},
+        {"remark-marked", (double) stats->remark_marked},
+        {"conservative", (double) CONSERVATIVE},
+        {"heap-max", (double) vm->config.heap_size_max},
+        {"heap-full", (double) stats->heap_full},
+    };
+
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 2)) {
+        return UNDEFINED_VAL;
+    }
+    value_t *result = vm->stack_top++;
+    value_t *pair = vm->stack_top++;
+    *result = NIL_VAL;
+    *pair = NIL_VAL;
+    for (int i = sizeof(fields) / sizeof(fields[0]) - 1; i >= 0; i--) {
+        *pair = PTR_VAL(
+            symbol_intern(vm, fields[i].name, strlen(fields[i].name)));
+        *pair = cons_fn(vm, *pair, NUM_VAL(fields[i].value));
+        *result = cons_fn(vm, *pair, *result);
+    }
+    value_t list = *result;
+    vm_stack_restore(vm, top);
+    return list;
+}
+
+static value_t builtin_finalize(vm_t *vm, env_t *env, int argc,
+                                value_t *args) {
+    // (run-finalizers)
+    if (!arity_check(vm, "run-finalizers", argc, 0, false)) {
+        return UNDEFINED_VAL;
+    }
+    return NUM_VAL(vm_finalize(vm, env));
+}
+
+/* *** core - other library functions *** */
+
+static value_t builtin_error(vm_t *vm, env_t *env, int argc, value_t *args) {
+    if (!arity_check(vm, "error", argc, 1, false)) {
+        return UNDEFINED_VAL;
+    }
+    value_t arg = args[0];
+    if (!IS_STRING(arg)) {
+        error_runtime(vm, "error: argument must be a string");
+        return UNDEFINED_VAL;
+    }
+    error_runtime(vm, AS_STRING(arg)->value);
+    return VOID_VAL;
+}
+
+static value_t builtin_time(vm_t *vm, env_t *env, int argc, value_t *args) {
+    arity_check(vm, "current-time", argc, 0, false);
+    return NUM_VAL((double) clock() / (CLOCKS_PER_SEC / 1000.0F));
+}
+
+// Exits the program - this procedure is really harsh
+// TODO: Can we just stop the interpret loop and exit more gracefully?
+static value_t builtin_exit(vm_t *vm, env_t *env, int argc, value_t *args) {
+    // (exit <status>)
+    if (!arity_check(vm, "exit", argc, 1, false)) {
+        return UNDEFINED_VAL;
+    }
+    value_t arg = args[0];
+    if (!IS_INT(arg)) {
+        error_runtime(vm, "exit: argument must be an integer");
+        return UNDEFINED_VAL;
+    }
+    int exit_status = AS_INT(arg);
+    vm_free(vm);
+    exit(exit_status);
+}
+
+static value_t builtin_hash(vm_t *vm, env_t *env, int argc, value_t *args) {
+    if (!arity_check(vm, "hash", argc, 1, false)) {
+        return UNDEFINED_VAL;
+    }
+
+    value_t arg = args[0];
+    if (IS_VAL(arg) || IS_STRING(arg) || IS_SYMBOL(arg)) {
+        return NUM_VAL(hash_value(arg));
+    }
+    error_runtime(vm, "hash: cannot hash non-immutable type");
+    return UNDEFINED_VAL;
+}
+
+/* *** debug functions *** */
+
+#if DEBUG
+
+static value_t builtin_env_cur(vm_t *vm, env_t *env, int argc,
+                               value_t *args) {
+    arity_check(vm, "current-environment", argc, 0, false);
+    return PTR_VAL(env);
+}
+
+static value_t builtin_env_top(vm_t *vm, env_t *env, int argc,
+                               value_t *args) {
+    arity_check(vm, "top-level-environment", argc, 0, false);
+    return PTR_VAL(vm->top_env);
+}
+
+static value_t builtin_env_vars(vm_t *vm, env_t *env, int argc,
+                                value_t *args) {
+    // (environment-variables <env>)
+    if (!arity_check(vm, "environment-variables", argc, 1, false)) {
+        return UNDEFINED_VAL;
+    }
+    if (!IS_ENV(args[0])) {
+        error_runtime(vm,
+                      "environment-variables: argument must be an environment");
+        return UNDEFINED_VAL;
+    }
+    env_t *e = AS_ENV(args[0]);
+
+    // an assoc list of the defined variables followed by the slots
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 2)) {
+        return UNDEFINED_VAL;
+    }
+    value_t *result = vm->stack_top++;
+    value_t *pair = vm->stack_top++;
+    *result = NIL_VAL;
+    *pair = NIL_VAL;
+
+    value_t iter = e->vars;
+    for (uint32_t i = 0; i < e->count; i++) {
+        value_t name = iter;
+        if (IS_CONS(iter)) {
+            name = AS_CONS(iter)->car;
+            if (e->bindings) {
+                name = AS_CONS(name)->car;
+            }
+            iter = AS_CONS(iter)->cdr;
+        }
+        *pair = cons_fn(vm, name, e->slots[i]);
+        *result = cons_fn(vm, *pair, *result);
+    }
+
+    for (uint32_t i = 0; i < e->variables_capacity; i++) {
+        variable_t *var = &e->variables[i];
+        if (var->sym != NULL) {
+            *pair = cons_fn(vm, PTR_VAL(var->sym), var->val);
+            *result = cons_fn(vm, *pair, *result);
+        }
+    }
+
+    value_t variables = *result;
+    vm_stack_restore(vm, top);
+    return variables;
+}
+
+static value_t builtin_env_up(vm_t *vm, env_t *env, int argc,
+                              value_t *args) {
+    // (environment-parent <env>)
+    if (!arity_check(vm, "environment-parent", argc, 1, false)) {
+        return UNDEFINED_VAL;
+    }
+    if (!IS_ENV(args[0])) {
+        write(stderr, args[0]);
+        error_runtime(vm,
+                      "environment-parent: argument must be an environment");
+        return UNDEFINED_VAL;
+    }
+    env_t *e = AS_ENV(args[0]);
+    if (e->up == NULL) {
+        return NIL_VAL;
+    }
+    return PTR_VAL(e->up);
+}
 #endif
 
 /* *** DEFAULT ENVIRONMENT *** */
 
 env_t *scm_env_default(vm_t *vm) {
-    env_t *env = env_new(vm, NIL_VAL, NULL);
+    env_t *env = env_new(vm, NIL_VAL, false, 0, NULL);
     vm->top_env = env;
 
+    // the primitives and their names live as long as the VM
+    // (the top env is a root which changes a lot, it isn't permanent)
+    bool permanent = vm->permanent;
+    vm->permanent = true;
+
     /* numeric functions */
     symbol_t *pi_sym = symbol_intern(vm, "pi", 2);
     variable_add(vm, env, pi_sym, NUM_VAL(3.14159265358979323846));
@@ -721,8 +2075,20 @@ env_t *scm_env_default(vm_t *vm) {
     primitive_add(vm, env, "builtin<", 8, builtin_num_lt);
     primitive_add(vm, env, "builtin=", 8, builtin_num_eq);
 
+    primitive_add(vm, env, "+", 1, builtin_num_add);
+    primitive_add(vm, env, "*", 1, builtin_num_mul);
+    primitive_add(vm, env, "-", 1, builtin_num_sub);
+    primitive_add(vm, env, "/", 1, builtin_num_div);
+
+    primitive_add(vm, env, "=", 1, builtin_num_eq_all);
+    primitive_add(vm, env, "<", 1, builtin_num_lt_all);
+    primitive_add(vm, env, ">", 1, builtin_num_gt_all);
+    primitive_add(vm, env, "<=", 2, builtin_num_le_all);
+    primitive_add(vm, env, ">=", 2, builtin_num_ge_all);
+
     /* types and predicates */
     primitive_add(vm, env, "eq?", 3, eq);
+    primitive_add(vm, env, "eqv?", 4, eq);
     primitive_add(vm, env, "equal?", 6, equal);
 
     primitive_add(vm, env, "cons?", 5, builtin_is_cons);
@@ -732,6 +2098,7 @@ env_t *scm_env_default(vm_t *vm) {
     primitive_add(vm, env, "symbol?", 7, builtin_is_symbol);
     primitive_add(vm, env, "procedure?", 10, builtin_is_procedure);
     primitive_add(vm, env, "vector?", 7, builtin_is_vector);
+    primitive_add(vm, env, "hash?", 5, builtin_is_hash);
     primitive_add(vm, env, "environment?", 12, builtin_is_environment);
     primitive_add(vm, env, "void", 4, builtin_void);
     primitive_add(vm, env, "undefined", 9, builtin_undefined);
@@ -739,12 +2106,12 @@ env_t *scm_env_default(vm_t *vm) {
     variable_add(vm, env, eof_sym, EOF_VAL);
 
     /* special constructs - flow control */
-    primitive_add(vm, env, "begin", 5, begin);
-    primitive_add(vm, env, "define", 6, builtin_define);
-    primitive_add(vm, env, "lambda", 6, lambda);
-    primitive_add(vm, env, "if", 2, builtin_if);
-    primitive_add(vm, env, "set!", 4, builtin_set);
-    primitive_add(vm, env, "let", 3, builtin_let);
+    special_add(vm, env, "begin", 5, begin_tail);
+    special_add(vm, env, "define", 6, builtin_define);
+    special_add(vm, env, "lambda", 6, lambda);
+    special_add(vm, env, "if", 2, builtin_if);
+    special_add(vm, env, "set!", 4, builtin_set);
+    special_add(vm, env, "let", 3, builtin_let);
 
     /* I/O */
     primitive_add(vm, env, "write", 5, builtin_write);
@@ -756,28 +2123,83 @@ env_t *scm_env_default(vm_t *vm) {
     }
 
     /* or/and */
-    primitive_add(vm, env, "or", 2, builtin_or);
-    primitive_add(vm, env, "and", 3, builtin_and);
+    special_add(vm, env, "or", 2, builtin_or);
+    special_add(vm, env, "and", 3, builtin_and);
 
     /* macros, eval */
-    primitive_add(vm, env, "define-macro", 12, define_macro);
+    special_add(vm, env, "define-macro", 12, define_macro);
     primitive_add(vm, env, "eval", 4, builtin_eval);
     primitive_add(vm, env, "apply", 5, builtin_apply);
-    primitive_add(vm, env, "expand", 6, builtin_expand);
+    special_add(vm, env, "expand", 6, builtin_expand);
     primitive_add(vm, env, "gensym", 6, builtin_gensym);
-    primitive_add(vm, env, "quote", 5, quote);
+    special_add(vm, env, "quote", 5, quote);
 
     /* list functions */
     primitive_add(vm, env, "cons", 4, builtin_cons);
     primitive_add(vm, env, "car", 3, builtin_car);
     primitive_add(vm, env, "cdr", 3, builtin_cdr);
     primitive_add(vm, env, "builtin-length", 14, builtin_length);
+    primitive_add(vm, env, "length", 6, builtin_list_length);
+    primitive_add(vm, env, "list-copy", 9, builtin_list_copy);
+    primitive_add(vm, env, "reverse", 7, builtin_list_reverse);
+    primitive_add(vm, env, "append", 6, builtin_list_append);
+    primitive_add(vm, env, "map", 3, builtin_list_map);
+    primitive_add(vm, env, "filter", 6, builtin_list_filter);
+    primitive_add(vm, env, "foldl", 5, builtin_list_foldl);
+    primitive_add(vm, env, "foldr", 5, builtin_list_foldr);
+    primitive_add(vm, env, "drop", 4, builtin_list_drop);
+    primitive_add(vm, env, "list-tail", 9, builtin_list_tail);
+    primitive_add(vm, env, "list-ref", 8, builtin_list_ref);
+    primitive_add(vm, env, "member?", 7, builtin_list_is_member);
+    primitive_add(vm, env, "memq", 4, builtin_list_memq);
+    primitive_add(vm, env, "memv", 4, builtin_list_memq);
+    primitive_add(vm, env, "member", 6, builtin_list_member);
+    primitive_add(vm, env, "assq", 4, builtin_list_assq);
+    primitive_add(vm, env, "assv", 4, builtin_list_assq);
+    primitive_add(vm, env, "assoc", 5, builtin_list_assoc);
 
     /* vector functions */
     primitive_add(vm, env, "vector-length", 13, builtin_vec_length);
     primitive_add(vm, env, "vector-ref", 10, builtin_vec_ref);
     primitive_add(vm, env, "vector-set!", 11, builtin_vec_set);
     primitive_add(vm, env, "make-vector", 11, builtin_vec_make);
+    primitive_add(vm, env, "vector", 6, builtin_vec_vector);
+    primitive_add(vm, env, "list->vector", 12, builtin_vec_from_list);
+    primitive_add(vm, env, "vector->list", 12, builtin_vec_to_list);
+    primitive_add(vm, env, "vector-map", 10, builtin_vec_map);
+    primitive_add(vm, env, "vector-for-each", 15, builtin_vec_for_each);
+    primitive_add(vm, env, "vector-fill!", 12, builtin_vec_fill);
+    primitive_add(vm, env, "vector-append", 13, builtin_vec_append);
+    primitive_add(vm, env, "vector-copy", 11, builtin_vec_copy);
+    primitive_add(vm, env, "subvector", 9, builtin_vec_sub);
+    primitive_add(vm, env, "vector-grow", 11, builtin_vec_grow);
+    primitive_add(vm, env, "vector-push!", 12, builtin_vec_push);
+
+    /* hash tables */
+    primitive_add(vm, env, "make-hash", 9, builtin_hash_make);
+    primitive_add(vm, env, "make-weak-key-hash", 18,
+                  builtin_hash_make_weak_keys);
+    primitive_add(vm, env, "make-weak-value-hash", 20,
+                  builtin_hash_make_weak_values);
+    primitive_add(vm, env, "hash-eq", 7, builtin_hash_eq);
+    primitive_add(vm, env, "hash-count", 10, builtin_hash_count);
+    primitive_add(vm, env, "hash-capacity", 13, builtin_hash_capacity);
+    primitive_add(vm, env, "hash-exists?", 12, builtin_hash_exists);
+    primitive_add(vm, env, "hash-ref", 8, builtin_hash_ref);
+    primitive_add(vm, env, "hash-set!", 9, builtin_hash_set);
+    primitive_add(vm, env, "hash-delete!", 12, builtin_hash_delete);
+    primitive_add(vm, env, "hash-resize!", 12, builtin_hash_resize);
+    primitive_add(vm, env, "hash-walk", 9, builtin_hash_walk);
+    primitive_add(vm, env, "hash->alist", 11, builtin_hash_alist);
+
+    /* weak references */
+    primitive_add(vm, env, "make-weak-box", 13, builtin_weak_box_make);
+    primitive_add(vm, env, "weak-box?", 9, builtin_is_weak_box);
+    primitive_add(vm, env, "weak-box-value", 14, builtin_weak_box_value);
+    primitive_add(vm, env, "register-finalizer!", 19, builtin_finalizer_add);
+    primitive_add(vm, env, "run-finalizers", 14, builtin_finalize);
+    primitive_add(vm, env, "gc", 2, builtin_gc);
+    primitive_add(vm, env, "gc-stats", 8, builtin_gc_stats);
 
     /* other library functions */
     primitive_add(vm, env, "error", 5, builtin_error);
@@ -790,10 +2212,10 @@ env_t *scm_env_default(vm_t *vm) {
     primitive_add(vm, env, "top-level-environment", 21, builtin_env_top);
     primitive_add(vm, env, "environment-variables", 21, builtin_env_vars);
     primitive_add(vm, env, "environment-parent", 18, builtin_env_up);
-
-    primitive_add(vm, env, "gc", 2, builtin_gc);
 #endif
 
+    vm->permanent = permanent;
+
     // Automatically loads the stdlib if a load function is present
     if (vm->config.load_fn != NULL) {
         vm->config.load_fn(vm, env, "src/stdlib.scm");
@@ -12,7 +12,7 @@ void error_runtime(vm_t *vm, const char *format, ...);
 
 // Checks if there are exactly n arguments (if at_least is false)
 //                  or at least n arguments (if at_least is true)
-bool arity_check(vm_t *vm, const char *fn_name, value_t args, int n,
+bool arity_check(vm_t *vm, const char *fn_name, int argc, int n,
                  bool at_least);
 
 // Loads a default environment
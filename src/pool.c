@@ -0,0 +1,782 @@
+#include "config.h"
+#if MMAP && !defined(_DEFAULT_SOURCE)
+// MAP_ANONYMOUS and madvise aren't in strict C99/POSIX
+#define _DEFAULT_SOURCE 1
+#endif  // MMAP
+
+#include <stdlib.h>  // qsort
+#include <string.h>  // memset
+#if THREADS
+#include <sched.h>  // sched_yield
+#endif  // THREADS
+#if MMAP
+#include <sys/mman.h>  // mmap, munmap, madvise
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif  // MMAP
+
+#include "pool.h"
+#include "vm.h"  // vm_t, vm_size
+
+// The pages or the big values changed, they have to be indexed again
+static inline void index_invalidate(vm_t *vm) {
+#if CONSERVATIVE
+    vm->index.valid = false;
+#else
+    (void) vm;
+#endif  // CONSERVATIVE
+}
+
+static inline size_t pool_class(size_t size) {
+    return (size - 1) / POOL_GRANULE;
+}
+
+// Returns the index of the lowest set bit of <bits> (which isn't 0)
+static inline unsigned lowest_bit(uint64_t bits) {
+#if defined(__GNUC__)
+    return (unsigned) __builtin_ctzll(bits);
+#else
+    unsigned index = 0;
+    while (!(bits & 1)) {
+        bits >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+// Rounds <ptr> up to a multiple of <align> (a power of two)
+static inline char *align_up(char *ptr, size_t align) {
+    return (char *) (((uintptr_t) ptr + align - 1) & ~(uintptr_t) (align - 1));
+}
+
+#if MMAP
+// the part of an unused page given back to the OS, the header stays
+// (it's a multiple of the size of the pages of the OS)
+#define PAGE_DISCARD_START (16 * 1024)
+
+// Maps <size> bytes aligned to <align>, returns NULL if it can't
+static char *chunk_map(size_t size, size_t align) {
+    char *base = (char *) mmap(NULL, size + align, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == (char *) MAP_FAILED) {
+        return NULL;
+    }
+    // only the aligned part is kept
+    char *start = align_up(base, align);
+    if (start > base) {
+        munmap(base, (size_t) (start - base));
+    }
+    if (base + align > start) {
+        munmap(start + size, (size_t) (base + align - start));
+    }
+    return start;
+}
+#endif  // MMAP
+
+// Allocates a new chunk of unused pages, a bigger one as the heap grows
+static bool chunk_new(vm_t *vm) {
+    size_t pages = POOL_CHUNK_PAGES;
+    while (pages < POOL_CHUNK_PAGES_MAX && pages * 4 <= vm->num_pages) {
+        pages *= 2;
+    }
+#if MMAP
+    size_t align = POOL_PAGE_SIZE;
+    if (vm->config.heap_huge_pages) {
+        align = POOL_HUGE_PAGES * POOL_PAGE_SIZE;
+        if (pages < POOL_HUGE_PAGES) {
+            pages = POOL_HUGE_PAGES;
+        }
+    }
+    char *start = chunk_map(pages * POOL_PAGE_SIZE, align);
+    if (start == NULL) {
+        return false;
+    }
+#ifdef MADV_HUGEPAGE
+    if (vm->config.heap_huge_pages) {
+        madvise(start, pages * POOL_PAGE_SIZE, MADV_HUGEPAGE);
+    }
+#endif  // MADV_HUGEPAGE
+    void *chunk = start;
+#else
+    // one more page, so that the pages can be aligned
+    void *chunk = vm->config.realloc_fn(NULL, (pages + 1) * POOL_PAGE_SIZE);
+    if (chunk == NULL) {
+        return false;
+    }
+    char *start = align_up((char *) chunk, POOL_PAGE_SIZE);
+#endif  // MMAP
+    pool_page_t *first = (pool_page_t *) start;
+    for (size_t i = pages; i-- > 0;) {
+        pool_page_t *page = (pool_page_t *) (start + i * POOL_PAGE_SIZE);
+        page->first = first;
+        page->chunk = i == 0 ? chunk : NULL;
+        page->pages = i == 0 ? (uint32_t) pages : 0;
+        page->unused = i == 0 ? (uint32_t) pages : 0;
+        page->next = vm->free_pages;
+        vm->free_pages = page;
+    }
+    return true;
+}
+
+// Frees the chunk whose first page is <first>
+static void chunk_free(vm_t *vm, pool_page_t *first) {
+#if MMAP
+    munmap(first->chunk, first->pages * POOL_PAGE_SIZE);
+#else
+    vm->config.realloc_fn(first->chunk, 0);
+#endif  // MMAP
+}
+
+// Takes an unused page, allocates a new chunk of them if there is none
+static pool_page_t *page_new(vm_t *vm) {
+    if (vm->free_pages == NULL && !chunk_new(vm)) {
+        return NULL;
+    }
+    pool_page_t *page = vm->free_pages;
+    vm->free_pages = page->next;
+    page->first->unused--;
+    vm->num_pages++;
+    return page;
+}
+
+// Returns <page> to the unused ones
+static void page_free(vm_t *vm, pool_page_t *page) {
+    page->next = vm->free_pages;
+    vm->free_pages = page;
+    page->first->unused++;
+    vm->num_pages--;
+}
+
+// Takes the chunks whose pages are all unused out of the unused pages,
+// returns their first pages linked together
+static pool_page_t *chunks_unused(vm_t *vm) {
+    pool_page_t *chunks = NULL;
+    pool_page_t **link = &vm->free_pages;
+    while (*link != NULL) {
+        pool_page_t *page = *link;
+        if (page->first->unused < page->first->pages) {
+            link = &page->next;
+            continue;
+        }
+        *link = page->next;
+        if (page->first == page) {
+            page->next = chunks;
+            chunks = page;
+        }
+    }
+    return chunks;
+}
+
+// Frees the chunks whose pages are all unused, returns their size
+static size_t chunks_free(vm_t *vm) {
+    pool_page_t *chunks = chunks_unused(vm);
+    size_t freed = 0;
+    while (chunks != NULL) {
+        pool_page_t *first = chunks;
+        chunks = chunks->next;
+        freed += first->pages * POOL_PAGE_SIZE;
+        chunk_free(vm, first);
+    }
+    return freed;
+}
+
+// Adds a new page to <pool>, whose objects are <size> bytes
+// (or conses if <conses>)
+static bool pool_grow(vm_t *vm, pool_t *pool, size_t size, bool conses) {
+    pool_page_t *page = page_new(vm);
+    if (page == NULL) {
+        return false;
+    }
+    size_t start = conses ? POOL_CONS_START : POOL_PAGE_START;
+    page->next = NULL;
+    page->size = (uint32_t) size;
+    page->count = (uint32_t) ((POOL_PAGE_SIZE - start) / size);
+    page->free = page->count;
+    page->state = POOL_SWEPT;
+    page->fresh = false;
+    page->conses = conses;
+    page->permanent = pool->permanent;
+    memset(page->allocated, 0, sizeof(page->allocated));
+    memset(page->marked, 0, sizeof(page->marked));
+    if (conses) {
+        pool_cons_page_t *cons_page = (pool_cons_page_t *) page;
+        memset(cons_page->remembered, 0, sizeof(cons_page->remembered));
+        memset(cons_page->resolved, 0, sizeof(cons_page->resolved));
+    }
+
+    if (pool->last != NULL) {
+        pool->last->next = page;
+    } else {
+        pool->pages = page;
+        for (size_t i = 0; i < page->count; i++) {
+            size_t granule = (start + i * size) / POOL_GRANULE;
+            pool->starts[granule / 64] |= (uint64_t) 1 << (granule % 64);
+        }
+    }
+    pool->last = page;
+    pool->current = page;
+    pool->word = 0;
+    index_invalidate(vm);
+    return true;
+}
+
+// Frees the unmarked conses of <page>, they own nothing to free
+// (their flags are cleared when they're allocated again,
+// the VM may set the flags of the live ones meanwhile)
+static size_t page_sweep_conses(pool_page_t *page) {
+    size_t freed = 0;
+    for (size_t i = 0; i < POOL_BITMAP_WORDS; i++) {
+        for (uint64_t dead = page->allocated[i] & ~page->marked[i]; dead != 0;
+             dead &= dead - 1) {
+            freed += sizeof(cons_t);
+            page->free++;
+        }
+        page->allocated[i] &= page->marked[i];
+    }
+    return freed;
+}
+
+// Frees the unmarked values of <page>, returns their size
+// Only the VM or the sweeper thread (the one which claimed it) sweeps it
+static size_t page_sweep(vm_t *vm, pool_page_t *page) {
+    if (page->conses) {
+        return page_sweep_conses(page);
+    }
+    size_t freed = 0;
+    for (size_t i = 0; i < POOL_BITMAP_WORDS; i++) {
+        uint64_t dead = page->allocated[i] & ~page->marked[i];
+        while (dead != 0) {
+            size_t granule = i * 64 + lowest_bit(dead);
+            ptrvalue_t *ptr =
+                (ptrvalue_t *) ((char *) page + granule * POOL_GRANULE);
+            freed += vm_size(vm, PTR_VAL(ptr));
+            ptr_free(vm, ptr);
+            page->free++;
+            dead &= dead - 1;
+        }
+    }
+    return freed;
+}
+
+static inline bool page_swept(pool_page_t *page) {
+#if THREADS
+    return __atomic_load_n(&page->state, __ATOMIC_ACQUIRE) == POOL_SWEPT;
+#else
+    return page->state == POOL_SWEPT;
+#endif  // THREADS
+}
+
+// Takes the unswept <page> to sweep it, returns false if another thread
+// took it first
+static inline bool page_claim(pool_page_t *page) {
+#if THREADS
+    uint8_t state = POOL_UNSWEPT;
+    return __atomic_compare_exchange_n(&page->state, &state, POOL_SWEEPING,
+                                       false, __ATOMIC_ACQUIRE,
+                                       __ATOMIC_RELAXED);
+#else
+    page->state = POOL_SWEEPING;
+    return true;
+#endif  // THREADS
+}
+
+static inline void page_release(pool_page_t *page) {
+#if THREADS
+    __atomic_store_n(&page->state, POOL_SWEPT, __ATOMIC_RELEASE);
+#else
+    page->state = POOL_SWEPT;
+#endif  // THREADS
+}
+
+// Sweeps the unswept <page> unless the sweeper thread took it,
+// then it waits until the page is swept
+static void page_sweep_now(vm_t *vm, pool_page_t *page) {
+    if (page_claim(page)) {
+        vm->allocated -= page_sweep(vm, page);
+        page_release(page);
+        return;
+    }
+#if THREADS
+    while (!page_swept(page)) {
+        sched_yield();
+    }
+#endif  // THREADS
+}
+
+// Allocates a value of <size> bytes from <pool>
+static void *pool_take(vm_t *vm, pool_t *pool, size_t size, bool conses) {
+    // free values are found in the bitmap of the current page,
+    // the garbage of the page is freed first
+    for (;;) {
+        pool_page_t *page = pool->current;
+        if (page == NULL) {
+            if (!pool_grow(vm, pool, size, conses)) {
+                return NULL;
+            }
+            page = pool->current;
+        }
+        if (!page_swept(page)) {
+            page_sweep_now(vm, page);
+        }
+
+        for (; page->free > 0 && pool->word < POOL_BITMAP_WORDS;
+             pool->word++) {
+            uint64_t *allocated = &page->allocated[pool->word];
+            uint64_t unused = pool->starts[pool->word] & ~*allocated;
+            if (unused != 0) {
+                size_t granule = pool->word * 64 + lowest_bit(unused);
+                *allocated |= unused & -unused;
+                page->free--;
+                page->fresh = true;
+                return (char *) page + granule * POOL_GRANULE;
+            }
+        }
+        pool->current = page->next;
+        pool->word = 0;
+    }
+}
+
+ptrvalue_t *pool_alloc(vm_t *vm, size_t size, bool permanent) {
+    size_t class = pool_class(size);
+    pool_t *pools = permanent ? vm->permanent_pools : vm->pools;
+    ptrvalue_t *ptr = (ptrvalue_t *) pool_take(
+        vm, &pools[class], (class + 1) * POOL_GRANULE, false);
+    if (ptr != NULL) {
+        ptr->large = false;
+        ptr->permanent = permanent;
+        if (permanent) {
+            pool_mark(ptr);
+        }
+    }
+    return ptr;
+}
+
+cons_t *pool_alloc_cons(vm_t *vm, bool permanent) {
+    pool_t *pools = permanent ? vm->permanent_pools : vm->pools;
+    cons_t *cons = (cons_t *) pool_take(vm, &pools[POOL_CONSES],
+                                        sizeof(cons_t), true);
+    if (cons != NULL) {
+        pool_clear_bit(pool_cons_page(cons)->resolved, cons);
+        if (permanent) {
+            pool_cons_mark(cons);
+        }
+    }
+    return cons;
+}
+
+ptrvalue_t *pool_alloc_large(vm_t *vm, size_t size, bool permanent) {
+    pool_large_t *large = (pool_large_t *) vm->config.realloc_fn(
+        NULL, sizeof(pool_large_t) + size);
+    if (large == NULL) {
+        return NULL;
+    }
+    pool_large_t **list = permanent ? &vm->large_permanent : &vm->large_young;
+    large->next = *list;
+    large->marked = permanent;
+    *list = large;
+    index_invalidate(vm);
+
+    ptrvalue_t *ptr = (ptrvalue_t *) (large + 1);
+    ptr->large = true;
+    ptr->permanent = permanent;
+    return ptr;
+}
+
+void pool_free(vm_t *vm, ptrvalue_t *ptr) {
+    if (ptr->large) {
+        index_invalidate(vm);
+        vm->config.realloc_fn(pool_large(ptr), 0);
+        return;
+    }
+    pool_clear_bit(pool_page(ptr)->allocated, ptr);
+}
+
+void pool_clear_marks(vm_t *vm) {
+    for (size_t i = 0; i < POOL_NUM_POOLS; i++) {
+        for (pool_page_t *page = vm->pools[i].pages; page != NULL;
+             page = page->next) {
+            memset(page->marked, 0, sizeof(page->marked));
+        }
+    }
+    for (pool_large_t *large = vm->large; large != NULL; large = large->next) {
+        large->marked = false;
+    }
+    for (pool_large_t *large = vm->large_young; large != NULL;
+         large = large->next) {
+        large->marked = false;
+    }
+}
+
+void pool_unmark_start(vm_t *vm, bool release) {
+    for (size_t i = 0; i < POOL_NUM_POOLS; i++) {
+        pool_t *pool = &vm->pools[i];
+        pool->unmark = pool->pages;
+        pool->unmark_kept = NULL;
+        if (release) {
+            // everything is swept
+            pool->sweep = NULL;
+            pool->shared_sweep = NULL;
+        }
+    }
+    // the young big values aren't marked
+    vm->unmark_large = vm->large;
+    vm->unmark_release = release;
+}
+
+// Takes the empty <page> out of <pool> (it's the one after unmark_kept)
+// and returns it to the unused ones, returns the size given back
+static size_t page_give_back(vm_t *vm, pool_t *pool, pool_page_t *page) {
+    if (pool->unmark_kept != NULL) {
+        pool->unmark_kept->next = page->next;
+    } else {
+        pool->pages = page->next;
+    }
+    if (pool->last == page) {
+        pool->last = pool->unmark_kept;
+    }
+    if (pool->current == page) {
+        pool->current = page->next;
+        pool->word = 0;
+    }
+    index_invalidate(vm);
+    page_free(vm, page);
+#if MMAP
+    // the OS gives zeroed memory back when it's used again
+    madvise((char *) page + PAGE_DISCARD_START,
+            POOL_PAGE_SIZE - PAGE_DISCARD_START, MADV_DONTNEED);
+    return POOL_PAGE_SIZE;
+#else
+    return 0;
+#endif  // MMAP
+}
+
+bool pool_unmark_next(vm_t *vm, size_t *released) {
+    for (size_t i = 0; i < POOL_NUM_POOLS; i++) {
+        pool_t *pool = &vm->pools[i];
+        pool_page_t *page = pool->unmark;
+        if (page != NULL) {
+            pool->unmark = page->next;
+            if (vm->unmark_release && page->free == page->count) {
+                *released += page_give_back(vm, pool, page);
+            } else {
+                memset(page->marked, 0, sizeof(page->marked));
+                pool->unmark_kept = page;
+            }
+            return true;
+        }
+    }
+    if (vm->unmark_large != NULL) {
+        vm->unmark_large->marked = false;
+        vm->unmark_large = vm->unmark_large->next;
+        return true;
+    }
+    // the chunks left unused are freed one at a time too
+    if (vm->unmark_chunks != NULL) {
+        pool_page_t *first = vm->unmark_chunks;
+        vm->unmark_chunks = first->next;
+#if !MMAP
+        // with MMAP the empty pages were given back already
+        *released += first->pages * POOL_PAGE_SIZE;
+#endif  // !MMAP
+        chunk_free(vm, first);
+        return true;
+    }
+    if (vm->unmark_release) {
+        vm->unmark_release = false;
+        vm->unmark_chunks = chunks_unused(vm);
+        return true;
+    }
+    return false;
+}
+
+void pool_each_marked(vm_t *vm, void (*fn)(vm_t *, value_t)) {
+    for (size_t i = 0; i < POOL_NUM_POOLS; i++) {
+        for (pool_page_t *page = vm->pools[i].pages; page != NULL;
+             page = page->next) {
+            for (size_t j = 0; j < POOL_BITMAP_WORDS; j++) {
+                // values marked by <fn> don't have to be visited
+                for (uint64_t bits = page->marked[j]; bits != 0;
+                     bits &= bits - 1) {
+                    size_t granule = j * 64 + lowest_bit(bits);
+                    char *ptr = (char *) page + granule * POOL_GRANULE;
+                    fn(vm, page->conses ? CONS_VAL((cons_t *) ptr)
+                                        : PTR_VAL(ptr));
+                }
+            }
+        }
+    }
+    for (pool_large_t *large = vm->large; large != NULL; large = large->next) {
+        if (large->marked) {
+            fn(vm, PTR_VAL(large + 1));
+        }
+    }
+    for (pool_large_t *large = vm->large_young; large != NULL;
+         large = large->next) {
+        if (large->marked) {
+            fn(vm, PTR_VAL(large + 1));
+        }
+    }
+}
+
+// Frees the unmarked big values in the list starting at <*list>
+static void large_sweep(vm_t *vm, pool_large_t **list) {
+    while (*list != NULL) {
+        pool_large_t *large = *list;
+        if (large->marked) {
+            list = &large->next;
+            continue;
+        }
+        *list = large->next;
+        index_invalidate(vm);
+        ptrvalue_t *ptr = (ptrvalue_t *) (large + 1);
+        vm->allocated -= vm_size(vm, PTR_VAL(ptr));
+        ptr_free(vm, ptr);
+    }
+}
+
+void pool_sweep_lazily(vm_t *vm, bool minor) {
+    if (!minor) {
+        large_sweep(vm, &vm->large);
+    }
+    large_sweep(vm, &vm->large_young);
+    // the rest of the young ones are old now
+    while (vm->large_young != NULL) {
+        pool_large_t *large = vm->large_young;
+        vm->large_young = large->next;
+        large->next = vm->large;
+        vm->large = large;
+    }
+
+    for (size_t i = 0; i < POOL_NUM_POOLS; i++) {
+        pool_t *pool = &vm->pools[i];
+        for (pool_page_t *page = pool->pages; page != NULL;
+             page = page->next) {
+            // a minor collection frees only young values
+            if (!minor || page->fresh) {
+                page->state = POOL_UNSWEPT;
+            }
+            page->fresh = false;
+        }
+        pool->current = pool->pages;
+        pool->word = 0;
+        pool->sweep = pool->pages;
+        pool->shared_sweep = pool->pages;
+        pool->shared_last = pool->last;
+    }
+}
+
+bool pool_sweep_next(vm_t *vm) {
+    for (size_t i = 0; i < POOL_NUM_POOLS; i++) {
+        pool_t *pool = &vm->pools[i];
+        if (pool->sweep != NULL) {
+            pool_page_t *page = pool->sweep;
+            pool->sweep = page->next;
+            // the allocator may have swept it already
+            if (!page_swept(page)) {
+                page_sweep_now(vm, page);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+#if THREADS
+
+bool pool_sweep_shared(vm_t *vm, size_t *freed) {
+    for (size_t i = 0; i < POOL_NUM_POOLS; i++) {
+        pool_t *pool = &vm->pools[i];
+        while (pool->shared_sweep != NULL) {
+            pool_page_t *page = pool->shared_sweep;
+            // the VM may be linking a new page after the last one
+            pool->shared_sweep =
+                page == pool->shared_last ? NULL : page->next;
+            if (!page_swept(page) && page_claim(page)) {
+                *freed += page_sweep(vm, page);
+                page_release(page);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+#endif  // THREADS
+
+// Frees all values of <pool> and returns its pages to the unused ones
+static void pool_free_pages(vm_t *vm, pool_t *pool) {
+    while (pool->pages != NULL) {
+        pool_page_t *page = pool->pages;
+        pool->pages = page->next;
+        memset(page->marked, 0, sizeof(page->marked));
+        vm->allocated -= page_sweep(vm, page);
+        page_free(vm, page);
+    }
+    memset(pool, 0, sizeof(pool_t));
+}
+
+#if CONSERVATIVE
+
+// Compares the addresses <a> and <b> (for qsort)
+static int address_compare(const void *a, const void *b) {
+    uintptr_t x = *(const uintptr_t *) a;
+    uintptr_t y = *(const uintptr_t *) b;
+    return (x > y) - (x < y);
+}
+
+// Adds <addr> to <*items> of <*count> and <*capacity> addresses,
+// returns false if it can't grow
+static bool index_add(vm_t *vm, uintptr_t **items, size_t *count,
+                      size_t *capacity, uintptr_t addr) {
+    if (*count == *capacity) {
+        size_t new_capacity = *capacity == 0 ? 64 : *capacity * 2;
+        uintptr_t *new_items = (uintptr_t *) vm->config.realloc_fn(
+            *items, sizeof(uintptr_t) * new_capacity);
+        if (new_items == NULL) {
+            return false;
+        }
+        *items = new_items;
+        *capacity = new_capacity;
+    }
+    (*items)[(*count)++] = addr;
+    return true;
+}
+
+bool pool_index(vm_t *vm) {
+    pool_index_t *index = &vm->index;
+    if (index->valid) {
+        return true;
+    }
+    index->num_pages = 0;
+    index->num_large = 0;
+    for (size_t i = 0; i < POOL_NUM_POOLS; i++) {
+        for (pool_page_t *page = vm->pools[i].pages; page != NULL;
+             page = page->next) {
+            if (!index_add(vm, &index->pages, &index->num_pages,
+                           &index->pages_capacity, (uintptr_t) page)) {
+                return false;
+            }
+        }
+    }
+    pool_large_t *lists[] = {vm->large, vm->large_young};
+    for (size_t i = 0; i < 2; i++) {
+        for (pool_large_t *large = lists[i]; large != NULL;
+             large = large->next) {
+            if (!index_add(vm, &index->large, &index->num_large,
+                           &index->large_capacity, (uintptr_t) large)) {
+                return false;
+            }
+        }
+    }
+    qsort(index->pages, index->num_pages, sizeof(uintptr_t), address_compare);
+    qsort(index->large, index->num_large, sizeof(uintptr_t), address_compare);
+
+    index->low = UINTPTR_MAX;
+    index->high = 0;
+    if (index->num_pages > 0) {
+        index->low = index->pages[0];
+        index->high = index->pages[index->num_pages - 1] + POOL_PAGE_SIZE;
+    }
+    if (index->num_large > 0) {
+        pool_large_t *last =
+            (pool_large_t *) index->large[index->num_large - 1];
+        uintptr_t high =
+            (uintptr_t) (last + 1) + ptr_size((ptrvalue_t *) (last + 1));
+        if (index->large[0] < index->low) {
+            index->low = index->large[0];
+        }
+        if (high > index->high) {
+            index->high = high;
+        }
+    }
+    index->valid = true;
+    return true;
+}
+
+// Returns the index of the last of <count> sorted <items> at or below
+// <addr>, or <count> if there is none
+static size_t index_search(uintptr_t *items, size_t count, uintptr_t addr) {
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (items[middle] <= addr) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low == 0 ? count : low - 1;
+}
+
+bool pool_find(vm_t *vm, uintptr_t addr, value_t *val) {
+    pool_index_t *index = &vm->index;
+    if (addr < index->low || addr >= index->high) {
+        return false;
+    }
+
+    uintptr_t page_addr = addr & ~(uintptr_t) (POOL_PAGE_SIZE - 1);
+    size_t i = index_search(index->pages, index->num_pages, page_addr);
+    if (i < index->num_pages && index->pages[i] == page_addr) {
+        pool_page_t *page = (pool_page_t *) page_addr;
+        size_t start = page->conses ? POOL_CONS_START : POOL_PAGE_START;
+        size_t offset = addr - page_addr;
+        if (offset < start || (offset - start) / page->size >= page->count) {
+            return false;
+        }
+        char *ptr = (char *) page + start +
+                    (offset - start) / page->size * page->size;
+        if (!pool_bit(page->allocated, ptr)) {
+            return false;
+        }
+        // the unmarked values of an unswept page are garbage,
+        // they may point to values which were freed already
+        if (!page_swept(page) && !pool_bit(page->marked, ptr)) {
+            return false;
+        }
+        *val = page->conses ? CONS_VAL((cons_t *) ptr) : PTR_VAL(ptr);
+        return true;
+    }
+
+    // the big values are freed right after a collection
+    i = index_search(index->large, index->num_large, addr);
+    if (i < index->num_large) {
+        ptrvalue_t *ptr = (ptrvalue_t *) ((pool_large_t *) index->large[i] + 1);
+        if (addr < (uintptr_t) ptr + ptr_size(ptr)) {
+            *val = PTR_VAL(ptr);
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif  // CONSERVATIVE
+
+void pool_free_all(vm_t *vm) {
+    // everything is garbage now (the buffers of the values are freed too)
+    pool_clear_marks(vm);
+    for (pool_large_t *large = vm->large_permanent; large != NULL;
+         large = large->next) {
+        large->marked = false;
+    }
+    large_sweep(vm, &vm->large);
+    large_sweep(vm, &vm->large_young);
+    large_sweep(vm, &vm->large_permanent);
+
+    // all pages are unused then
+    for (size_t i = 0; i < POOL_NUM_POOLS; i++) {
+        pool_free_pages(vm, &vm->pools[i]);
+        pool_free_pages(vm, &vm->permanent_pools[i]);
+    }
+    while (vm->unmark_chunks != NULL) {
+        pool_page_t *first = vm->unmark_chunks;
+        vm->unmark_chunks = first->next;
+        chunk_free(vm, first);
+    }
+    chunks_free(vm);
+#if CONSERVATIVE
+    vm->config.realloc_fn(vm->index.pages, 0);
+    vm->config.realloc_fn(vm->index.large, 0);
+#endif  // CONSERVATIVE
+}
@@ -0,0 +1,337 @@
+#ifndef _pool_h
+#define _pool_h
+
+#include <stdbool.h>
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint64_t, uintptr_t
+
+#include "config.h"
+#include "scheme.h"
+#include "value.h"  // ptrvalue_t, cons_t
+
+// The heap of values
+//
+// Values up to POOL_MAX_SIZE bytes are allocated from pages,
+// one pool per size class (every POOL_GRANULE bytes).
+// Pages are aligned to POOL_PAGE_SIZE, so the page of a value
+// is found by masking its address. The header of a page has two bitmaps
+// with a bit for every granule - which granules start an allocated value
+// and which start a marked one. The values themselves have no mark bit
+// and aren't linked together.
+//
+// A collection only marks values. The pages which may have garbage
+// are left unswept and a pool sweeps its next page when it needs space
+// (see pool_alloc), so the garbage is freed lazily, a page at a time.
+// A thread of its own may sweep them meanwhile (see pool_sweep_shared),
+// a page is claimed by setting its state, so it's swept just once.
+// The marks aren't cleared after a collection, a marked value is old
+// (it survived a collection) and an unmarked one is young or garbage.
+// A major collection clears them all first (see pool_unmark_next).
+//
+// Conses have a pool of their own (POOL_CONSES) and no header at all,
+// the page tells that its values are conses. Their flags are kept
+// in two more bitmaps of the page (see pool_cons_page_t).
+//
+// Bigger values are allocated one by one with config.realloc_fn,
+// preceded by a pool_large_t. They are freed right after a collection.
+//
+// Permanent values (code read from files, see vm->permanent) have pools
+// of their own. They are marked when they're allocated and never swept,
+// a collection doesn't clear their marks and doesn't trace them.
+//
+// Pages come from chunks mapped with mmap (see MMAP in config.h)
+// or allocated with config.realloc_fn, the chunks get bigger as the heap
+// grows. The empty pages can be given back while a major collection
+// unmarks the values (see pool_unmark_start), a chunk is freed when none
+// of its pages are used.
+
+#define POOL_GRANULE 16
+#define POOL_MAX_SIZE 256
+#define POOL_NUM_CLASSES (POOL_MAX_SIZE / POOL_GRANULE)
+// the pool of conses follows the size classes
+#define POOL_CONSES POOL_NUM_CLASSES
+#define POOL_NUM_POOLS (POOL_NUM_CLASSES + 1)
+// the size (and alignment) of a page including its header
+#define POOL_PAGE_SIZE (64 * 1024)
+#define POOL_PAGE_GRANULES (POOL_PAGE_SIZE / POOL_GRANULE)
+#define POOL_BITMAP_WORDS (POOL_PAGE_GRANULES / 64)
+// the number of pages allocated at once, at least and at most
+#define POOL_CHUNK_PAGES 16
+#define POOL_CHUNK_PAGES_MAX 512
+// the number of pages in a (transparent) huge page of the OS
+#define POOL_HUGE_PAGES 32
+
+// A page of values of one size class, they follow the header
+typedef struct _pool_page_t {
+    struct _pool_page_t *next;
+    // the first page of its chunk, that one has the allocation of the chunk,
+    // the number of its pages and how many of them are unused
+    // (else they're NULL and 0)
+    struct _pool_page_t *first;
+    void *chunk;
+    uint32_t pages, unused;
+    // the size of the values, how many of them fit in
+    // and how many of them are free (not counting the unswept garbage)
+    uint32_t size, count, free;
+    // whether it was swept since the last collection (POOL_SWEPT...)
+    uint8_t state;
+    // values were allocated from it since the last collection
+    // (only these pages can have garbage after a minor collection)
+    bool fresh;
+    // its values are conses (it's a pool_cons_page_t)
+    bool conses;
+    // its values are permanent
+    bool permanent;
+
+    uint64_t allocated[POOL_BITMAP_WORDS];
+    uint64_t marked[POOL_BITMAP_WORDS];
+} pool_page_t;
+
+// The states of a page, a page is POOL_SWEEPING while a thread sweeps it
+enum { POOL_UNSWEPT, POOL_SWEEPING, POOL_SWEPT };
+
+// A page of conses, the bitmaps have the flags of the conses
+// which other values keep in their header
+typedef struct {
+    pool_page_t page;
+
+    // the cons is in the remembered set of the vm
+    uint64_t remembered[POOL_BITMAP_WORDS];
+    // the arguments of lambda/define/let starting here
+    // were already resolved (see resolve.h)
+    uint64_t resolved[POOL_BITMAP_WORDS];
+} pool_cons_page_t;
+
+// the offset of the first value of a page
+#define POOL_PAGE_START \
+    ((sizeof(pool_page_t) + POOL_GRANULE - 1) / POOL_GRANULE * POOL_GRANULE)
+#define POOL_CONS_START                                           \
+    ((sizeof(pool_cons_page_t) + POOL_GRANULE - 1) / POOL_GRANULE * \
+     POOL_GRANULE)
+
+typedef struct {
+    pool_page_t *pages, *last;
+
+    // the page values are allocated from (NULL if there is none left)
+    // and the word of its bitmap to look for a free value in
+    pool_page_t *current;
+    size_t word;
+    // a bitmap of the granules where values of this pool start
+    uint64_t starts[POOL_BITMAP_WORDS];
+    // the next page which may need sweeping (see pool_sweep_next)
+    pool_page_t *sweep;
+    // the next page to unmark and the last one kept (see pool_unmark_next)
+    pool_page_t *unmark, *unmark_kept;
+    // the same for the sweeper thread and the last page it sweeps
+    // (see pool_sweep_shared)
+    pool_page_t *shared_sweep, *shared_last;
+    // its values are permanent
+    bool permanent;
+} pool_t;
+
+// The header of a big value
+typedef struct _pool_large_t {
+    struct _pool_large_t *next;
+    bool marked;
+} pool_large_t;
+
+#if CONSERVATIVE
+// The pages and big values sorted by their address,
+// to find the value an address points into (see pool_find)
+typedef struct {
+    uintptr_t *pages;
+    size_t num_pages, pages_capacity;
+    uintptr_t *large;
+    size_t num_large, large_capacity;
+    // the lowest and the highest address in them
+    uintptr_t low, high;
+    // no page or big value was added or freed since it was made
+    bool valid;
+} pool_index_t;
+#endif  // CONSERVATIVE
+
+// Returns true if objects of <size> bytes are allocated from the pools
+static inline bool pool_fits(size_t size) {
+    return size > 0 && size <= POOL_MAX_SIZE;
+}
+
+static inline pool_page_t *pool_page(const void *ptr) {
+    return (pool_page_t *) ((uintptr_t) ptr &
+                            ~(uintptr_t) (POOL_PAGE_SIZE - 1));
+}
+
+static inline pool_cons_page_t *pool_cons_page(cons_t *cons) {
+    return (pool_cons_page_t *) pool_page(cons);
+}
+
+static inline pool_large_t *pool_large(ptrvalue_t *ptr) {
+    return (pool_large_t *) ptr - 1;
+}
+
+// Returns the index of the granule of <ptr> in its page
+static inline size_t pool_granule(const void *ptr) {
+    return ((uintptr_t) ptr & (POOL_PAGE_SIZE - 1)) / POOL_GRANULE;
+}
+
+// Gets, sets and clears the bit of the value <ptr> in <bitmap> of its page
+static inline bool pool_bit(const uint64_t *bitmap, const void *ptr) {
+    size_t granule = pool_granule(ptr);
+    return (bitmap[granule / 64] >> (granule % 64)) & 1;
+}
+
+static inline void pool_set_bit(uint64_t *bitmap, const void *ptr) {
+    size_t granule = pool_granule(ptr);
+    bitmap[granule / 64] |= (uint64_t) 1 << (granule % 64);
+}
+
+static inline void pool_clear_bit(uint64_t *bitmap, const void *ptr) {
+    size_t granule = pool_granule(ptr);
+    bitmap[granule / 64] &= ~((uint64_t) 1 << (granule % 64));
+}
+
+static inline bool pool_marked(ptrvalue_t *ptr) {
+    if (ptr->large) {
+        return pool_large(ptr)->marked;
+    }
+    return pool_bit(pool_page(ptr)->marked, ptr);
+}
+
+static inline void pool_mark(ptrvalue_t *ptr) {
+    if (ptr->large) {
+        pool_large(ptr)->marked = true;
+        return;
+    }
+    pool_set_bit(pool_page(ptr)->marked, ptr);
+}
+
+static inline bool pool_cons_marked(cons_t *cons) {
+    return pool_bit(pool_page(cons)->marked, cons);
+}
+
+static inline void pool_cons_mark(cons_t *cons) {
+    pool_set_bit(pool_page(cons)->marked, cons);
+}
+
+// The resolved flag of a cons (see resolve.h)
+static inline bool pool_cons_resolved(cons_t *cons) {
+    return pool_bit(pool_cons_page(cons)->resolved, cons);
+}
+
+static inline void pool_cons_resolve(cons_t *cons) {
+    pool_set_bit(pool_cons_page(cons)->resolved, cons);
+}
+
+// Returns true if the value <val> (a ptrvalue or a cons) is marked
+static inline bool pool_val_marked(value_t val) {
+    if (IS_CONS(val)) {
+        return pool_cons_marked(AS_CONS(val));
+    }
+    return pool_marked(AS_PTR(val));
+}
+
+static inline bool pool_cons_permanent(cons_t *cons) {
+    return pool_page(cons)->permanent;
+}
+
+// Returns true if <val> isn't allocated or it's permanent
+static inline bool pool_val_permanent(value_t val) {
+    if (IS_VAL(val)) {
+        return true;
+    }
+    if (IS_CONS(val)) {
+        return pool_cons_permanent(AS_CONS(val));
+    }
+    return AS_PTR(val)->permanent;
+}
+
+#if THREADS
+
+// The same as pool_val_marked while other threads are marking values
+static inline bool pool_val_marked_shared(value_t val) {
+    if (IS_HEADED(val) && AS_PTR(val)->large) {
+        return __atomic_load_n(&pool_large(AS_PTR(val))->marked,
+                               __ATOMIC_RELAXED);
+    }
+    void *ptr = IS_CONS(val) ? (void *) AS_CONS(val) : (void *) AS_PTR(val);
+    size_t granule = pool_granule(ptr);
+    uint64_t word =
+        __atomic_load_n(&pool_page(ptr)->marked[granule / 64], __ATOMIC_RELAXED);
+    return (word >> (granule % 64)) & 1;
+}
+
+// Marks <val> while other threads are marking values
+// Returns false if another thread marked it first
+static inline bool pool_val_mark_shared(value_t val) {
+    if (IS_HEADED(val) && AS_PTR(val)->large) {
+        return !__atomic_exchange_n(&pool_large(AS_PTR(val))->marked, true,
+                                    __ATOMIC_RELAXED);
+    }
+    void *ptr = IS_CONS(val) ? (void *) AS_CONS(val) : (void *) AS_PTR(val);
+    size_t granule = pool_granule(ptr);
+    uint64_t bit = (uint64_t) 1 << (granule % 64);
+    uint64_t word = __atomic_fetch_or(&pool_page(ptr)->marked[granule / 64],
+                                      bit, __ATOMIC_RELAXED);
+    return !(word & bit);
+}
+
+#endif  // THREADS
+
+// Allocates a value of <size> bytes (see pool_fits),
+// a marked one from the permanent pools if <permanent>
+// Returns NULL if a new page can't be allocated
+ptrvalue_t *pool_alloc(vm_t *vm, size_t size, bool permanent);
+// Allocates a big value of <size> bytes
+ptrvalue_t *pool_alloc_large(vm_t *vm, size_t size, bool permanent);
+// Allocates a cons, returns NULL if a new page can't be allocated
+cons_t *pool_alloc_cons(vm_t *vm, bool permanent);
+
+// Frees the value <ptr> (with its pool_large_t if it's big)
+void pool_free(vm_t *vm, ptrvalue_t *ptr);
+
+// Unmarks all values
+void pool_clear_marks(vm_t *vm);
+
+// Starts unmarking all values a page at a time, the ones allocated
+// meanwhile aren't marked either (see pool_unmark_next)
+// If <release>, the empty pages are returned to the unused ones meanwhile
+// and given back to the OS (with MMAP, else only the chunks which have
+// no used pages left). All pages have to be swept then.
+void pool_unmark_start(vm_t *vm, bool release);
+// Unmarks the next page (or releases it) or old big value,
+// the size which was given back is added to <*released>
+// Returns false if there is none left
+bool pool_unmark_next(vm_t *vm, size_t *released);
+
+// Calls <fn> with every marked value
+void pool_each_marked(vm_t *vm, void (*fn)(vm_t *, value_t));
+
+// Ends a collection - frees the unmarked big values (only the young ones
+// if <minor>) and leaves the pages to be swept
+void pool_sweep_lazily(vm_t *vm, bool minor);
+
+// Sweeps the next page unless it was swept since the last collection
+// Returns false if there is none left
+bool pool_sweep_next(vm_t *vm);
+
+#if THREADS
+// The same as pool_sweep_next on another thread while the VM runs,
+// the size of the freed values is added to <*freed>
+// (it doesn't touch the pages the VM adds meanwhile)
+bool pool_sweep_shared(vm_t *vm, size_t *freed);
+#endif  // THREADS
+
+#if CONSERVATIVE
+// Indexes the pages and the big values for pool_find (but not the permanent
+// ones, a collection doesn't need them) unless they didn't change
+// Returns false if it can't
+bool pool_index(vm_t *vm);
+
+// Finds the value <addr> points into (even into its middle), returns false
+// if there is none or it's garbage left unswept (see pool_index)
+bool pool_find(vm_t *vm, uintptr_t addr, value_t *val);
+#endif  // CONSERVATIVE
+
+// Frees all values and pages of <vm> (the permanent ones too)
+void pool_free_all(vm_t *vm);
+
+#endif  // _pool_h
@@ -178,10 +178,16 @@ static void read_quote(reader_t *reader) {
     symbol_t *s = symbol_intern(reader->vm, "quote", 5);
 
     read1(reader);
-    value_t val = reader->tokval;
 
-    reader->tokval =
-        cons_fn(reader->vm, PTR_VAL(s), cons_fn(reader->vm, val, NIL_VAL));
+    // the value being read is in reader->tokval, which is a GC root
+    // (a new permanent cons may point to an older value)
+    vm_t *vm = reader->vm;
+    cons_t *quoted = AS_CONS(cons_fn(vm, reader->tokval, NIL_VAL));
+    vm_cons_barrier(vm, quoted, quoted->car);
+    reader->tokval = CONS_VAL(quoted);
+    cons_t *quote = AS_CONS(cons_fn(vm, PTR_VAL(s), reader->tokval));
+    vm_cons_barrier(vm, quote, quote->car);
+    reader->tokval = CONS_VAL(quote);
 }
 
 // TODO: add escape characters
@@ -214,19 +220,28 @@ static void read_vector(reader_t *reader) {
     next_char(reader);  // consumes '#'
     next_char(reader);  // consumes '('
 
-    vector_t *vec = vector_new(reader->vm, 0);
+    // the vector is kept on the stack while its elements are read
+    vm_t *vm = reader->vm;
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 1)) {
+        return;
+    }
+    vector_t *vec = vector_new(vm, 0);
+    *vm->stack_top++ = PTR_VAL(vec);
+
     while (reader->toktype != TOK_EOF) {
         next_token(reader);
         if (reader->toktype == TOK_RPAREN) {
             reader->tokval = PTR_VAL(vec);
             next_char(reader);
-            return;
+            break;
         } else {
             read1(reader);
             value_t elem = reader->tokval;
-            vector_push(reader->vm, vec, elem);
+            vector_push(vm, vec, elem);
         }
     }
+    vm_stack_restore(vm, top);
 }
 
 
@@ -295,18 +310,27 @@ static void read_list(reader_t *reader) {
     eat_whitespace(reader);
     value_t val = reader->tokval;
 
+    // the list is kept on the stack while the rest of it is read
+    vm_t *vm = reader->vm;
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 1)) {
+        return;
+    }
     cons_t *head, *tail;
-    head = tail = AS_CONS(cons_fn(reader->vm, val, NIL_VAL));
+    head = tail = AS_CONS(cons_fn(vm, val, NIL_VAL));
+    // a new permanent cons may point to an older value
+    vm_cons_barrier(vm, head, val);
+    *vm->stack_top++ = CONS_VAL(head);
 
     while (reader->toktype != TOK_EOF) {
         next_token(reader);
         if (reader->toktype == TOK_RPAREN) {
-            reader->tokval = PTR_VAL(head);
+            reader->tokval = CONS_VAL(head);
             next_char(reader);
-            return;
+            break;
         } else if (reader->toktype == TOK_EOF) {
             error_print(reader, "Unexpected EOF while parsing");
-            return;
+            break;
         } else if (reader->toktype == TOK_DOT) {
             next_char(reader);
             next_token(reader);
@@ -314,18 +338,22 @@ static void read_list(reader_t *reader) {
             read1(reader);
 
             tail->cdr = reader->tokval;
-            reader->tokval = PTR_VAL(head);
+            vm_cons_barrier(vm, tail, tail->cdr);
+            reader->tokval = CONS_VAL(head);
 
             next_char(reader);
-            return;
+            break;
         }
 
         read1(reader);
         val = reader->tokval;
 
-        tail->cdr = cons_fn(reader->vm, val, NIL_VAL);
+        tail->cdr = cons_fn(vm, val, NIL_VAL);
+        vm_cons_barrier(vm, tail, tail->cdr);
         tail = AS_CONS(tail->cdr);
+        vm_cons_barrier(vm, tail, val);
     }
+    vm_stack_restore(vm, top);
 }
 
 value_t read_source(vm_t *vm, const char *source) {
@@ -360,5 +388,14 @@ value_t read_source(vm_t *vm, const char *source) {
     }
 
     vm->curval = reader.tokval;
+    vm->reader = NULL;
     return reader.tokval;
 }
+
+value_t read_source_permanent(vm_t *vm, const char *source) {
+    bool permanent = vm->permanent;
+    vm->permanent = true;
+    value_t val = read_source(vm, source);
+    vm->permanent = permanent;
+    return val;
+}
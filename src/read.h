@@ -37,5 +37,8 @@ typedef struct {
 // Reads the given source and returns a value.
 // Creates a local reader_t on the inside.
 value_t read_source(vm_t *vm, const char *source);
+// The same, but the values are permanent (see vm->permanent),
+// for code which lives as long as the VM (like a loaded file)
+value_t read_source_permanent(vm_t *vm, const char *source);
 
 #endif  // _read_h
@@ -0,0 +1,479 @@
+#include <string.h>  // strcmp
+
+#include "resolve.h"
+#include "scheme.h"
+#include "value.h"
+#include "vm.h"
+
+// Variables of one env frame (created by a lambda or a let)
+typedef struct _scope_t {
+    // either parameters of a lambda (a list, possibly dotted, or a symbol)
+    // or bindings of a let ((var val) ...)
+    value_t vars;
+    bool bindings;
+
+    // variables defined somewhere in the body
+    // (their position in the frame isn't known in advance)
+    symbol_t **defined;
+    uint32_t num_defined, defined_capacity;
+
+    struct _scope_t *up;
+} scope_t;
+
+typedef struct {
+    vm_t *vm;
+
+    // environment for looking up macros and special forms
+    env_t *env;
+
+    scope_t *scope;
+} resolver_t;
+
+// What a symbol refers to
+typedef enum {
+    // not bound by any scope - a global (or bound outside of the expression)
+    VAR_GLOBAL,
+    // bound by a scope, but has no fixed position in its frame
+    VAR_DYNAMIC,
+    // bound by a scope and always at the same position
+    VAR_LOCAL
+} var_kind_t;
+
+static void resolve_expr(resolver_t *r, value_t owner, value_t *place);
+static void scope_collect(resolver_t *r, scope_t *scope, value_t val);
+
+// Returns the length of the list <val> or a negative number if it's not one
+static int32_t list_len(value_t val) {
+    if (!IS_CONS(val) && !IS_NIL(val)) {
+        return -1;
+    }
+    return cons_len(val);
+}
+
+// The write barrier for a store into <owner> (NIL if there is none)
+static void owner_barrier(vm_t *vm, value_t owner, value_t val) {
+    if (IS_CONS(owner)) {
+        vm_cons_barrier(vm, AS_CONS(owner), val);
+    } else if (!IS_NIL(owner)) {
+        vm_write_barrier(vm, AS_PTR(owner), val);
+    }
+}
+
+// Replaces the list at <place> inside of <owner> by a copy of its spine,
+// which is resolved instead of it. The code may be data that the program
+// can still reach, resolving it must not change what the program sees.
+// Returns false if it can't be copied (a circular list or no stack left).
+static bool resolve_copy(resolver_t *r, value_t owner, value_t *place) {
+    vm_t *vm = r->vm;
+    value_t *top = vm->stack_top;
+    if (!IS_CONS(*place)) {
+        return true;
+    }
+    if (cons_len(*place) == -1 || !vm_stack_check(vm, 1)) {
+        return false;
+    }
+
+    // the copy is kept on the stack while it's made
+    value_t *copy = vm->stack_top++;
+    *copy = NIL_VAL;
+    cons_t *tail = NULL;
+    value_t iter = *place;
+    for (; IS_CONS(iter); iter = AS_CONS(iter)->cdr) {
+        cons_t *cons = cons_new(vm);
+        cons->car = AS_CONS(iter)->car;
+        vm_cons_barrier(vm, cons, cons->car);
+        if (tail == NULL) {
+            *copy = CONS_VAL(cons);
+        } else {
+            tail->cdr = CONS_VAL(cons);
+            vm_cons_barrier(vm, tail, tail->cdr);
+        }
+        tail = cons;
+    }
+    tail->cdr = iter;
+    vm_cons_barrier(vm, tail, iter);
+
+    *place = *copy;
+    owner_barrier(vm, owner, *place);
+    vm_stack_restore(vm, top);
+    return true;
+}
+
+bool params_valid(value_t params) {
+    value_t iter = params;
+    for (; IS_CONS(iter); iter = AS_CONS(iter)->cdr) {
+        if (!IS_SYMBOL(AS_CONS(iter)->car)) {
+            return false;
+        }
+    }
+    return IS_NIL(iter) || IS_SYMBOL(iter);
+}
+
+/* *** scopes *** */
+
+static void scope_define(resolver_t *r, scope_t *scope, symbol_t *sym) {
+    for (uint32_t i = 0; i < scope->num_defined; i++) {
+        if (scope->defined[i] == sym) {
+            return;
+        }
+    }
+
+    if (scope->num_defined + 1 > scope->defined_capacity) {
+        uint32_t capacity =
+            scope->defined_capacity ? scope->defined_capacity << 1 : 8;
+        scope->defined = (symbol_t **) vm_realloc(
+            r->vm, scope->defined,
+            scope->defined_capacity * sizeof(symbol_t *),
+            capacity * sizeof(symbol_t *));
+        scope->defined_capacity = capacity;
+    }
+    scope->defined[scope->num_defined++] = sym;
+}
+
+// Finds all variables which can be defined by the expression <val>
+// Defines in nested lambdas are found too (which does no harm,
+// such variables are just looked up by name)
+static void scope_collect(resolver_t *r, scope_t *scope, value_t val) {
+    if (!IS_CONS(val)) {
+        return;
+    }
+
+    value_t head = AS_CONS(val)->car;
+    value_t args = AS_CONS(val)->cdr;
+    if (IS_SYMBOL(head)) {
+        const char *name = AS_SYMBOL(head)->name;
+        if (strcmp(name, "quote") == 0) {
+            return;
+        }
+        if (strcmp(name, "define") == 0 && IS_CONS(args)) {
+            // (define <name> ...) or (define (<name> ...) ...)
+            value_t target = AS_CONS(args)->car;
+            if (IS_CONS(target)) {
+                target = AS_CONS(target)->car;
+            }
+            if (IS_SYMBOL(target)) {
+                scope_define(r, scope, AS_SYMBOL(target));
+            }
+        }
+    }
+
+    for (value_t iter = val; IS_CONS(iter); iter = AS_CONS(iter)->cdr) {
+        scope_collect(r, scope, AS_CONS(iter)->car);
+    }
+}
+
+// Finds what <sym> refers to, if it's a local variable,
+// sets <*depth> and <*slot> to its lexical address
+// and <*vars> to the variables of its scope
+static var_kind_t scope_find(resolver_t *r, symbol_t *sym, uint16_t *depth,
+                             uint16_t *slot, value_t *vars) {
+    value_t var = PTR_VAL(sym);
+    uint32_t d = 0;
+    for (scope_t *scope = r->scope; scope != NULL; scope = scope->up, d++) {
+        // a define may add another variable with this name at runtime
+        for (uint32_t i = 0; i < scope->num_defined; i++) {
+            if (scope->defined[i] == sym) {
+                return VAR_DYNAMIC;
+            }
+        }
+
+        // the last one wins if there are duplicates
+        int64_t found = -1;
+        uint32_t index = 0;
+        value_t iter = scope->vars;
+        for (; IS_CONS(iter); iter = AS_CONS(iter)->cdr, index++) {
+            value_t name = AS_CONS(iter)->car;
+            if (scope->bindings) {
+                name = AS_CONS(name)->car;
+            }
+            if (IS_EQ(name, var)) {
+                found = index;
+            }
+        }
+        if (IS_EQ(iter, var)) {
+            // the rest parameter (lambda (a b . rest) ...)
+            found = index;
+        }
+
+        if (found >= 0) {
+            if (d > UINT16_MAX || found > UINT16_MAX) {
+                return VAR_DYNAMIC;
+            }
+            *depth = (uint16_t) d;
+            *slot = (uint16_t) found;
+            *vars = scope->vars;
+            return VAR_LOCAL;
+        }
+    }
+    return VAR_GLOBAL;
+}
+
+// Resolves the expressions of <body> in a new scope of <vars>
+static void resolve_scope(resolver_t *r, value_t vars, bool bindings,
+                          value_t body) {
+    scope_t scope = {vars, bindings, NULL, 0, 0, r->scope};
+
+    for (value_t iter = body; IS_CONS(iter); iter = AS_CONS(iter)->cdr) {
+        scope_collect(r, &scope, AS_CONS(iter)->car);
+    }
+
+    r->scope = &scope;
+    for (value_t iter = body; IS_CONS(iter); iter = AS_CONS(iter)->cdr) {
+        resolve_expr(r, iter, &AS_CONS(iter)->car);
+    }
+    r->scope = scope.up;
+
+    if (scope.defined != NULL) {
+        vm_realloc(r->vm, scope.defined,
+                   scope.defined_capacity * sizeof(symbol_t *), 0);
+    }
+}
+
+/* *** expressions *** */
+
+// Resolves all expressions in the list <list>
+static void resolve_list(resolver_t *r, value_t list) {
+    for (; IS_CONS(list); list = AS_CONS(list)->cdr) {
+        resolve_expr(r, list, &AS_CONS(list)->car);
+    }
+}
+
+// The arguments of lambda, define and let are marked as resolved,
+// so that they aren't resolved again when the form is evaluated
+
+static void resolve_lambda_args(resolver_t *r, value_t args) {
+    // (lambda (<params...>) <body...>)
+    if (list_len(args) < 1 || !params_valid(AS_CONS(args)->car)) {
+        return;
+    }
+    pool_cons_resolve(AS_CONS(args));
+    resolve_scope(r, AS_CONS(args)->car, false, AS_CONS(args)->cdr);
+}
+
+static void resolve_define_args(resolver_t *r, value_t args) {
+    int32_t len = list_len(args);
+    if (len < 1) {
+        return;
+    }
+    pool_cons_resolve(AS_CONS(args));
+
+    value_t target = AS_CONS(args)->car;
+    if (IS_SYMBOL(target) && len == 2) {  // (define <name> <body>)
+        resolve_expr(r, AS_CONS(args)->cdr, &AS_CONS(AS_CONS(args)->cdr)->car);
+    } else if (IS_CONS(target) && IS_SYMBOL(AS_CONS(target)->car) &&
+               params_valid(AS_CONS(target)->cdr)) {
+        // (define (<name> <params...>) <body...>)
+        resolve_scope(r, AS_CONS(target)->cdr, false, AS_CONS(args)->cdr);
+    }
+}
+
+static void resolve_let_args(resolver_t *r, value_t args) {
+    // (let ((a 10) (b 20) ...) <exprs...>)
+    if (list_len(args) < 2) {
+        return;
+    }
+    value_t bindings = AS_CONS(args)->car;
+    if (list_len(bindings) < 0) {
+        return;
+    }
+    for (value_t iter = bindings; IS_CONS(iter); iter = AS_CONS(iter)->cdr) {
+        value_t binding = AS_CONS(iter)->car;
+        if (!IS_CONS(binding) || cons_len(binding) != 2 ||
+            !IS_SYMBOL(AS_CONS(binding)->car)) {
+            return;
+        }
+    }
+    pool_cons_resolve(AS_CONS(args));
+
+    // the bindings are copied too, their values are resolved in them
+    if (!resolve_copy(r, args, &AS_CONS(args)->car)) {
+        return;
+    }
+    bindings = AS_CONS(args)->car;
+    for (value_t iter = bindings; IS_CONS(iter); iter = AS_CONS(iter)->cdr) {
+        if (!resolve_copy(r, iter, &AS_CONS(iter)->car)) {
+            return;
+        }
+    }
+
+    // the values are evaluated outside of the new frame
+    for (value_t iter = bindings; IS_CONS(iter); iter = AS_CONS(iter)->cdr) {
+        value_t binding = AS_CONS(iter)->car;
+        resolve_expr(r, AS_CONS(binding)->cdr,
+                     &AS_CONS(AS_CONS(binding)->cdr)->car);
+    }
+    resolve_scope(r, bindings, true, AS_CONS(args)->cdr);
+}
+
+// Resolves a form of the special form <sym> at <place>
+// Unknown special forms get their arguments as they are
+static void resolve_special(resolver_t *r, symbol_t *sym, value_t owner,
+                            value_t *place) {
+    const char *name = sym->name;
+    int32_t len = list_len(AS_CONS(*place)->cdr);
+    if (len < 0) {
+        return;
+    }
+
+    void (*fn)(resolver_t *r, value_t args) = NULL;
+    if (strcmp(name, "if") == 0 || strcmp(name, "begin") == 0 ||
+        strcmp(name, "and") == 0 || strcmp(name, "or") == 0) {
+        fn = resolve_list;
+    } else if (strcmp(name, "set!") == 0) {
+        // (set! <sym> <expr>)
+        if (len == 2) {
+            fn = resolve_list;
+        }
+    } else if (strcmp(name, "define") == 0) {
+        fn = resolve_define_args;
+    } else if (strcmp(name, "lambda") == 0) {
+        fn = resolve_lambda_args;
+    } else if (strcmp(name, "let") == 0) {
+        fn = resolve_let_args;
+    }
+
+    if (fn != NULL && resolve_copy(r, owner, place)) {
+        fn(r, AS_CONS(*place)->cdr);
+    }
+}
+
+// Expands the use <form> of the macro <macro> at <place>
+// and resolves the expansion
+// (<place> is in a copy of the code, <form> itself stays as it is)
+static void resolve_macro(resolver_t *r, value_t owner, value_t *place,
+                          value_t form, value_t macro) {
+    vm_t *vm = r->vm;
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 1)) {
+        return;
+    }
+
+    // a failed expansion is left for eval, so that it complains every time
+    bool had_error = vm->has_error;
+    vm->has_error = false;
+    value_t *expanded = vm->stack_top++;
+    *expanded = NIL_VAL;
+    *expanded = apply(vm, r->env, macro, AS_CONS(form)->cdr);
+    bool failed = vm->has_error;
+    vm->has_error = had_error || failed;
+
+    if (!failed) {
+        expansion_t *expansion = expansion_new(vm, form, *expanded);
+        *place = PTR_VAL(expansion);
+        owner_barrier(vm, owner, *place);
+
+        // the expansion may define new variables
+        if (r->scope != NULL) {
+            scope_collect(r, r->scope, expansion->expanded);
+        }
+        resolve_expr(r, PTR_VAL(expansion), &expansion->expanded);
+    }
+    vm_stack_restore(vm, top);
+}
+
+// Resolves the expression at <place> inside of <owner>
+// (NIL if it isn't inside of a value)
+static void resolve_expr(resolver_t *r, value_t owner, value_t *place) {
+    value_t val = *place;
+    uint16_t depth, slot;
+    value_t vars;
+
+    if (IS_SYMBOL(val)) {
+        symbol_t *sym = AS_SYMBOL(val);
+        if (scope_find(r, sym, &depth, &slot, &vars) == VAR_LOCAL) {
+            // permanent code gets a permanent reference,
+            // unless it would point to other values
+            vm_t *vm = r->vm;
+            bool permanent = vm->permanent;
+            vm->permanent = IS_PTR(owner) && pool_val_permanent(owner) &&
+                            pool_val_permanent(val) &&
+                            pool_val_permanent(vars);
+            *place = PTR_VAL(local_new(vm, sym, depth, slot, vars));
+            vm->permanent = permanent;
+            owner_barrier(vm, owner, *place);
+        }
+        return;
+    }
+    if (!IS_CONS(val)) {
+        return;
+    }
+
+    value_t head = AS_CONS(val)->car;
+    if (IS_SYMBOL(head) &&
+        scope_find(r, AS_SYMBOL(head), &depth, &slot, &vars) == VAR_GLOBAL) {
+        symbol_t *sym = AS_SYMBOL(head);
+        value_t found = lookup(r->env, sym);
+
+        if (IS_MACRO(found)) {
+            // macros are expanded just once, now
+            resolve_macro(r, owner, place, val, found);
+            return;
+        }
+        if (IS_SPECIAL(found)) {
+            if (AS_PRIMITIVE(found)->name == sym) {
+                resolve_special(r, sym, owner, place);
+            }
+            return;
+        }
+        if (resolve_copy(r, owner, place)) {
+            resolve_list(r, AS_CONS(*place)->cdr);
+        }
+        return;
+    }
+
+    // an application
+    if (resolve_copy(r, owner, place)) {
+        resolve_list(r, *place);
+    }
+}
+
+/* *** entry points *** */
+
+value_t resolve(vm_t *vm, env_t *env, value_t val) {
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 1)) {
+        return val;
+    }
+    // the resolved copy is kept on the stack while it's made
+    value_t *slot = vm->stack_top++;
+    *slot = val;
+    resolver_t r = {vm, env, NULL};
+    resolve_expr(&r, NIL_VAL, slot);
+    val = *slot;
+    vm_stack_restore(vm, top);
+    return val;
+}
+
+// Resolves a copy of the arguments <args> of a form with <fn>
+// if it wasn't done yet
+static value_t resolve_args(vm_t *vm, env_t *env, value_t args,
+                            void (*fn)(resolver_t *r, value_t args)) {
+    if (!IS_CONS(args) || pool_cons_resolved(AS_CONS(args))) {
+        return args;
+    }
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 1)) {
+        return args;
+    }
+    value_t *slot = vm->stack_top++;
+    *slot = args;
+    resolver_t r = {vm, env, NULL};
+    if (resolve_copy(&r, NIL_VAL, slot)) {
+        fn(&r, *slot);
+    }
+    args = *slot;
+    vm_stack_restore(vm, top);
+    return args;
+}
+
+value_t resolve_lambda(vm_t *vm, env_t *env, value_t args) {
+    return resolve_args(vm, env, args, resolve_lambda_args);
+}
+
+value_t resolve_define(vm_t *vm, env_t *env, value_t args) {
+    return resolve_args(vm, env, args, resolve_define_args);
+}
+
+value_t resolve_let(vm_t *vm, env_t *env, value_t args) {
+    return resolve_args(vm, env, args, resolve_let_args);
+}
@@ -0,0 +1,40 @@
+#ifndef _resolve_h
+#define _resolve_h
+
+#include "config.h"
+#include "scheme.h"
+#include "value.h"  // env_t, value_t
+
+// Lexical addressing
+//
+// References to parameters of lambdas and variables bound by let
+// are replaced by their lexical address (see local_t), so that they
+// can be found without searching the environment by name.
+// A copy of the expression is resolved, the code may be data which the
+// program can still reach (eval). Only the lists which have something
+// resolved in them are copied, the copied arguments of lambda, define
+// and let are marked, so that resolving them again does nothing.
+//
+// Variables added by `define` inside a body and globals stay symbols,
+// as well as everything inside quote.
+//
+// Uses of macros are expanded while resolving (see expansion_t),
+// so that the macro is applied only once and not every time
+// the use is evaluated. Macros defined later are expanded by eval.
+// Special forms and macros are looked up in <env> at the time of resolving.
+
+// Returns true if <params> are valid lambda parameters
+bool params_valid(value_t params);
+
+// Resolves the expression <val> evaluated in <env>
+// Returns the resolved copy of the expression
+value_t resolve(vm_t *vm, env_t *env, value_t val);
+
+// Resolve the arguments <args> of lambda, define and let evaluated in <env>
+// Return the resolved copy of them, or <args> if they are a part of a body
+// which was already resolved
+value_t resolve_lambda(vm_t *vm, env_t *env, value_t args);
+value_t resolve_define(vm_t *vm, env_t *env, value_t args);
+value_t resolve_let(vm_t *vm, env_t *env, value_t args);
+
+#endif  // _resolve_h
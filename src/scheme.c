@@ -56,7 +56,7 @@ void file_load(vm_t *vm, env_t *env, const char *path) {
         fprintf(stderr, "ERROR: Could not find script %s!\n", path);
         exit(66);  // EX_NOINPUT
     }
-    value_t val = read_source(vm, source);
+    value_t val = read_source_permanent(vm, source);
     eval(vm, env, val);
 
     free(source);
@@ -64,15 +64,84 @@ void file_load(vm_t *vm, env_t *env, const char *path) {
 
 /* *** */
 
-static vm_t *vm_init() {
+// print the statistics of the GC when the VM is freed
+static bool show_gc_stats = false;
+// the maximum duration of a step of an incremental collection (see vm_gc)
+static unsigned gc_step_time = 0;
+// the number of threads marking values in major collections
+static unsigned gc_threads = 1;
+// sweep the garbage on a thread of its own
+static bool gc_sweep_thread = false;
+// the fraction of the CPU time the GC should take (0 for the default)
+static double gc_cpu_fraction = 0;
+// the size the heap shouldn't grow over (0 for none)
+static size_t heap_size_soft_max = 0;
+// the size the heap can't grow over (0 for none)
+static size_t heap_size_max = 0;
+// the size heap_size_max is raised by when the heap is full (0 to fail)
+static size_t heap_size_grow = 0;
+// back the heap with huge pages
+static bool heap_huge_pages = false;
+
+static void gc_stats_print(vm_t *vm) {
+    gc_stats_t *stats = &vm->gc_stats;
+    fprintf(stderr,
+            "GC: %zu minor collections, %.3lfs total, %.3lfms max pause\n",
+            stats->minor_count, stats->minor_time, stats->minor_max * 1000);
+    fprintf(stderr,
+            "GC: %zu major collections, %.3lfs total, %.3lfms max pause\n",
+            stats->major_count, stats->major_time, stats->major_max * 1000);
+    fprintf(stderr,
+            "GC: %zu incremental steps, %.3lfs total, %.3lfms max pause\n",
+            stats->step_count, stats->step_time, stats->step_max * 1000);
+    fprintf(stderr,
+            "GC: %zu stack slots and frames scanned by minor collections\n",
+            stats->minor_scanned);
+    fprintf(stderr,
+            "GC: %zu stack slots and frames and %zuB marked by the last "
+            "incremental step at most\n",
+            stats->remark_scanned, stats->remark_marked);
+    fprintf(stderr, "GC: %zuB promoted to the old generation\n",
+            stats->promoted);
+    fprintf(stderr, "GC: %zuB permanent\n", stats->permanent);
+    fprintf(stderr, "GC: %zuB given back\n", stats->released);
+    fprintf(stderr, "GC: the heap was full %zu times\n", stats->heap_full);
+}
+
+// Raises the maximum size of the full heap instead of failing
+static bool heap_grow(vm_t *vm, size_t size) {
+    vm->config.heap_size_max += size > heap_size_grow ? size : heap_size_grow;
+    return true;
+}
+
+static void vm_done(vm_t *vm) {
+    if (show_gc_stats) {
+        gc_stats_print(vm);
+    }
+    vm_free(vm);
+}
+
+static vm_t *vm_init(scm_engine_t engine) {
     scm_config_t config;
     scm_config_default(&config);
 
+    config.engine = engine;
+
     config.error_fn = error_report;
     config.load_fn = file_load;
+    config.gc_step_time = gc_step_time;
+    config.gc_threads = gc_threads;
+    config.gc_sweep_thread = gc_sweep_thread;
+    config.gc_cpu_fraction = gc_cpu_fraction;
+    config.heap_size_soft_max = heap_size_soft_max;
+    config.heap_size_max = heap_size_max;
+    config.heap_huge_pages = heap_huge_pages;
+    if (heap_size_grow > 0) {
+        config.oom_fn = heap_grow;
+    }
 
-    // 64 MB
-    config.heap_size_initial = 1024 * 1024 * 64;
+    // 16 MB
+    config.heap_size_initial = 1024 * 1024 * 16;
 
     vm_t *vm = vm_new(&config);
 
@@ -81,25 +150,27 @@ static vm_t *vm_init() {
 
 /* *** */
 
-void file_run(const char *filename) {
+void file_run(const char *filename, scm_engine_t engine) {
     char *source = file_read(filename);
     if (source == NULL) {
         fprintf(stderr, "ERROR: Could not find file %s!\n", filename);
         exit(66);  // EX_NOINPUT
     }
 
-    vm_t *vm = vm_init();
+    vm_t *vm = vm_init(engine);
     env_t *env = scm_env_default(vm);
 
-    value_t val = read_source(vm, source);
+    value_t val = read_source_permanent(vm, source);
     eval(vm, env, val);
+    // the finalizers queued by the last collections
+    vm_finalize(vm, env);
 
-    vm_free(vm);
+    vm_done(vm);
     free(source);
 }
 
-void repl_run() {
-    vm_t *vm = vm_init();
+void repl_run(scm_engine_t engine) {
+    vm_t *vm = vm_init(engine);
     env_t *env = scm_env_default(vm);
 
     fprintf(stdout, " _  __     \n"
@@ -127,31 +198,82 @@ void repl_run() {
             display(stdout, result);
             fprintf(stdout, "\n");
         }
+
+        vm_finalize(vm, env);
     }
 
     fprintf(stdout, "Quitting!\n");
-    vm_free(vm);
+    vm_done(vm);
 }
 
 /* *** */
 int main(int argc, char *argv[]) {
     // TODO: Add support for cmdline arguments for scripts
-    if (argc == 2) {
-        if (strcmp(argv[1], "--help") == 0) {
-            fprintf(stdout, "Usage: scheme.out [file]\n");
+    scm_engine_t engine = SCM_ENGINE_TREE;
+    const char *filename = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0) {
+            fprintf(stdout, "Usage: scheme.out [options] [file]\n");
             fprintf(stdout, "  --help    : Show this help\n");
             fprintf(stdout, "  --version : Show version\n");
+            fprintf(stdout, "  --engine=tree|bytecode : Choose the engine\n");
+            fprintf(stdout, "  --gc-stats : Show pause times of the GC\n");
+            fprintf(stdout, "  --gc-step=<us> : Collect incrementally "
+                            "in steps of at most <us> microseconds\n");
+            fprintf(stdout, "  --gc-threads=<n> : Mark values with <n> "
+                            "threads in major collections\n");
+            fprintf(stdout, "  --gc-sweep-thread : Sweep the garbage "
+                            "on a thread of its own\n");
+            fprintf(stdout, "  --gc-cpu=<fraction> : Grow the heap so that "
+                            "the GC takes about <fraction> of the time\n");
+            fprintf(stdout, "  --heap-soft-max=<kB> : Collect more often "
+                            "instead of growing the heap over <kB>\n");
+            fprintf(stdout, "  --heap-max=<kB> : Fail when the heap "
+                            "can't fit in <kB>\n");
+            fprintf(stdout, "  --heap-max-grow=<kB> : Raise --heap-max "
+                            "by <kB> instead of failing\n");
+            fprintf(stdout, "  --heap-huge-pages : Back the heap "
+                            "with transparent huge pages\n");
             return 0;
-        } else if (strcmp(argv[1], "--version") == 0) {
+        } else if (strcmp(argv[i], "--version") == 0) {
             fprintf(stdout, "SCM v%s\n", SCM_VERSION_STRING);
             return 0;
+        } else if (strcmp(argv[i], "--engine=tree") == 0) {
+            engine = SCM_ENGINE_TREE;
+        } else if (strcmp(argv[i], "--engine=bytecode") == 0) {
+            engine = SCM_ENGINE_BYTECODE;
+        } else if (strcmp(argv[i], "--gc-stats") == 0) {
+            show_gc_stats = true;
+        } else if (strncmp(argv[i], "--gc-step=", 10) == 0) {
+            gc_step_time = (unsigned) strtoul(argv[i] + 10, NULL, 10);
+        } else if (strncmp(argv[i], "--gc-threads=", 13) == 0) {
+            gc_threads = (unsigned) strtoul(argv[i] + 13, NULL, 10);
+        } else if (strcmp(argv[i], "--gc-sweep-thread") == 0) {
+            gc_sweep_thread = true;
+        } else if (strncmp(argv[i], "--gc-cpu=", 9) == 0) {
+            gc_cpu_fraction = strtod(argv[i] + 9, NULL);
+        } else if (strncmp(argv[i], "--heap-soft-max=", 16) == 0) {
+            heap_size_soft_max =
+                (size_t) strtoul(argv[i] + 16, NULL, 10) * 1024;
+        } else if (strncmp(argv[i], "--heap-max=", 11) == 0) {
+            heap_size_max = (size_t) strtoul(argv[i] + 11, NULL, 10) * 1024;
+        } else if (strncmp(argv[i], "--heap-max-grow=", 16) == 0) {
+            heap_size_grow = (size_t) strtoul(argv[i] + 16, NULL, 10) * 1024;
+        } else if (strcmp(argv[i], "--heap-huge-pages") == 0) {
+            heap_huge_pages = true;
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            fprintf(stderr, "ERROR: Unknown option %s!\n", argv[i]);
+            return 64;  // EX_USAGE
+        } else {
+            filename = argv[i];
         }
     }
 
-    if (argc == 1) {
-        repl_run();
+    if (filename == NULL) {
+        repl_run(engine);
     } else {
-        file_run(argv[1]);
+        file_run(filename, engine);
     }
 
     return 0;
@@ -2,57 +2,80 @@
 #include <string.h>  // memcpy, memcmp
 
 #include "value.h"
-#include "vm.h"  // vm_t, vm_realloc
+#include "vm.h"  // vm_t, vm_realloc, vm_alloc_value, vm_weak_add
 #include "write.h"
 
 static void ptr_init(vm_t *vm, ptrvalue_t *ptr, ptrvalue_type_t type) {
     ptr->type = type;
-    ptr->gcmark = false;
-    ptr->next = vm->head;
-    vm->head = ptr;
+    ptr->remembered = false;
+}
+
+size_t ptr_size(ptrvalue_t *ptr) {
+    switch (ptr->type) {
+        case T_STRING:
+            return sizeof(string_t) +
+                   sizeof(char) * (((string_t *) ptr)->len + 1);
+        case T_SYMBOL:
+            return sizeof(symbol_t) +
+                   sizeof(char) * (((symbol_t *) ptr)->len + 1);
+        case T_PRIMITIVE:
+            return sizeof(primitive_t);
+        case T_FUNCTION:
+        case T_MACRO:
+            return sizeof(function_t);
+        case T_VECTOR:
+            return sizeof(vector_t);
+        case T_ENV:
+            return sizeof(env_t) + sizeof(value_t) * ((env_t *) ptr)->count;
+        case T_CODE:
+            return sizeof(code_t);
+        case T_LOCAL:
+            return sizeof(local_t);
+        case T_EXPANSION:
+            return sizeof(expansion_t);
+        case T_HASHTABLE:
+            return sizeof(hashtable_t);
+        case T_WEAKBOX:
+            return sizeof(weakbox_t);
+    }
+    return 0;
 }
 
 void ptr_free(vm_t *vm, ptrvalue_t *ptr) {
-    if (ptr->type == T_STRING) {
-        vm_realloc(vm, ptr, 0, 0);
-    } else if (ptr->type == T_CONS) {
-        vm_realloc(vm, ptr, 0, 0);
-    } else if (ptr->type == T_SYMBOL) {
-        symbol_t *ptr_sym = (symbol_t *) ptr;
-        symbol_t *prev = NULL;
-        symbol_t *s = vm->symbol_table;
-        while (s != NULL) {
-            if (s->len == ptr_sym->len &&
-                memcmp(s->name, ptr_sym->name, s->len * sizeof(char)) == 0) {
-                if (prev != NULL) {
-                    prev->next = s->next;
-                    vm->symbol_table = prev;
-                } else {
-                    vm->symbol_table = s->next;
-                }
-                break;
-            }
-            prev = s;
-            s = s->next;
-        }
-        vm_realloc(vm, ptr, 0, 0);
-    } else if (ptr->type == T_PRIMITIVE) {
-        vm_realloc(vm, ptr, 0, 0);
-    } else if (ptr->type == T_FUNCTION || ptr->type == T_MACRO) {
-        vm_realloc(vm, ptr, 0, 0);
-    } else if (ptr->type == T_VECTOR) {
+    if (ptr->type == T_VECTOR) {
         vector_t *vec = (vector_t *) ptr;
 
-        vm_realloc(vm, vec->data, 0, 0);
+        vm->config.realloc_fn(vec->data, 0);
 
         vec->data = NULL;
         vec->capacity = 0;
         vec->count = 0;
-
-        vm_realloc(vm, ptr, 0, 0);
     } else if (ptr->type == T_ENV) {
-        vm_realloc(vm, ptr, 0, 0);
+        env_t *env = (env_t *) ptr;
+
+        vm->config.realloc_fn(env->variables, 0);
+
+        env->variables = NULL;
+        env->num_variables = 0;
+        env->variables_capacity = 0;
+    } else if (ptr->type == T_CODE) {
+        code_t *code = (code_t *) ptr;
+
+        vm->config.realloc_fn(code->bytes, 0);
+        vm->config.realloc_fn(code->constants, 0);
+
+        code->bytes = NULL;
+        code->constants = NULL;
+    } else if (ptr->type == T_HASHTABLE) {
+        hashtable_t *ht = (hashtable_t *) ptr;
+
+        vm->config.realloc_fn(ht->entries, 0);
+
+        ht->entries = NULL;
+        ht->capacity = 0;
+        ht->count = 0;
     }
+    vm_free_value(vm, ptr);
 }
 
 /* *** HASHING *** */
@@ -96,22 +119,66 @@ static inline uint32_t hash_number(uint64_t num) {
     return hash;
 }
 
-static uint32_t hash_ptr(ptrvalue_t *ptr) {
+// How deep are pairs and vectors hashed
+// (equal? values still get equal hashes, and cycles don't loop)
+#define HASH_MAX_DEPTH 8
+
+static uint32_t hash_value_depth(value_t val, int depth);
+
+static inline uint32_t hash_combine(uint32_t hash, uint32_t other) {
+    return (hash ^ other) * HASH_PRIME;
+}
+
+static uint32_t hash_ptr(ptrvalue_t *ptr, int depth) {
     if (ptr->type == T_STRING) {
         // all strings are hashed when created!
         return ((string_t *) ptr)->hash;
     } else if (ptr->type == T_SYMBOL) {
-        symbol_t *sym = (symbol_t *) ptr;
-        return hash_string_like(sym->name, sym->len);
+        // and so are symbols
+        return ((symbol_t *) ptr)->hash;
+    } else if (ptr->type == T_LOCAL) {
+        // the same as in val_equal
+        return ((local_t *) ptr)->name->hash;
+    } else if (ptr->type == T_EXPANSION) {
+        return hash_value_depth(((expansion_t *) ptr)->form, depth);
+    } else if (depth <= 0) {
+        return 0;
+    } else if (ptr->type == T_VECTOR) {
+        vector_t *vec = (vector_t *) ptr;
+        uint32_t hash = hash_combine(HASH_SEED, vec->count);
+        for (uint32_t i = 0; i < vec->count && i < HASH_MAX_DEPTH; i++) {
+            hash =
+                hash_combine(hash, hash_value_depth(vec->data[i], depth - 1));
+        }
+        return hash;
     } else {
         return 0;  // TODO: log error - mutable
     }
 }
 
-uint32_t hash_value(value_t val) {
+static uint32_t hash_cons(value_t val, int depth) {
+    if (depth <= 0) {
+        return 0;
+    }
+    // mutable, but equal? compares the contents
+    uint32_t hash = HASH_SEED;
+    for (int i = 0; i < HASH_MAX_DEPTH && IS_CONS(val); i++) {
+        hash = hash_combine(hash,
+                            hash_value_depth(AS_CONS(val)->car, depth - 1));
+        val = AS_CONS(val)->cdr;
+    }
+    if (!IS_CONS(val)) {
+        hash = hash_combine(hash, hash_value_depth(val, depth - 1));
+    }
+    return hash;
+}
+
+static uint32_t hash_value_depth(value_t val, int depth) {
 #if NANTAG
-    if (IS_PTR(val)) {
-        return hash_ptr(AS_PTR(val));
+    if (IS_CONS(val)) {
+        return hash_cons(val, depth);
+    } else if (IS_PTR(val)) {
+        return hash_ptr(AS_PTR(val), depth);
     } else {
         value_conv_t data;
         data.bits = val;
@@ -130,18 +197,33 @@ uint32_t hash_value(value_t val) {
         case V_NUM:
             return hash_number(AS_NUM(val));
         case V_PTR:
-            return hash_ptr(AS_PTR(val));
+            return hash_ptr(AS_PTR(val), depth);
+        case V_CONS:
+            return hash_cons(val, depth);
         default:
             return 0;
     }
 #endif  // NANTAG
 }
 
+uint32_t hash_value(value_t val) {
+    return hash_value_depth(val, HASH_MAX_DEPTH);
+}
+
+uint32_t hash_value_eq(value_t val) {
+    if (IS_PTR(val) && !IS_STRING(val) && !IS_SYMBOL(val)) {
+        uintptr_t hash = (uintptr_t) AS_PTR(val);
+        hash ^= hash >> 16;
+        hash *= HASH_PRIME;
+        hash ^= hash >> 16;
+        return (uint32_t) hash;
+    }
+    return hash_value(val);
+}
+
 /* *** ptrvalue creating *** */
 cons_t *cons_new(vm_t *vm) {
-    cons_t *cons = (cons_t *) vm_realloc(vm, NULL, 0, sizeof(cons_t));
-
-    ptr_init(vm, &cons->p, T_CONS);
+    cons_t *cons = vm_alloc_cons(vm);
 
     cons->car = NIL_VAL;
     cons->cdr = NIL_VAL;
@@ -150,8 +232,8 @@ cons_t *cons_new(vm_t *vm) {
 }
 
 string_t *string_new(vm_t *vm, const char *text, size_t len) {
-    string_t *str = (string_t *) vm_realloc(
-        vm, NULL, 0, sizeof(string_t) + sizeof(char) * (len + 1));
+    string_t *str = (string_t *) vm_alloc_value(
+        vm, sizeof(string_t) + sizeof(char) * (len + 1));
 
     ptr_init(vm, &str->p, T_STRING);
 
@@ -167,40 +249,62 @@ string_t *string_new(vm_t *vm, const char *text, size_t len) {
     return str;
 }
 
-symbol_t *symbol_new(vm_t *vm, const char *name, size_t len) {
+// Creates a symbol with an already computed <hash> of its name
+static symbol_t *symbol_new_hashed(vm_t *vm, const char *name, size_t len,
+                                   uint32_t hash) {
     if (len == 0 || name == NULL) {
         error_runtime(vm, "NULL or 0-length symbols are not allowed!");
         return NULL;
     }
 
-    symbol_t *sym = (symbol_t *) vm_realloc(
-        vm, NULL, 0, sizeof(symbol_t) + sizeof(char) * (len + 1));
+    symbol_t *sym = (symbol_t *) vm_alloc_value(
+        vm, sizeof(symbol_t) + sizeof(char) * (len + 1));
 
     ptr_init(vm, &sym->p, T_SYMBOL);
 
     sym->len = (uint32_t) len;
+    sym->hash = hash;
     sym->name[len] = '\0';
-    sym->next = NULL;
 
     memcpy(sym->name, name, len);
 
     return sym;
 }
 
+symbol_t *symbol_new(vm_t *vm, const char *name, size_t len) {
+    uint32_t hash = 0;
+    if (name != NULL) {
+        hash = hash_string_like(name, (uint32_t) len);
+    }
+    return symbol_new_hashed(vm, name, len, hash);
+}
+
 primitive_t *primitive_new(vm_t *vm, primitive_fn fn) {
-    primitive_t *prim =
-        (primitive_t *) vm_realloc(vm, NULL, 0, sizeof(primitive_t));
+    primitive_t *prim = (primitive_t *) vm_alloc_value(vm, sizeof(primitive_t));
 
     ptr_init(vm, &prim->p, T_PRIMITIVE);
 
     prim->name = NULL;
     prim->fn = fn;
+    prim->form = NULL;
+
+    return prim;
+}
+
+primitive_t *special_new(vm_t *vm, special_fn form) {
+    primitive_t *prim = (primitive_t *) vm_alloc_value(vm, sizeof(primitive_t));
+
+    ptr_init(vm, &prim->p, T_PRIMITIVE);
+
+    prim->name = NULL;
+    prim->fn = NULL;
+    prim->form = form;
 
     return prim;
 }
 
 function_t *function_new(vm_t *vm, env_t *env, value_t params, value_t body) {
-    function_t *fn = (function_t *) vm_realloc(vm, NULL, 0, sizeof(function_t));
+    function_t *fn = (function_t *) vm_alloc_value(vm, sizeof(function_t));
 
     ptr_init(vm, &fn->p, T_FUNCTION);
 
@@ -209,13 +313,13 @@ function_t *function_new(vm_t *vm, env_t *env, value_t params, value_t body) {
     fn->env = env;
     fn->params = params;
     fn->body = body;
+    fn->code = NULL;
 
     return fn;
 }
 
 function_t *macro_new(vm_t *vm, env_t *env, value_t params, value_t body) {
-    function_t *macro =
-        (function_t *) vm_realloc(vm, NULL, 0, sizeof(function_t));
+    function_t *macro = (function_t *) vm_alloc_value(vm, sizeof(function_t));
 
     ptr_init(vm, &macro->p, T_MACRO);
 
@@ -224,6 +328,7 @@ function_t *macro_new(vm_t *vm, env_t *env, value_t params, value_t body) {
     macro->env = env;
     macro->params = params;
     macro->body = body;
+    macro->code = NULL;
 
     return macro;
 }
@@ -234,7 +339,7 @@ vector_t *vector_new(vm_t *vm, uint32_t count) {
         data = (value_t *) vm_realloc(vm, NULL, 0, sizeof(value_t) * count);
     }
 
-    vector_t *vec = (vector_t *) vm_realloc(vm, NULL, 0, sizeof(vector_t));
+    vector_t *vec = (vector_t *) vm_alloc_value(vm, sizeof(vector_t));
 
     ptr_init(vm, &vec->p, T_VECTOR);
 
@@ -245,43 +350,265 @@ vector_t *vector_new(vm_t *vm, uint32_t count) {
     return vec;
 }
 
-env_t *env_new(vm_t *vm, value_t variables, env_t *up) {
-    env_t *env = (env_t *) vm_realloc(vm, NULL, 0, sizeof(env_t));
+env_t *env_new(vm_t *vm, value_t vars, bool bindings, uint32_t count,
+              env_t *up) {
+    env_t *env =
+        (env_t *) vm_alloc_value(vm, sizeof(env_t) + sizeof(value_t) * count);
 
     ptr_init(vm, &env->p, T_ENV);
 
-    env->variables = variables;
+    env->vars = vars;
+    env->bindings = bindings;
+    env->variables = NULL;
+    env->num_variables = 0;
+    env->variables_capacity = 0;
     env->up = up;
 
+    env->count = count;
+    for (uint32_t i = 0; i < count; i++) {
+        env->slots[i] = UNDEFINED_VAL;
+    }
+
     vm->env = env;
 
     return env;
 }
 
+code_t *code_new(vm_t *vm, value_t params, value_t body) {
+    code_t *code = (code_t *) vm_alloc_value(vm, sizeof(code_t));
+
+    ptr_init(vm, &code->p, T_CODE);
+
+    code->params = params;
+    code->body = body;
+
+    code->count = 0;
+    code->capacity = 0;
+    code->bytes = NULL;
+
+    code->num_constants = 0;
+    code->constants_capacity = 0;
+    code->constants = NULL;
+
+    code->max_stack = 0;
+
+    return code;
+}
+
+local_t *local_new(vm_t *vm, symbol_t *name, uint16_t depth, uint16_t slot,
+                   value_t vars) {
+    local_t *local = (local_t *) vm_alloc_value(vm, sizeof(local_t));
+
+    ptr_init(vm, &local->p, T_LOCAL);
+
+    local->name = name;
+    local->depth = depth;
+    local->slot = slot;
+    local->vars = vars;
+
+    return local;
+}
+
+expansion_t *expansion_new(vm_t *vm, value_t form, value_t expanded) {
+    expansion_t *expansion =
+        (expansion_t *) vm_alloc_value(vm, sizeof(expansion_t));
+
+    ptr_init(vm, &expansion->p, T_EXPANSION);
+
+    expansion->form = form;
+    expansion->expanded = expanded;
+
+    return expansion;
+}
+
+hashtable_t *hashtable_new(vm_t *vm, value_t eq, hashtable_weak_t weak) {
+    hashtable_t *ht = (hashtable_t *) vm_alloc_value(vm, sizeof(hashtable_t));
+
+    ptr_init(vm, &ht->p, T_HASHTABLE);
+
+    ht->eq = eq;
+    ht->weak = weak;
+    ht->count = 0;
+    ht->tombstones = 0;
+    ht->capacity = 0;
+    ht->entries = NULL;
+
+    // the GC has to know about it to clear it (it's strong if it can't)
+    if (weak != HASHTABLE_STRONG && !vm_weak_add(vm, PTR_VAL(ht))) {
+        ht->weak = HASHTABLE_STRONG;
+    }
+
+    return ht;
+}
+
+weakbox_t *weakbox_new(vm_t *vm, value_t value) {
+    weakbox_t *box = (weakbox_t *) vm_alloc_value(vm, sizeof(weakbox_t));
+
+    ptr_init(vm, &box->p, T_WEAKBOX);
+
+    box->value = FALSE_VAL;
+    if (vm_weak_add(vm, PTR_VAL(box))) {
+        box->value = value;
+    }
+
+    return box;
+}
+
 /* *** UTILITY *** */
 
+// Marks a removed entry of the symbol table (so that probing goes on)
+static symbol_t symbol_tombstone;
+
+// Finds the entry of the symbol <name> in the symbol table
+// or the first free entry (empty or a tombstone) where it would belong
+static symbol_t **symbol_entry(vm_t *vm, const char *name, size_t len,
+                               uint32_t hash) {
+    uint32_t mask = vm->symbols_capacity - 1;
+    symbol_t **free_entry = NULL;
+
+    for (uint32_t index = hash & mask;; index = (index + 1) & mask) {
+        symbol_t **entry = &vm->symbols[index];
+        if (*entry == NULL) {
+            return free_entry != NULL ? free_entry : entry;
+        }
+        if (*entry == &symbol_tombstone) {
+            if (free_entry == NULL) {
+                free_entry = entry;
+            }
+        } else if ((*entry)->hash == hash && (*entry)->len == len &&
+                   memcmp((*entry)->name, name, len * sizeof(char)) == 0) {
+            return entry;
+        }
+    }
+}
+
+// Makes room for another symbol in the symbol table
+// Returns false if it can't
+static bool symbols_grow(vm_t *vm) {
+    // keep the load factor (tombstones included) under 3/4
+    uint32_t used = vm->num_symbols + vm->num_tombstones;
+    if ((used + 1) * 4 <= vm->symbols_capacity * 3) {
+        return true;
+    }
+
+    // if there are many tombstones, just get rid of them
+    uint32_t capacity = vm->symbols_capacity ? vm->symbols_capacity : 256;
+    if ((vm->num_symbols + 1) * 2 > capacity) {
+        capacity <<= 1;
+    }
+
+    symbol_t **symbols = (symbol_t **) vm->config.realloc_fn(
+        NULL, capacity * sizeof(symbol_t *));
+    if (symbols == NULL) {
+        error_runtime(vm, "Can't grow the symbol table!");
+        return false;
+    }
+    memset(symbols, 0, capacity * sizeof(symbol_t *));
+
+    symbol_t **old = vm->symbols;
+    uint32_t old_capacity = vm->symbols_capacity;
+    vm->symbols = symbols;
+    vm->symbols_capacity = capacity;
+    vm->num_tombstones = 0;
+
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        symbol_t *sym = old[i];
+        if (sym != NULL && sym != &symbol_tombstone) {
+            *symbol_entry(vm, sym->name, sym->len, sym->hash) = sym;
+        }
+    }
+    vm->config.realloc_fn(old, 0);
+    return true;
+}
+
+// Adds the new interned symbol <sym> to vm->young_symbols
+static void symbols_young_add(vm_t *vm, symbol_t *sym) {
+    if (vm->num_young_symbols >= vm->young_symbols_capacity) {
+        // not vm_realloc, the gc can't run before <sym> is there
+        uint32_t capacity = vm->young_symbols_capacity
+                                ? vm->young_symbols_capacity << 1
+                                : 64;
+        symbol_t **young = (symbol_t **) vm->config.realloc_fn(
+            vm->young_symbols, capacity * sizeof(symbol_t *));
+        if (young == NULL) {
+            // the next minor collection goes through the whole table
+            vm->young_symbols_overflow = true;
+            return;
+        }
+        vm->young_symbols = young;
+        vm->young_symbols_capacity = capacity;
+    }
+    vm->young_symbols[vm->num_young_symbols++] = sym;
+}
+
 // This is the proper way to create interned symbols
 // (so that we don't have two symbols that don't eq each other)
 symbol_t *symbol_intern(vm_t *vm, const char *name, size_t len) {
-    for (symbol_t *s = vm->symbol_table; s != NULL; s = s->next) {
-        if (s->len == len && memcmp(s->name, name, len * sizeof(char)) == 0) {
-            return s;
+    uint32_t hash = hash_string_like(name, (uint32_t) len);
+
+    if (vm->num_symbols > 0) {
+        symbol_t **entry = symbol_entry(vm, name, len, hash);
+        if (*entry != NULL && *entry != &symbol_tombstone) {
+            return *entry;
         }
     }
 
-    symbol_t *sym = symbol_new(vm, name, len);
+    // the gc can run while the symbol is allocated,
+    // so the table is changed only after that
+    symbol_t *sym = symbol_new_hashed(vm, name, len, hash);
+    if (sym == NULL || !symbols_grow(vm)) {
+        return sym;
+    }
 
-    sym->next = vm->symbol_table;
-    vm->symbol_table = sym;
+    symbol_t **entry = symbol_entry(vm, name, len, hash);
+    if (*entry == &symbol_tombstone) {
+        vm->num_tombstones--;
+    }
+    *entry = sym;
+    vm->num_symbols++;
+    if (!sym->p.permanent) {
+        symbols_young_add(vm, sym);
+    }
 
     return sym;
 }
 
+// Removes the entry <*entry> of an unmarked symbol from the symbol table
+static inline void symbol_unintern(vm_t *vm, symbol_t **entry) {
+    *entry = &symbol_tombstone;
+    vm->num_symbols--;
+    vm->num_tombstones++;
+}
+
+void symbols_unintern_unmarked(vm_t *vm, bool minor) {
+    if (minor && !vm->young_symbols_overflow) {
+        // the old symbols stay marked
+        for (uint32_t i = 0; i < vm->num_young_symbols; i++) {
+            symbol_t *sym = vm->young_symbols[i];
+            if (!pool_marked(&sym->p)) {
+                symbol_unintern(
+                    vm, symbol_entry(vm, sym->name, sym->len, sym->hash));
+            }
+        }
+    } else {
+        for (uint32_t i = 0; i < vm->symbols_capacity; i++) {
+            symbol_t *sym = vm->symbols[i];
+            if (sym != NULL && sym != &symbol_tombstone &&
+                !pool_marked(&sym->p)) {
+                symbol_unintern(vm, &vm->symbols[i]);
+            }
+        }
+    }
+    // the symbols left are old now
+    vm->num_young_symbols = 0;
+    vm->young_symbols_overflow = false;
+}
+
 value_t cons_fn(vm_t *vm, value_t a, value_t b) {
     cons_t *result = cons_new(vm);
     result->car = a;
     result->cdr = b;
-    return PTR_VAL(result);
+    return CONS_VAL(result);
 }
 
 // Finds the length of a cons cell
@@ -333,10 +660,25 @@ void vector_push(vm_t *vm, vector_t *vec, value_t val) {
         vec->capacity = capacity;
     }
     vec->data[vec->count++] = val;
+    vm_write_barrier(vm, &vec->p, val);
 }
 
 /* *** equality *** */
 bool val_equal(value_t a, value_t b) {
+    // resolved code is still equal to its source
+    if (IS_LOCAL(a)) {
+        a = PTR_VAL(AS_LOCAL(a)->name);
+    }
+    if (IS_LOCAL(b)) {
+        b = PTR_VAL(AS_LOCAL(b)->name);
+    }
+    if (IS_EXPANSION(a)) {
+        a = AS_EXPANSION(a)->form;
+    }
+    if (IS_EXPANSION(b)) {
+        b = AS_EXPANSION(b)->form;
+    }
+
     if (val_eq(a, b)) {
         return true;
     }
@@ -347,6 +689,17 @@ bool val_equal(value_t a, value_t b) {
         return false;
     }
 
+    if (IS_CONS(a) || IS_CONS(b)) {
+        if (!IS_CONS(a) || !IS_CONS(b)) {
+            return false;
+        }
+        cons_t *consa = AS_CONS(a);
+        cons_t *consb = AS_CONS(b);
+
+        return val_equal(consa->car, consb->car) &&
+               val_equal(consa->cdr, consb->cdr);
+    }
+
     ptrvalue_t *pa = AS_PTR(a);
     ptrvalue_t *pb = AS_PTR(b);
 
@@ -354,13 +707,7 @@ bool val_equal(value_t a, value_t b) {
         return false;
     }
 
-    if (pa->type == T_CONS) {
-        cons_t *consa = (cons_t *) pa;
-        cons_t *consb = (cons_t *) pb;
-
-        return val_equal(consa->car, consb->car) &&
-               val_equal(consa->cdr, consb->cdr);
-    } else if (pa->type == T_STRING) {
+    if (pa->type == T_STRING) {
         string_t *stra = (string_t *) pa;
         string_t *strb = (string_t *) pb;
 
@@ -8,23 +8,33 @@
 #include "config.h"
 #include "scheme.h"
 
+// the types of values with a ptrvalue header (conses have none)
 typedef enum {
-    T_CONS,
     T_STRING,
     T_SYMBOL,
     T_PRIMITIVE,
     T_FUNCTION,
     T_MACRO,
     T_VECTOR,
-    T_ENV
+    T_ENV,
+    T_CODE,
+    T_LOCAL,
+    T_EXPANSION,
+    T_HASHTABLE,
+    T_WEAKBOX
 } ptrvalue_type_t;
 
-// ptrvalue is a heap allocated object
+// ptrvalue is a heap allocated object, the header of all of them
+// but conses, which are told apart by their value_t (see IS_CONS)
 typedef struct _ptrvalue {
     ptrvalue_type_t type;
-    bool gcmark;
-    // next heap allocated object
-    struct _ptrvalue *next;
+    // an old value in the remembered set of the vm
+    bool remembered;
+    // allocated on its own, not from a page (set by the allocator)
+    // the mark bits are kept outside of values (see pool.h)
+    bool large;
+    // never freed (set by the allocator, see vm->permanent)
+    bool permanent;
 } ptrvalue_t;
 
 #if NANTAG
@@ -42,7 +52,8 @@ typedef enum {
     V_VOID,
     V_EOF,
     V_NUM,
-    V_PTR
+    V_PTR,
+    V_CONS
 } value_type_t;
 
 typedef struct {
@@ -55,10 +66,9 @@ typedef struct {
 
 #endif
 
-// a cons cell
+// a cons cell, it has no header - conses have pages of their own
+// which keep their mark bits and flags (see pool.h)
 typedef struct {
-    ptrvalue_t p;
-
     value_t car, cdr;
 } cons_t;
 
@@ -71,42 +81,76 @@ typedef struct {
     char value[];
 } string_t;
 
-// a basic symbol type with a pointer
-// to the next one in the symbol_table
+// a basic symbol type with its hash
+// (interned symbols are in the symbol table of the vm)
 typedef struct _symbol_t {
     ptrvalue_t p;
 
     uint32_t len;
-
-    struct _symbol_t *next;
+    uint32_t hash;
 
     char name[];
 } symbol_t;
 
+// A variable added by define, an entry of the hash table of an env frame
+typedef struct {
+    // NULL if the entry is empty
+    symbol_t *sym;
+    value_t val;
+} variable_t;
+
 // Environment frame
 // Should be typedef'd by now
 struct _env_t {
     ptrvalue_t p;
 
-    // contains variables and their mapping in assoc list
-    // ((var . val) (var2 . val2) ... )
-    // or NIL_VAL
-    value_t variables;
+    // names of the variables in <slots>, either parameters of a function
+    // (a list, possibly dotted, or a symbol) or bindings of a let
+    // ((var val) ...) if <bindings> is true
+    value_t vars;
+    bool bindings;
+
+    // variables added by define in a hash table keyed by their symbols
+    // (open addressing, see variable_t), NULL if there are none yet
+    variable_t *variables;
+    uint32_t num_variables, variables_capacity;
 
     // points to 'upper' env, NULL if none
     struct _env_t *up;
+
+    // values of the variables named by <vars>
+    uint32_t count;
+    value_t slots[];
 };
 
 // A primitive (builtin) function C type
-typedef value_t (*primitive_fn)(vm_t *vm, env_t *env, value_t args);
-
+// Gets <argc> already evaluated arguments in <args>
+typedef value_t (*primitive_fn)(vm_t *vm, env_t *env, int argc,
+                                value_t *args);
+
+// A special form C type
+// Gets its arguments unevaluated as a list
+// If it sets <*tail_env>, the returned value is an expression
+// which is evaluated in <*tail_env> (in tail position) afterwards.
+// It may push a frame of its own before (see special_frame_push),
+// the value of the expression goes to the frame then, so that
+// its subexpressions are evaluated without recursing in C.
+typedef value_t (*special_fn)(vm_t *vm, env_t *env, value_t args,
+                              env_t **tail_env);
+
+// A primitive is either a builtin function (fn)
+// or a special form (form), the other one is NULL
 typedef struct {
     ptrvalue_t p;
 
     symbol_t *name;
     primitive_fn fn;
+    special_fn form;
 } primitive_t;
 
+// Compiled bytecode of a function (see code.h)
+typedef struct _code_t code_t;
+
 // User-defined function or a macro
 typedef struct {
     ptrvalue_t p;
@@ -116,6 +160,9 @@ typedef struct {
 
     value_t params;
     value_t body;
+
+    // bytecode of the body, NULL if not compiled (yet)
+    code_t *code;
 } function_t;
 
 // A dynamic array (vector) type
@@ -126,17 +173,94 @@ typedef struct {
     value_t *data;
 } vector_t;
 
+// An entry of a hash table
+// Empty entries have an undefined key and value,
+// deleted ones (tombstones) an undefined key and #t as the value
+typedef struct {
+    value_t key;
+    value_t value;
+} hashtable_entry_t;
+
+// What a hash table doesn't keep alive - an entry is removed when the GC
+// frees its weak key or value (see gc_weak), a value with a weak key
+// is kept alive only by its key
+typedef enum {
+    HASHTABLE_STRONG,
+    HASHTABLE_WEAK_KEYS,
+    HASHTABLE_WEAK_VALUES
+} hashtable_weak_t;
+
+// A hash table with open addressing (linear probing)
+typedef struct {
+    ptrvalue_t p;
+
+    // the equality predicate of keys (eq?, equal? or any other procedure)
+    value_t eq;
+    hashtable_weak_t weak;
+
+    uint32_t count, tombstones, capacity;
+    hashtable_entry_t *entries;
+} hashtable_t;
+
+// A box which doesn't keep its value alive,
+// the GC sets it to #f when the value is freed (see gc_weak)
+typedef struct {
+    ptrvalue_t p;
+
+    value_t value;
+} weakbox_t;
+
+// Bytecode with its constant pool
+struct _code_t {
+    ptrvalue_t p;
+
+    // parameters and body this code was compiled from
+    value_t params;
+    value_t body;
+
+    uint32_t count, capacity;
+    uint8_t *bytes;
+
+    uint32_t num_constants, constants_capacity;
+    value_t *constants;
+
+    // maximum number of values this code pushes to the stack
+    uint32_t max_stack;
+};
+
+// A reference to a local variable resolved to its lexical address
+// (replaces the symbol <name> in bodies of functions, see resolve.h)
+typedef struct {
+    ptrvalue_t p;
+
+    symbol_t *name;
+
+    // number of env frames to go up and the slot of the variable there
+    uint16_t depth, slot;
+    // <vars> of that env frame (it's checked that it's the right one)
+    value_t vars;
+} local_t;
+
+// A use of a macro together with its expansion
+// (replaces the use <form> in bodies of functions, see resolve.h)
+typedef struct {
+    ptrvalue_t p;
+
+    value_t form;
+    value_t expanded;
+} expansion_t;
+
 // C value -> value
 #define BOOL_VAL(b) ((b) ? TRUE_VAL : FALSE_VAL)
 #define NUM_VAL(num) (num_to_val(num))
 #define PTR_VAL(ptr) (ptr_to_val((ptrvalue_t *) (ptr)))
+#define CONS_VAL(cons) (cons_to_val(cons))
 
 #define IS_BOOL(val) (IS_FALSE(val) || IS_TRUE(val))
 
 #define IS_INT(val) (IS_NUM(val) && (trunc(AS_NUM(val)) == AS_NUM(val)))
 #define IS_DOUBLE(val) (IS_NUM(val) && !(trunc(AS_NUM(val)) == AS_NUM(val)))
 
-#define IS_CONS(val) (val_is_ptr(val, T_CONS))
 #define IS_STRING(val) (val_is_ptr(val, T_STRING))
 #define IS_SYMBOL(val) (val_is_ptr(val, T_SYMBOL))
 #define IS_PRIMITIVE(val) (val_is_ptr(val, T_PRIMITIVE))
@@ -144,11 +268,16 @@ typedef struct {
 #define IS_MACRO(val) (val_is_ptr(val, T_MACRO))
 #define IS_VECTOR(val) (val_is_ptr(val, T_VECTOR))
 #define IS_ENV(val) (val_is_ptr(val, T_ENV))
+#define IS_CODE(val) (val_is_ptr(val, T_CODE))
+#define IS_LOCAL(val) (val_is_ptr(val, T_LOCAL))
+#define IS_EXPANSION(val) (val_is_ptr(val, T_EXPANSION))
+#define IS_HASHTABLE(val) (val_is_ptr(val, T_HASHTABLE))
+#define IS_WEAKBOX(val) (val_is_ptr(val, T_WEAKBOX))
 
 #define IS_PROCEDURE(val) (IS_PRIMITIVE(val) || IS_FUNCTION(val))
+#define IS_SPECIAL(val) (IS_PRIMITIVE(val) && AS_PRIMITIVE(val)->form != NULL)
 
 // doesn't check anything
-#define AS_CONS(val) ((cons_t *) AS_PTR(val))
 #define AS_STRING(val) ((string_t *) AS_PTR(val))
 #define AS_SYMBOL(val) ((symbol_t *) AS_PTR(val))
 #define AS_PRIMITIVE(val) ((primitive_t *) AS_PTR(val))
@@ -156,6 +285,11 @@ typedef struct {
 #define AS_MACRO(val) (AS_FUNCTION(val))
 #define AS_VECTOR(val) ((vector_t *) AS_PTR(val))
 #define AS_ENV(val) ((env_t *) AS_PTR(val))
+#define AS_CODE(val) ((code_t *) AS_PTR(val))
+#define AS_LOCAL(val) ((local_t *) AS_PTR(val))
+#define AS_EXPANSION(val) ((expansion_t *) AS_PTR(val))
+#define AS_HASHTABLE(val) ((hashtable_t *) AS_PTR(val))
+#define AS_WEAKBOX(val) ((weakbox_t *) AS_PTR(val))
 
 #define AS_NUM(val) (val_to_num(val))
 #define AS_INT(val) ((int64_t) trunc(val_to_num(val)))
@@ -168,6 +302,9 @@ typedef struct {
 #define SIGN_BIT ((uint64_t) 1 << 63)
 // -1111111111111--------------------------------------------------
 #define QUIET_NAN ((uint64_t) 0x7ffc000000000000)
+// set in pointers to conses
+// ---------------1------------------------------------------------
+#define CONS_BIT ((uint64_t) 1 << 48)
 
 // used for singletons
 // -------------------------------------------------------------111
@@ -202,24 +339,36 @@ typedef struct {
 
 // returns true if val is type <X> in IS_<X>
 #define IS_NUM(val) (((val) & (QUIET_NAN)) != QUIET_NAN)
+// any heap allocated value (a ptrvalue or a cons)
 #define IS_PTR(val) (((val) & (QUIET_NAN | SIGN_BIT)) == (QUIET_NAN | SIGN_BIT))
 // if a value is not ptrvalue
 #define IS_VAL(val) (!IS_PTR(val))
+#define IS_CONS(val)                                 \
+    (((val) & (QUIET_NAN | SIGN_BIT | CONS_BIT)) == \
+     (QUIET_NAN | SIGN_BIT | CONS_BIT))
+// a heap allocated value with a ptrvalue header
+#define IS_HEADED(val) \
+    (((val) & (QUIET_NAN | SIGN_BIT | CONS_BIT)) == (QUIET_NAN | SIGN_BIT))
 
 // value -> C value
 // all values but #f and NIL are truthy!
 #define AS_BOOL(val) ((!IS_FALSE(val)) && (!IS_NIL(val)))
 #define AS_PTR(val) \
     ((ptrvalue_t *) (uintptr_t)((val) & ~(SIGN_BIT | QUIET_NAN)))
+#define AS_CONS(val) \
+    ((cons_t *) (uintptr_t)((val) & ~(SIGN_BIT | QUIET_NAN | CONS_BIT)))
 
 #else  // !NANTAG
 
 #define AS_BOOL(val) (((val).type != V_FALSE) && ((val).type != V_NIL))
 
 #define AS_PTR(val) ((val).v.ptr)
+#define AS_CONS(val) ((cons_t *) (val).v.ptr)
 
-#define IS_PTR(val) ((val).type == V_PTR)
-#define IS_VAL(val) ((val).type != V_PTR)
+#define IS_PTR(val) ((val).type == V_PTR || (val).type == V_CONS)
+#define IS_VAL(val) (!IS_PTR(val))
+#define IS_CONS(val) ((val).type == V_CONS)
+#define IS_HEADED(val) ((val).type == V_PTR)
 
 #define IS_NIL(val) ((val).type == V_NIL)
 #define IS_TRUE(val) ((val).type == V_TRUE)
@@ -244,21 +393,39 @@ typedef struct {
 
 /* *** Memory management functions *** */
 
+// Returns the size of the value <ptr> itself
+// (without the buffers it points to)
+size_t ptr_size(ptrvalue_t *ptr);
+// Frees the value <ptr> and its buffers (the sweeper thread uses it too,
+// so it doesn't account for them, see vm_size)
 void ptr_free(vm_t *vm, ptrvalue_t *ptr);
 
 cons_t *cons_new(vm_t *vm);
 string_t *string_new(vm_t *vm, const char *text, size_t len);
 symbol_t *symbol_new(vm_t *vm, const char *name, size_t len);
 primitive_t *primitive_new(vm_t *vm, primitive_fn fn);
+primitive_t *special_new(vm_t *vm, special_fn form);
 function_t *function_new(vm_t *vm, env_t *env, value_t params, value_t body);
 function_t *macro_new(vm_t *vm, env_t *env, value_t params, value_t body);
 vector_t *vector_new(vm_t *vm, uint32_t count);
-env_t *env_new(vm_t *vm, value_t variables, env_t *up);
+env_t *env_new(vm_t *vm, value_t vars, bool bindings, uint32_t count,
+              env_t *up);
+code_t *code_new(vm_t *vm, value_t params, value_t body);
+local_t *local_new(vm_t *vm, symbol_t *name, uint16_t depth, uint16_t slot,
+                   value_t vars);
+expansion_t *expansion_new(vm_t *vm, value_t form, value_t expanded);
+hashtable_t *hashtable_new(vm_t *vm, value_t eq, hashtable_weak_t weak);
+weakbox_t *weakbox_new(vm_t *vm, value_t value);
 
 // Makes sure that there are no duplicit symbols
 // => we can compare symbols using pointer comparisons
 symbol_t *symbol_intern(vm_t *vm, const char *name, size_t len);
 
+// Removes all unmarked symbols from the symbol table, it doesn't keep
+// them alive (they are freed later, when their page is swept)
+// After a <minor> collection only the young symbols can be unmarked
+void symbols_unintern_unmarked(vm_t *vm, bool minor);
+
 // Creates a new cons cell and puts a as car and b as cdr
 value_t cons_fn(vm_t *vm, value_t a, value_t b);
 
@@ -311,10 +478,22 @@ static inline value_t ptr_to_val(ptrvalue_t *ptr) {
 #endif
 }
 
+static inline value_t cons_to_val(cons_t *cons) {
+#if NANTAG
+    return (value_t)(SIGN_BIT | QUIET_NAN | CONS_BIT |
+                     (uint64_t)(uintptr_t)(cons));
+#else  // !NANTAG
+    value_t val;
+    val.type = V_CONS;
+    val.v.ptr = (ptrvalue_t *) cons;
+    return val;
+#endif
+}
+
 /* *** equality *** */
 
 static inline bool val_is_ptr(value_t val, ptrvalue_type_t t) {
-    return IS_PTR(val) && AS_PTR(val)->type == t;
+    return IS_HEADED(val) && AS_PTR(val)->type == t;
 }
 
 // scm: equal?
@@ -340,12 +519,15 @@ static inline bool val_eq(value_t a, value_t b) {
 // (careful, has to be immutable [IS_VAL || IS_STRING])
 uint32_t hash_value(value_t val);
 
+// hashes a value for eq? - mutable values are hashed by their address
+uint32_t hash_value_eq(value_t val);
+
 /* *** looping *** */
 
 // For each value `val` in cons pair `cons` using iterator `iter`,
 // do something
 #define SCM_FOREACH(val, cons, iter)                                         \
-    for ((iter) = PTR_VAL(cons); !IS_NIL(iter); (iter) = AS_CONS(iter)->cdr) \
+    for ((iter) = CONS_VAL(cons); !IS_NIL(iter); (iter) = AS_CONS(iter)->cdr) \
         if (((val) = AS_CONS(iter)->car), true)
 
 #endif  // _value_h
@@ -1,18 +1,41 @@
+#include "config.h"
+#if MONOTONIC_CLOCK && !defined(_POSIX_C_SOURCE)
+// clock_gettime isn't in strict C99
+#define _POSIX_C_SOURCE 200809L
+#endif  // MONOTONIC_CLOCK
+
+#include <math.h>    // HUGE_VAL
+#if CONSERVATIVE
+#include <setjmp.h>  // jmp_buf, setjmp
+#endif  // CONSERVATIVE
 #include <stdarg.h>  // va_list, ...
 #include <stdio.h>   // fprintf, stderr
 #include <stdlib.h>  // realloc
 #include <string.h>  // memset
 
-#if DEBUG
-#include <time.h>  // clock(), CLOCKS_PER_SEC
-#endif             // DEBUG`
+#include <time.h>    // clock_gettime, clock(), CLOCKS_PER_SEC
 
+#include "code.h"
 #include "scheme.h"
 #include "value.h"
 #include "vm.h"
 #include "write.h"
 
-#define MAX_ALLOCATED 1024 * 1024 * 32  // 32 MB
+#if THREADS
+#include <sched.h>  // sched_yield
+#endif  // THREADS
+
+// allocated between two steps of an incremental collection (see vm_gc)
+#define GC_STEP_ALLOCATED (1024 * 32)
+// values marked by a step between checking the time
+#define GC_STEP_CHECK 256
+// the last step marks the stack slots and frames which changed since
+// the steps marked them, they're marked by the steps once more if there
+// are more of them or the program allocated more than GC_RESCAN_ALLOCATED
+// bytes meanwhile (at most GC_RESCANS times, see gc_rescan)
+#define GC_RESCAN_MIN 4096
+#define GC_RESCAN_ALLOCATED (GC_STEP_ALLOCATED * 2)
+#define GC_RESCANS 8
 
 void error_runtime(vm_t *vm, const char *format, ...) {
     vm->has_error = true;
@@ -52,6 +75,36 @@ void scm_config_default(scm_config_t *config) {
     config->heap_size_initial = 512 * 1024;  // 512 kB
     config->heap_size_min = 64 * 1024;       //  64 kB
     config->heap_growth = 0.5;               //  50%
+    config->heap_size_max = 0;
+    config->heap_huge_pages = false;
+    config->gc_cpu_fraction = 0;
+    config->heap_size_soft_max = 0;
+    config->gc_release_after = 3;
+    config->nursery_size = 256 * 1024;       // 256 kB
+    config->gc_step_time = 0;
+    config->gc_threads = 1;
+    config->gc_sweep_thread = false;
+    config->gc_fn = NULL;
+    config->oom_fn = NULL;
+
+    config->engine = SCM_ENGINE_TREE;
+
+    config->stack_max = 1024 * 1024 * 256;  // 256 MB
+}
+
+static void sweeper_start(vm_t *vm);
+static void sweeper_stop(vm_t *vm);
+
+// Returns the time in seconds for measuring pauses of the GC
+// (see MONOTONIC_CLOCK in config.h)
+static double gc_clock(void) {
+#if MONOTONIC_CLOCK
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1000000000;
+#else
+    return (double) clock() / CLOCKS_PER_SEC;
+#endif  // MONOTONIC_CLOCK
 }
 
 vm_t *vm_new(scm_config_t *config) {
@@ -68,10 +121,61 @@ vm_t *vm_new(scm_config_t *config) {
         scm_config_default(&vm->config);
     }
 
+    vm->free_pages = NULL;
+    vm->num_pages = 0;
+    vm->large = NULL;
+    vm->large_young = NULL;
+    vm->unmark_large = NULL;
+    vm->unmark_release = false;
+    vm->unmark_chunks = NULL;
+    vm->permanent = false;
+    for (size_t i = 0; i < POOL_NUM_POOLS; i++) {
+        vm->permanent_pools[i].permanent = true;
+    }
+    vm->large_permanent = NULL;
+    vm->remembered = NULL;
+    vm->num_remembered = 0;
+    vm->remembered_capacity = 0;
+    vm->permanent_refs = NULL;
+    vm->num_permanent_refs = 0;
+    vm->permanent_refs_capacity = 0;
+    vm->weak = NULL;
+    vm->num_weak = 0;
+    vm->num_weak_old = 0;
+    vm->weak_capacity = 0;
+    vm->finalizers = NULL;
+    vm->num_finalizers = 0;
+    vm->finalizers_capacity = 0;
+    vm->finalize = NULL;
+    vm->num_finalize = 0;
+    vm->finalize_capacity = 0;
+
     vm->allocated = 0;
     vm->gc_threshold = vm->config.heap_size_initial;
-
-    vm->symbol_table = NULL;
+    vm->young_allocated = 0;
+    vm->gc_minor = false;
+
+    vm->marker.vm = vm;
+    vm->marker.gray = NULL;
+    vm->marker.num_gray = 0;
+    vm->marker.gray_capacity = 0;
+    vm->marker.overflow = false;
+    vm->marker.marked = 0;
+    vm->marker.shared = false;
+    vm->marker.vector = NULL;
+
+    vm->gc_phase = GC_IDLE;
+    vm->gc_pacer.pause_end = gc_clock();
+    sweeper_start(vm);
+
+    vm->symbols = NULL;
+    vm->num_symbols = 0;
+    vm->num_tombstones = 0;
+    vm->symbols_capacity = 0;
+    vm->young_symbols = NULL;
+    vm->num_young_symbols = 0;
+    vm->young_symbols_capacity = 0;
+    vm->young_symbols_overflow = false;
 
     vm->env = NULL;
     vm->reader = NULL;
@@ -83,415 +187,2436 @@ vm_t *vm_new(scm_config_t *config) {
 
     vm->has_error = false;
 
+    vm->segment =
+        (stack_segment_t *) reallocate(NULL, sizeof(stack_segment_t));
+    vm->segment->prev = NULL;
+    vm->segment->next = NULL;
+    vm->segment->offset = 0;
+    vm->stack_top = vm->segment->slots;
+    vm->stack_end = vm->segment->slots + STACK_SEGMENT_SIZE;
+
+    vm->frames = (frame_t *) reallocate(NULL, sizeof(frame_t) * FRAMES_INITIAL);
+    vm->num_frames = 0;
+    vm->frames_capacity = FRAMES_INITIAL;
+
+    vm->stack_size =
+        sizeof(stack_segment_t) + sizeof(frame_t) * FRAMES_INITIAL;
+    vm->stack_old = 0;
+    vm->frames_old = 0;
+    vm->gc_scanned = 0;
+    vm->gc_frames_scanned = 0;
+    vm->gc_rescans = 0;
+    vm->num_regs = 0;
+    vm->native_depth = 0;
+
     return vm;
 }
 
 void vm_free(vm_t *vm) {
-    ptrvalue_t *ptr = vm->head;
-    while (ptr != NULL) {
-        ptrvalue_t *next = ptr->next;
-        ptr_free(vm, ptr);
-        ptr = next;
+    sweeper_stop(vm);
+    pool_free_all(vm);
+    vm->config.realloc_fn(vm->symbols, 0);
+    vm->config.realloc_fn(vm->young_symbols, 0);
+    vm->config.realloc_fn(vm->remembered, 0);
+    vm->config.realloc_fn(vm->permanent_refs, 0);
+    vm->config.realloc_fn(vm->weak, 0);
+    vm->config.realloc_fn(vm->finalizers, 0);
+    vm->config.realloc_fn(vm->finalize, 0);
+    vm->config.realloc_fn(vm->marker.gray, 0);
+
+    stack_segment_t *segment = vm->segment;
+    while (segment->prev != NULL) {
+        segment = segment->prev;
+    }
+    while (segment != NULL) {
+        stack_segment_t *next = segment->next;
+        vm->config.realloc_fn(segment, 0);
+        segment = next;
     }
+    vm->config.realloc_fn(vm->frames, 0);
 
     vm_realloc(vm, vm, 0, 0);
 }
 
-void *vm_realloc(vm_t *vm, void *ptr, size_t old_size, size_t new_size) {
+static bool gc_sweep_until(vm_t *vm, double deadline);
+static void gc_start(vm_t *vm);
+static void gc_step(vm_t *vm);
+static void sweeper_account(vm_t *vm);
+static void gc_full(vm_t *vm);
+static void gc_weak(vm_t *vm);
+
+// Calls config.oom_fn when the heap is full even after a full collection
+// and <size> more bytes don't fit, returns if it should be tried again
+// Otherwise the VM can't go on (allocations aren't checked everywhere)
+static void heap_full(vm_t *vm, size_t size) {
+    vm->gc_stats.heap_full++;
+    if (vm->config.oom_fn != NULL && vm->config.oom_fn(vm, size)) {
+        return;
+    }
+    error_runtime(vm, "Out of memory - can't allocate %zu more bytes!", size);
+    abort();
+}
+
+static inline bool heap_over_max(vm_t *vm) {
+    return vm->config.heap_size_max > 0 &&
+           vm->allocated > vm->config.heap_size_max;
+}
+
+// Accounts for an allocation changing from <old_size> to <new_size> bytes
+// Runs the GC if needed, see heap_full if the heap is over its maximum
+static void vm_allocate(vm_t *vm, size_t old_size, size_t new_size) {
+    sweeper_account(vm);
     vm->allocated += new_size - old_size;
+    if (new_size > old_size) {
+        vm->young_allocated += new_size - old_size;
+    }
 
-    if (new_size > 0 && vm->allocated > vm->gc_threshold) {
-        vm_gc(vm);
+    if (new_size > 0) {
+        if (vm->gc_phase != GC_IDLE) {
+            if (vm->young_allocated > GC_STEP_ALLOCATED) {
+                gc_step(vm);
+            }
+        } else if (vm->allocated > vm->gc_threshold) {
+            if (vm->config.gc_step_time > 0) {
+                gc_start(vm);
+            } else {
+                // the garbage may just be left unswept
+                gc_sweep_until(vm, 0);
+                if (vm->allocated > vm->gc_threshold) {
+                    vm_gc(vm);
+                }
+            }
+        } else if (vm->young_allocated > vm->config.nursery_size) {
+            vm_gc_minor(vm);
+        }
     }
 #if !NOGC
-    if (vm->allocated > MAX_ALLOCATED) {
-        error_runtime(
-            vm,
-            "Can't allocate - already allocated more than %d (MAX_ALLOCATED)!",
-            MAX_ALLOCATED);
-        vm->allocated -= new_size;
-        return NULL;
+    if (new_size > old_size && heap_over_max(vm)) {
+        gc_full(vm);
+        while (heap_over_max(vm)) {
+            heap_full(vm, new_size - old_size);
+        }
     }
 #endif  // !NOGC
-    return vm->config.realloc_fn(ptr, new_size);
 }
 
-/* *** temp *** */
+void *vm_realloc(vm_t *vm, void *ptr, size_t old_size, size_t new_size) {
+    vm_allocate(vm, old_size, new_size);
+    void *new_ptr = vm->config.realloc_fn(ptr, new_size);
+    if (new_ptr == NULL && new_size > 0) {
+        gc_full(vm);
+        while ((new_ptr = vm->config.realloc_fn(ptr, new_size)) == NULL) {
+            heap_full(vm, new_size);
+        }
+    }
+    return new_ptr;
+}
+
+// Allocates a value of <size> bytes from the pools or a big one
+static void *value_alloc(vm_t *vm, size_t size) {
+#if !NOPOOL
+    if (pool_fits(size)) {
+        return pool_alloc(vm, size, vm->permanent);
+    }
+#endif  // !NOPOOL
+    return pool_alloc_large(vm, size, vm->permanent);
+}
 
-void vm_push_temp(vm_t *vm, ptrvalue_t *ptr) {
+void *vm_alloc_value(vm_t *vm, size_t size) {
+    vm_allocate(vm, 0, size);
+    if (vm->permanent) {
+        vm->gc_stats.permanent += size;
+    }
+    void *ptr = value_alloc(vm, size);
     if (ptr == NULL) {
-        error_runtime(vm, "Cannot have a NULL as a temporary root!");
+        gc_full(vm);
+        while ((ptr = value_alloc(vm, size)) == NULL) {
+            heap_full(vm, size);
+        }
+    }
+    return ptr;
+}
+
+cons_t *vm_alloc_cons(vm_t *vm) {
+    vm_allocate(vm, 0, sizeof(cons_t));
+    if (vm->permanent) {
+        vm->gc_stats.permanent += sizeof(cons_t);
     }
-    if (vm->num_temp >= MAX_NUM_TEMP) {
-        error_runtime(
-            vm, "Trying to add a temporary root that is over limit (%d is max)",
-            MAX_NUM_TEMP);
+    cons_t *cons = pool_alloc_cons(vm, vm->permanent);
+    if (cons == NULL) {
+        gc_full(vm);
+        while ((cons = pool_alloc_cons(vm, vm->permanent)) == NULL) {
+            heap_full(vm, sizeof(cons_t));
+        }
     }
-    vm->temp[vm->num_temp++] = ptr;
+    return cons;
+}
+
+void vm_free_value(vm_t *vm, ptrvalue_t *ptr) {
+    pool_free(vm, ptr);
+}
+
+/* *** stack *** */
+
+// Returns the position of <slot> of <segment> in the whole stack
+static inline size_t stack_position(stack_segment_t *segment, value_t *slot) {
+    return segment->offset + (size_t) (slot - segment->slots);
 }
 
-void vm_pop_temp(vm_t *vm) {
-    if (vm->num_temp <= 0) {
-        error_runtime(vm, "No more temporary roots to release!");
+// Checks if the stack can grow by <size> bytes
+static bool stack_grow_check(vm_t *vm, size_t size) {
+    if (vm->stack_size + size > vm->config.stack_max) {
+        error_runtime(vm, "Stack overflow (%zu bytes is max)!",
+                      vm->config.stack_max);
+        return false;
     }
-    vm->num_temp--;
+    return true;
 }
 
-/* *** GC *** */
+bool vm_stack_check(vm_t *vm, size_t n) {
+    if (vm->stack_top + n <= vm->stack_end) {
+        return true;
+    }
+    if (n > STACK_SEGMENT_SIZE) {
+        error_runtime(vm, "Stack overflow (%d values at once is max)!",
+                      STACK_SEGMENT_SIZE);
+        return false;
+    }
 
-static void mark(vm_t *vm, value_t val) {
-    if (IS_VAL(val)) {
-        return;
+    // the values have to be contiguous, let's move on to the next segment
+    stack_segment_t *segment = vm->segment;
+    if (segment->next == NULL) {
+        if (!stack_grow_check(vm, sizeof(stack_segment_t))) {
+            return false;
+        }
+        stack_segment_t *next = (stack_segment_t *) vm->config.realloc_fn(
+            NULL, sizeof(stack_segment_t));
+        if (next == NULL) {
+            error_runtime(vm, "Can't allocate a new stack segment!");
+            return false;
+        }
+        next->prev = segment;
+        next->next = NULL;
+        next->offset = segment->offset + STACK_SEGMENT_SIZE;
+        segment->next = next;
+        vm->stack_size += sizeof(stack_segment_t);
     }
-    ptrvalue_t *ptr = AS_PTR(val);
-    if (ptr == NULL) {
-        error_runtime(vm, "|GC: Cannot mark a NULL!");
-        return;
+    segment->top = vm->stack_top;
+
+    vm->segment = segment->next;
+    vm->stack_top = vm->segment->slots;
+    vm->stack_end = vm->segment->slots + STACK_SEGMENT_SIZE;
+    return true;
+}
+
+void vm_stack_restore(vm_t *vm, value_t *top) {
+    stack_segment_t *segment = vm->segment;
+    while (top < segment->slots || top > segment->slots + STACK_SEGMENT_SIZE) {
+        segment = segment->prev;
     }
-    if (ptr->gcmark) {
-        return;
+    vm->segment = segment;
+    vm->stack_top = top;
+    vm->stack_end = segment->slots + STACK_SEGMENT_SIZE;
+
+    // the slots above are written again from here
+    size_t position = stack_position(segment, top);
+    if (position < vm->stack_old) {
+        vm->stack_old = position;
+    }
+}
+
+bool vm_native_check(vm_t *vm) {
+    if (vm->native_depth >= MAX_NATIVE_DEPTH) {
+        error_runtime(vm, "Too deep recursion (%d nested evals is max)!",
+                      MAX_NATIVE_DEPTH);
+        return false;
+    }
+    return true;
+}
+
+frame_t *vm_push_frame(vm_t *vm) {
+    if (vm->num_frames >= vm->frames_capacity) {
+        size_t capacity = vm->frames_capacity * 2;
+        size_t size = sizeof(frame_t) * (capacity - vm->frames_capacity);
+        if (!stack_grow_check(vm, size)) {
+            return NULL;
+        }
+        frame_t *frames = (frame_t *) vm->config.realloc_fn(
+            vm->frames, sizeof(frame_t) * capacity);
+        if (frames == NULL) {
+            error_runtime(vm, "Can't allocate more call frames!");
+            return NULL;
+        }
+        vm->frames = frames;
+        vm->frames_capacity = capacity;
+        vm->stack_size += size;
+    }
+    // only the innermost frame changes (and the slots above it),
+    // so the one below may have changed since the last collection
+    if (vm->num_frames > 0) {
+        frame_t *below = &vm->frames[vm->num_frames - 1];
+        if (vm->num_frames - 1 < vm->frames_old) {
+            vm->frames_old = vm->num_frames - 1;
+        }
+        if (below->position < vm->stack_old) {
+            vm->stack_old = below->position;
+        }
     }
+    frame_t *frame = &vm->frames[vm->num_frames++];
+    frame->position = stack_position(vm->segment, vm->stack_top);
+    return frame;
+}
+
+/* *** GC *** */
 
-    ptr->gcmark = true;
+static void mark(marker_t *m, value_t val);
 
-    if (ptr->type == T_CONS) {
-        cons_t *cons = (cons_t *) ptr;
-        mark(vm, cons->car);
-        mark(vm, cons->cdr);
-    } else if (ptr->type == T_ENV) {
+// Marks the values referenced by <val>
+static void mark_refs(marker_t *m, value_t val) {
+    if (IS_CONS(val)) {
+        cons_t *cons = AS_CONS(val);
+        // the car is popped first, so the stack doesn't grow along a list
+        mark(m, cons->cdr);
+        mark(m, cons->car);
+        return;
+    }
+    ptrvalue_t *ptr = AS_PTR(val);
+    if (ptr->type == T_ENV) {
         env_t *env = (env_t *) ptr;
-        mark(vm, env->variables);
-        if (!IS_NIL(env->variables)) {
-            cons_t *vars = AS_CONS(env->variables);
-            while (true) {
-                value_t pair = vars->car;
-                mark(vm, pair);
-                if (IS_NIL(vars->cdr)) {
-                    break;
-                }
-                vars = AS_CONS(vars->cdr);
+        mark(m, env->vars);
+        for (uint32_t i = 0; i < env->variables_capacity; i++) {
+            variable_t *var = &env->variables[i];
+            if (var->sym != NULL) {
+                mark(m, PTR_VAL(var->sym));
+                mark(m, var->val);
             }
         }
+        for (uint32_t i = 0; i < env->count; i++) {
+            mark(m, env->slots[i]);
+        }
 
         if (env->up != NULL) {
-            mark(vm, PTR_VAL(env->up));
+            mark(m, PTR_VAL(env->up));
         }
     } else if (ptr->type == T_PRIMITIVE) {
         primitive_t *prim = (primitive_t *) ptr;
         if (prim->name != NULL) {
-            mark(vm, PTR_VAL(prim->name));
+            mark(m, PTR_VAL(prim->name));
         }
     } else if (ptr->type == T_FUNCTION || ptr->type == T_MACRO) {
         function_t *func = (function_t *) ptr;
 
         if (func->name != NULL) {
-            mark(vm, PTR_VAL(func->name));
+            mark(m, PTR_VAL(func->name));
         }
 
-        mark(vm, func->params);
-        mark(vm, func->body);
-        mark(vm, PTR_VAL(func->env));
+        mark(m, func->params);
+        mark(m, func->body);
+        mark(m, PTR_VAL(func->env));
+
+        if (func->code != NULL) {
+            mark(m, PTR_VAL(func->code));
+        }
     } else if (ptr->type == T_VECTOR) {
         vector_t *vec = (vector_t *) ptr;
 
         for (uint32_t i = 0; i < vec->count; i++) {
-            mark(vm, vec->data[i]);
+            mark(m, vec->data[i]);
         }
-    }
-}
+    } else if (ptr->type == T_CODE) {
+        code_t *code = (code_t *) ptr;
 
-static void markall(vm_t *vm) {
-    env_t *env = vm->env;
-    mark(vm, PTR_VAL(env));
+        mark(m, code->params);
+        mark(m, code->body);
 
-    if (vm->reader != NULL) {
-        mark(vm, vm->reader->tokval);
+        for (uint32_t i = 0; i < code->num_constants; i++) {
+            mark(m, code->constants[i]);
+        }
+    } else if (ptr->type == T_LOCAL) {
+        local_t *local = (local_t *) ptr;
+        mark(m, PTR_VAL(local->name));
+        mark(m, local->vars);
+    } else if (ptr->type == T_HASHTABLE) {
+        hashtable_t *ht = (hashtable_t *) ptr;
+        // the weak references are left to gc_weak
+        // (a value with a weak key is marked if the key is)
+        if (ht->weak == HASHTABLE_STRONG) {
+            for (uint32_t i = 0; i < ht->capacity; i++) {
+                mark(m, ht->entries[i].key);
+                mark(m, ht->entries[i].value);
+            }
+        } else if (ht->weak == HASHTABLE_WEAK_VALUES) {
+            for (uint32_t i = 0; i < ht->capacity; i++) {
+                mark(m, ht->entries[i].key);
+            }
+        }
+        mark(m, ht->eq);
+    } else if (ptr->type == T_EXPANSION) {
+        expansion_t *expansion = (expansion_t *) ptr;
+        mark(m, expansion->form);
+        mark(m, expansion->expanded);
     }
+}
 
-    for (size_t i = 0; i < vm->num_temp; i++) {
-        mark(vm, PTR_VAL(vm->temp[i]));
+// Makes space for <n> more values on the mark stack of <m>
+// Returns false if it can't grow
+static bool marker_reserve(marker_t *m, size_t n) {
+    if (m->num_gray + n <= m->gray_capacity) {
+        return true;
     }
-
-    mark(vm, vm->curval);
+    size_t capacity = m->gray_capacity ? m->gray_capacity * 2 : 256;
+    while (capacity < m->num_gray + n) {
+        capacity *= 2;
+    }
+    // not vm_realloc, it would account for it (and maybe run the GC)
+    value_t *gray = (value_t *) m->vm->config.realloc_fn(
+        m->gray, sizeof(value_t) * capacity);
+    if (gray == NULL) {
+        return false;
+    }
+    m->gray = gray;
+    m->gray_capacity = capacity;
+    return true;
 }
 
-// returns the size of a value
-static size_t vm_size(vm_t *vm, value_t val) {
+// Marking doesn't recurse, so that the C stack is never exhausted
+// by a deep (or long) structure. A marked value is pushed
+// to the mark stack (vm->marker) and its references are marked
+// when it's popped (see mark_refs and trace).
+//
+// Old values stay marked between collections (see pool.h),
+// so a minor collection doesn't mark them again
+static void mark(marker_t *m, value_t val) {
     if (IS_VAL(val)) {
-        return 0;
-    } else if (IS_CONS(val)) {
-        return sizeof(cons_t);
-    } else if (IS_STRING(val)) {
-        string_t *str = AS_STRING(val);
-        return sizeof(string_t) + sizeof(char) * (str->len + 1);
-    } else if (IS_SYMBOL(val)) {
-        symbol_t *sym = AS_SYMBOL(val);
-        return sizeof(symbol_t) + sizeof(char) * (sym->len + 1);
-    } else if (IS_PRIMITIVE(val)) {
-        return sizeof(primitive_t);
-    } else if (IS_FUNCTION(val) || IS_MACRO(val)) {
-        return sizeof(function_t);
-    } else if (IS_VECTOR(val)) {
-        vector_t *vec = AS_VECTOR(val);
-        return sizeof(vector_t) + sizeof(value_t) * (vec->capacity);
-    } else if (IS_ENV(val)) {
-        return sizeof(env_t);
+        return;
     }
-    // This should be an assert
-    error_runtime(vm, "Cannot calculate the size of this value!");
-    return 0;
-}
-
-// A very basic mark and sweep GC
-void vm_gc(vm_t *vm) {
-#if NOGC
-    return;
-#endif  // NOGC
-#if DEBUG
-    fprintf(stdout, "GC started\n");
-    size_t allocated_prev = vm->allocated;
-    double time_start = (double) clock() / CLOCKS_PER_SEC;
-#endif  // DEBUG
-    vm->allocated = 0;
-    markall(vm);
-    ptrvalue_t **head = &vm->head;
-    while (*head != NULL) {
-        if (!((*head)->gcmark)) {
-            ptrvalue_t *not_found = *head;
-            *head = not_found->next;
-            ptr_free(vm, not_found);
-        } else {
-            (*head)->gcmark = false;
-            vm->allocated += vm_size(vm, PTR_VAL(*head));
-            head = &(*head)->next;
+    if (AS_PTR(val) == NULL) {
+        error_runtime(m->vm, "|GC: Cannot mark a NULL!");
+        return;
+    }
+#if THREADS
+    if (m->shared) {
+        // another thread may be marking it right now
+        if (pool_val_marked_shared(val)) {
+            return;
+        }
+        if (!marker_reserve(m, 1)) {
+            m->overflow = true;
+            return;
         }
+        if (!pool_val_mark_shared(val)) {
+            return;
+        }
+        m->marked += vm_size(m->vm, val);
+        m->gray[m->num_gray++] = val;
+        return;
     }
-    vm->gc_threshold = vm->allocated * (1 + vm->config.heap_growth);
-    if (vm->gc_threshold < vm->config.heap_size_min) {
-        vm->gc_threshold = vm->config.heap_size_min;
+#endif  // THREADS
+    if (pool_val_marked(val)) {
+        return;
     }
-#if DEBUG
-    double time_delta = ((double) clock() / CLOCKS_PER_SEC) - time_start;
-    fprintf(stdout, "GC finished: %zuB previously, %zuB now (%zuB gc'd), "
-                    "new threshold at %zuB! Time delta: %.3lfs.\n",
-            allocated_prev, vm->allocated, (allocated_prev - vm->allocated),
-            vm->gc_threshold, time_delta);
-#endif  // DEBUG
+    if (!marker_reserve(m, 1)) {
+        // left unmarked, markall will find it later
+        m->overflow = true;
+        return;
+    }
+    if (IS_CONS(val)) {
+        pool_cons_mark(AS_CONS(val));
+    } else {
+        pool_mark(AS_PTR(val));
+    }
+    m->marked += vm_size(m->vm, val);
+    m->gray[m->num_gray++] = val;
 }
 
-/* *** ENV *** */
+// Marks the references of the marked values until the mark stack is empty
+static void trace(marker_t *m) {
+    while (m->num_gray > 0) {
+        mark_refs(m, m->gray[--m->num_gray]);
+    }
+}
 
-// Adds a variable (pair of symbol and its value) to the env. frame
-void variable_add(vm_t *vm, env_t *env, symbol_t *sym, value_t val) {
-    value_t pair = cons_fn(vm, PTR_VAL(sym), val);  // (sym . val)
-    value_t temp = cons_fn(vm, pair, env->variables);
-    env->variables = temp;
+#if CONSERVATIVE
+
+// Marks the value <word> points into if it looks like it does
+static void mark_word(marker_t *m, uintptr_t word) {
+    value_t val;
+    if (pool_find(m->vm, word, &val)) {
+        mark(m, val);
+    }
+#if NANTAG
+    // a value kept in a local
+    if (IS_PTR((value_t) word) &&
+        pool_find(m->vm, (uintptr_t) AS_CONS((value_t) word), &val)) {
+        mark(m, val);
+    }
+#endif  // NANTAG
 }
 
-// Creates a new env frame
-env_t *env_push(vm_t *vm, env_t *env, value_t vars, value_t vals) {
-    value_t alist = NIL_VAL;
-    value_t vars_iter, vals_iter;
+// Marks everything the native stack and the registers may point to
+// (the stack is scanned from here down to the bottom - eval)
+#if defined(__GNUC__)
+__attribute__((noinline, no_sanitize_address))
+#endif
+static void mark_native(marker_t *m) {
+    vm_t *vm = m->vm;
+    if (vm->native_base == NULL) {
+        return;
+    }
+    if (!pool_index(vm)) {
+        error_runtime(vm, "Can't index the heap to scan the native stack!");
+        abort();
+    }
+    // the registers are spilled to the stack
+    jmp_buf regs;
+    setjmp(regs);
+    uintptr_t addr = (uintptr_t) &regs & ~(uintptr_t) (sizeof(void *) - 1);
+    for (; addr + sizeof(void *) <= (uintptr_t) vm->native_base;
+         addr += sizeof(void *)) {
+        mark_word(m, *(volatile uintptr_t *) addr);
+    }
+}
+
+#endif  // CONSERVATIVE
 
-    // TODO: should we create a macro - like SCM_ASSOC_FOREACH?
-    for (vars_iter = vars, vals_iter = vals; IS_CONS(vars_iter);
-         vars_iter = AS_CONS(vars_iter)->cdr,
-        vals_iter = AS_CONS(vals_iter)->cdr) {
-        if (!IS_CONS(vals_iter)) {
-            // TODO: Add proper function arity?
-            error_runtime(vm, "Number of arguments doesn't match!");
+// Marks the stack slots from the position <*from> up to <to> (at most
+// the top) until it's <deadline> (0 is none), <*from> is moved past them
+// Returns the number of slots it marked
+static size_t mark_slots(vm_t *vm, size_t *from, size_t to, double deadline) {
+    if (*from >= to) {
+        return 0;
+    }
+    stack_segment_t *segment = vm->segment;
+    while (segment->offset > *from) {
+        segment = segment->prev;
+    }
+    size_t count = 0;
+    for (;;) {
+        value_t *top = segment == vm->segment ? vm->stack_top : segment->top;
+        value_t *slot = segment->slots + (*from - segment->offset);
+        value_t *end = to - segment->offset < (size_t) (top - segment->slots)
+                           ? segment->slots + (to - segment->offset)
+                           : top;
+        for (; slot < end; slot++) {
+            mark(&vm->marker, *slot);
+            if (++count % GC_STEP_CHECK == 0 && deadline != 0 &&
+                gc_clock() >= deadline) {
+                *from = stack_position(segment, slot + 1);
+                return count;
+            }
         }
+        // the rest of the segment isn't used
+        if (segment == vm->segment ||
+            to <= segment->offset + STACK_SEGMENT_SIZE) {
+            break;
+        }
+        segment = segment->next;
+        *from = segment->offset;
+    }
+    *from = to;
+    return count;
+}
 
-        value_t par = AS_CONS(vars_iter)->car;
-        value_t arg = AS_CONS(vals_iter)->car;
+// The same for the frames from <*from> up to <to>
+static size_t mark_frames(vm_t *vm, size_t *from, size_t to, double deadline) {
+    size_t count = 0;
+    for (; *from < to; (*from)++) {
+        frame_t *frame = &vm->frames[*from];
+        if (frame->code != NULL) {
+            mark(&vm->marker, PTR_VAL(frame->code));
+        }
+        mark(&vm->marker, PTR_VAL(frame->env));
+        mark(&vm->marker, frame->rest);
+        if (++count % GC_STEP_CHECK == 0 && deadline != 0 &&
+            gc_clock() >= deadline) {
+            (*from)++;
+            break;
+        }
+    }
+    return count;
+}
 
-        value_t pair = cons_fn(vm, par, arg);
-        value_t temp = cons_fn(vm, pair, alist);
+// Finds the lowest stack slot <*from> and frame <*from_frame> which may
+// have changed since vm->stack_old and vm->frames_old were set
+// (see mark_stack)
+static void stack_changed(vm_t *vm, size_t *from, size_t *from_frame) {
+    *from = 0;
+    *from_frame = 0;
+    // C code may write to any slot if there is no frame
+    if (vm->num_frames > 0) {
+        frame_t *innermost = &vm->frames[vm->num_frames - 1];
+        *from = vm->stack_old < innermost->position ? vm->stack_old
+                                                    : innermost->position;
+        *from_frame = vm->frames_old < vm->num_frames - 1
+                          ? vm->frames_old
+                          : vm->num_frames - 1;
+    }
+}
 
-        alist = temp;
+// Marks the values on the stack and the call frames
+//
+// A minor collection skips the slots and frames which didn't change
+// since the last collection (see vm->stack_old), so that deep recursion
+// isn't scanned again and again. C code writes only to the slots it
+// pushed itself, which are above the innermost frame, and only
+// the innermost frame changes - the one below may have changed when
+// a frame is pushed (see vm_push_frame). Popping values lowers
+// vm->stack_old (see vm_stack_restore) unless the innermost frame does it.
+// The end of an incremental collection skips the ones which didn't
+// change since its steps marked them (see gc_scan).
+static void mark_stack(vm_t *vm) {
+    size_t from, from_frame;
+    stack_changed(vm, &from, &from_frame);
+    if (vm->gc_scanned < from) {
+        from = vm->gc_scanned;
+    }
+    if (vm->gc_frames_scanned < from_frame) {
+        from_frame = vm->gc_frames_scanned;
     }
-    if (!IS_NIL(vars_iter)) {
-        value_t pair = cons_fn(vm, vars_iter, vals_iter);
-        value_t temp = cons_fn(vm, pair, alist);
 
-        alist = temp;
+    size_t count =
+        mark_slots(vm, &from, stack_position(vm->segment, vm->stack_top), 0);
+    count += mark_frames(vm, &from_frame, vm->num_frames, 0);
+    if (vm->gc_minor) {
+        vm->gc_stats.minor_scanned += count;
     }
-    env_t *new_env = env_new(vm, alist, env);
-    return new_env;
 }
 
-void primitive_add(vm_t *vm, env_t *env, const char *name, size_t len,
-                   primitive_fn fn) {
-    symbol_t *sym = symbol_intern(vm, name, len);
+// Marks the roots which aren't on the stack
+static void mark_globals(vm_t *vm) {
+    marker_t *m = &vm->marker;
+    if (vm->env != NULL) {
+        mark(m, PTR_VAL(vm->env));
+    }
 
-    primitive_t *prim = primitive_new(vm, fn);
+    if (vm->reader != NULL) {
+        mark(m, vm->reader->tokval);
+    }
 
-    prim->name = sym;
+    if (vm->top_env != NULL) {
+        mark(m, PTR_VAL(vm->top_env));
+    }
 
-    variable_add(vm, env, sym, PTR_VAL(prim));
-}
+    for (size_t i = 0; i < vm->num_regs; i++) {
+        mark(m, vm->regs[i]);
+    }
 
-/* *** EVAL/APPLY *** */
+    mark(m, vm->curval);
 
-// Applies <func> in <env> to <args>
-static value_t apply_func(vm_t *vm, env_t *env, function_t *func,
-                          value_t args) {
-    value_t params = func->params;
-    env_t *new_env = func->env;
-    new_env = env_push(vm, new_env, params, args);
-    value_t body = func->body;
-    return begin(vm, new_env, body);
-}
+    // the finalizers are kept alive, the values only when they're queued
+    for (size_t i = 0; i < vm->num_finalizers; i += 2) {
+        mark(m, vm->finalizers[i + 1]);
+    }
+    for (size_t i = 0; i < vm->num_finalize; i++) {
+        mark(m, vm->finalize[i]);
+    }
 
-// Tries to apply the value <fn> in <env> to <args>
-value_t apply(vm_t *vm, env_t *env, value_t fn, value_t args) {
-    if (!IS_NIL(args) && !IS_CONS(args)) {
-        error_runtime(vm, "|apply: Cannot apply to a non-list!");
-        return NIL_VAL;
+    // collections don't trace permanent values
+    for (size_t i = 0; i < vm->num_permanent_refs; i++) {
+        mark_refs(m, vm->permanent_refs[i]);
     }
-    if (IS_PRIMITIVE(fn)) {
-        primitive_t *prim = AS_PRIMITIVE(fn);
-        return prim->fn(vm, env, args);
-    } else if (IS_FUNCTION(fn)) {
-        function_t *func = AS_FUNCTION(fn);
-        value_t eargs = eval_list(vm, env, args);
-        if (IS_PTR(eargs)) {
-            vm_push_temp(vm, AS_PTR(eargs));
-        }
-        value_t result = apply_func(vm, env, func, eargs);
-        if (IS_PTR(eargs)) {
-            vm_pop_temp(vm);  // eargs
+
+    // old values pointing to young ones are roots of a minor collection
+    if (vm->gc_minor) {
+        for (size_t i = 0; i < vm->num_remembered; i++) {
+            mark_refs(m, vm->remembered[i]);
         }
-        return result;
     }
+}
 
-    error_runtime(vm, "|apply: Cannot apply something else than a procedure!");
-    return NIL_VAL;
+// Marks the roots
+static void mark_roots(vm_t *vm) {
+#if CONSERVATIVE
+    mark_native(&vm->marker);
+#endif  // CONSERVATIVE
+    mark_globals(vm);
+    mark_stack(vm);
 }
 
-// Tries to find <sym> in <env>
-// Returns `undefined` if not found
-value_t find(env_t *env, symbol_t *sym) {
-    for (env_t *e = env; e != NULL; e = e->up) {
-        if (IS_NIL(e->variables)) {
-            // we're not going to find anything here, let's move on
+#if THREADS
+
+// Parallel marking (config.gc_threads > 1)
+//
+// Every thread marks values from its own mark stack. A thread with
+// a lot of gray values moves some of them to its loot, where the threads
+// without any can steal them. Marking ends when all threads are idle.
+
+// the number of gray values in a loot
+#define LOOT_SIZE 32
+
+// A thread marking values
+typedef struct {
+    marker_t marker;
+    pthread_t thread;
+    bool started;
+
+    // gray values the other threads can take (guarded by <lock>)
+    pthread_mutex_t lock;
+    value_t loot[LOOT_SIZE];
+    size_t num_loot;
+} gc_worker_t;
+
+typedef struct {
+    gc_worker_t *workers;
+    unsigned count;
+    // the number of threads without any gray values
+    unsigned idle;
+} gc_workers_t;
+
+typedef struct {
+    gc_workers_t *all;
+    gc_worker_t *worker;
+} gc_worker_arg_t;
+
+// Moves some gray values of <worker> to its loot
+static void worker_share(gc_worker_t *worker) {
+    marker_t *m = &worker->marker;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->num_loot == 0) {
+        m->num_gray -= LOOT_SIZE;
+        memcpy(worker->loot, m->gray + m->num_gray, sizeof(worker->loot));
+        __atomic_store_n(&worker->num_loot, LOOT_SIZE, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&worker->lock);
+}
+
+// Takes the loot of some thread (maybe its own) for <worker>
+// Returns false if there is none
+static bool worker_steal(gc_workers_t *all, gc_worker_t *worker) {
+    marker_t *m = &worker->marker;
+    for (unsigned i = 0; i < all->count; i++) {
+        gc_worker_t *victim = &all->workers[i];
+        if (__atomic_load_n(&victim->num_loot, __ATOMIC_ACQUIRE) == 0) {
             continue;
         }
-        value_t pair, iter;
-        SCM_FOREACH (pair, AS_CONS(e->variables), iter) {
-            symbol_t *key = AS_SYMBOL(AS_CONS(pair)->car);
-            if (key == sym) {
-                return AS_CONS(pair)->cdr;
-            }
+        pthread_mutex_lock(&victim->lock);
+        size_t n = victim->num_loot;
+        if (n > 0 && !marker_reserve(m, n)) {
+            // the values stay marked, markall will mark their references
+            m->overflow = true;
+        } else if (n > 0) {
+            memcpy(m->gray + m->num_gray, victim->loot, sizeof(value_t) * n);
+            m->num_gray += n;
+        }
+        __atomic_store_n(&victim->num_loot, 0, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&victim->lock);
+        if (n > 0) {
+            return true;
         }
     }
+    return false;
+}
 
-    fprintf(stderr, "|find: Error: Symbol %s not bound\n", sym->name);
-    // error_runtime(vm, "|find: Symbol %s is not bound in environment!",
-    // sym->name);
-    return UNDEFINED_VAL;
+// Returns true if there is a loot to steal
+static bool workers_have_loot(gc_workers_t *all) {
+    for (unsigned i = 0; i < all->count; i++) {
+        if (__atomic_load_n(&all->workers[i].num_loot, __ATOMIC_ACQUIRE) > 0) {
+            return true;
+        }
+    }
+    return false;
 }
 
-// Tries to find <sym> in <env> and replace it's val with <new_val>
-// Returns `undefined` if not found
-// TODO: this is maybe unnecessary duplication with 'find' above?
-value_t find_replace(env_t *env, symbol_t *sym, value_t new_val) {
-    for (env_t *e = env; e != NULL; e = e->up) {
-        if (IS_NIL(e->variables)) {
-            // we're not going to find anything here, let's move on
+static void *worker_run(void *data) {
+    gc_worker_arg_t *arg = (gc_worker_arg_t *) data;
+    gc_workers_t *all = arg->all;
+    gc_worker_t *worker = arg->worker;
+    marker_t *m = &worker->marker;
+
+    for (;;) {
+        while (m->num_gray > 0) {
+            mark_refs(m, m->gray[--m->num_gray]);
+            if (m->num_gray >= 2 * LOOT_SIZE &&
+                __atomic_load_n(&worker->num_loot, __ATOMIC_RELAXED) == 0) {
+                worker_share(worker);
+            }
+        }
+        if (worker_steal(all, worker)) {
             continue;
         }
-        value_t pair, iter;
-        SCM_FOREACH (pair, AS_CONS(e->variables), iter) {
-            symbol_t *key = AS_SYMBOL(AS_CONS(pair)->car);
-            if (key == sym) {
-                AS_CONS(pair)->cdr = new_val;
-                return new_val;
+
+        // only a thread which isn't idle can share gray values,
+        // so if all of them are idle, there are no gray values left
+        __atomic_add_fetch(&all->idle, 1, __ATOMIC_ACQ_REL);
+        for (;;) {
+            if (__atomic_load_n(&all->idle, __ATOMIC_ACQUIRE) == all->count) {
+                return NULL;
             }
+            if (workers_have_loot(all)) {
+                __atomic_sub_fetch(&all->idle, 1, __ATOMIC_ACQ_REL);
+                break;
+            }
+            sched_yield();
         }
     }
-
-    fprintf(stderr, "|find-replace: Error: Symbol %s not bound\n", sym->name);
-    // error_runtime(vm, "|find: Symbol %s is not bound in environment!",
-    // sym->name);
-    return UNDEFINED_VAL;
 }
 
-// Evaluates all members of list and returns their return values as a list
-value_t eval_list(vm_t *vm, env_t *env, value_t list) {
-    if (IS_NIL(list)) {
-        return NIL_VAL;
+// Marks the references of the gray values of vm->marker
+// with config.gc_threads threads (the current one is one of them)
+static void trace_parallel(vm_t *vm) {
+    gc_workers_t all;
+    all.count = vm->config.gc_threads;
+    all.idle = 0;
+    all.workers = (gc_worker_t *) vm->config.realloc_fn(
+        NULL, sizeof(gc_worker_t) * all.count);
+    gc_worker_arg_t *args = (gc_worker_arg_t *) vm->config.realloc_fn(
+        NULL, sizeof(gc_worker_arg_t) * all.count);
+    if (all.workers == NULL || args == NULL) {
+        vm->config.realloc_fn(all.workers, 0);
+        vm->config.realloc_fn(args, 0);
+        trace(&vm->marker);
+        return;
     }
-    cons_t *head = NULL;
-    cons_t *tail = NULL;
 
-    for (cons_t *cons = AS_CONS(list);; cons = AS_CONS(cons->cdr)) {
-        value_t temp = eval(vm, env, cons->car);
-        if (head == NULL) {
-            head = tail = AS_CONS(cons_fn(vm, temp, NIL_VAL));
-            vm_push_temp(vm, (ptrvalue_t *) (head));
+    for (unsigned i = 0; i < all.count; i++) {
+        gc_worker_t *worker = &all.workers[i];
+        worker->marker = vm->marker;
+        worker->marker.shared = true;
+        worker->marker.marked = 0;
+        if (i > 0) {
+            worker->marker.gray = NULL;
+            worker->marker.num_gray = 0;
+            worker->marker.gray_capacity = 0;
+        }
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->num_loot = 0;
+        worker->started = false;
+        args[i].all = &all;
+        args[i].worker = worker;
+    }
+    // the roots are on the mark stack of the current thread
+    // and the others steal them from there
+    for (unsigned i = 1; i < all.count; i++) {
+        if (pthread_create(&all.workers[i].thread, NULL, worker_run,
+                           &args[i]) == 0) {
+            all.workers[i].started = true;
         } else {
-            tail->cdr = cons_fn(vm, temp, NIL_VAL);
-            tail = AS_CONS(tail->cdr);
+            // the threads which couldn't start are idle from the beginning
+            __atomic_add_fetch(&all.idle, 1, __ATOMIC_ACQ_REL);
         }
-        if (IS_NIL(cons->cdr)) {
-            break;
+    }
+    worker_run(&args[0]);
+
+    vm->marker.gray = all.workers[0].marker.gray;
+    vm->marker.gray_capacity = all.workers[0].marker.gray_capacity;
+    vm->marker.num_gray = 0;
+    for (unsigned i = 0; i < all.count; i++) {
+        gc_worker_t *worker = &all.workers[i];
+        if (worker->started) {
+            pthread_join(worker->thread, NULL);
         }
+        if (i > 0) {
+            vm->config.realloc_fn(worker->marker.gray, 0);
+        }
+        vm->marker.marked += worker->marker.marked;
+        vm->marker.overflow |= worker->marker.overflow;
+        pthread_mutex_destroy(&worker->lock);
     }
-    vm_pop_temp(vm);  // head
-    return PTR_VAL(head);
+    vm->config.realloc_fn(all.workers, 0);
+    vm->config.realloc_fn(args, 0);
 }
 
-// Evaluates the value <val>
-// Returns `undefined` if symbol not found
-value_t eval(vm_t *vm, env_t *env, value_t val) {
-    if (IS_VAL(val) || IS_STRING(val) || IS_PROCEDURE(val) || IS_VECTOR(val) ||
-        IS_ENV(val)) {
-        // These values are self evaluating
-        return val;
-    } else if (IS_SYMBOL(val)) {
-        // This is a variable
-        symbol_t *sym = AS_SYMBOL(val);
-        value_t result = find(env, sym);
-        if (IS_UNDEFINED(result)) {
-            error_runtime(vm, "|eval: Can't eval %s - symbol not bound!",
-                          sym->name);
-        }
-        return result;
-    } else if (IS_CONS(val)) {
-        // It's a function application
-        value_t expanded = expand(vm, env, val);
+#endif  // THREADS
+
+// Marks the references of the marked value <val>
+static void mark_refs_traced(vm_t *vm, value_t val) {
+    mark_refs(&vm->marker, val);
+    trace(&vm->marker);
+}
+
+// Marks the gray values and everything they point to
+static void trace_all(vm_t *vm) {
+    trace(&vm->marker);
+    // if the mark stack couldn't grow, some values were left unmarked,
+    // but they are all referenced by roots or by marked values
+    // (a minor collection keeps everything old values point to then)
+    while (vm->marker.overflow) {
+        vm->marker.overflow = false;
+        // the values of all slots may have been left unmarked
+        vm->gc_scanned = 0;
+        vm->gc_frames_scanned = 0;
+        mark_roots(vm);
+        trace(&vm->marker);
+        pool_each_marked(vm, mark_refs_traced);
+    }
+}
+
+static void markall(vm_t *vm) {
+    mark_roots(vm);
+#if THREADS
+    if (!vm->gc_minor && vm->config.gc_threads > 1) {
+        trace_parallel(vm);
+    }
+#endif  // THREADS
+    trace_all(vm);
+    gc_weak(vm);
+}
+
+void vm_shade(vm_t *vm, value_t val) {
+    mark(&vm->marker, val);
+}
 
-        if (!IS_EQ(expanded, val)) {
-            // macros encountered and expanded, now eval the expanded value
-            return eval(vm, env, expanded);
+// Sets the flag of <val> telling that it's in the remembered set
+static void remembered_set(value_t val, bool remembered) {
+    if (IS_CONS(val)) {
+        cons_t *cons = AS_CONS(val);
+        if (remembered) {
+            pool_set_bit(pool_cons_page(cons)->remembered, cons);
+        } else {
+            pool_clear_bit(pool_cons_page(cons)->remembered, cons);
         }
+    } else {
+        AS_PTR(val)->remembered = remembered;
+    }
+}
 
+static bool remembered_get(value_t val) {
+    if (IS_CONS(val)) {
         cons_t *cons = AS_CONS(val);
-        value_t fn = eval(vm, env, cons->car);
-        value_t args = cons->cdr;
+        return pool_bit(pool_cons_page(cons)->remembered, cons);
+    }
+    return AS_PTR(val)->remembered;
+}
 
-        if (!IS_PROCEDURE(fn)) {
-            error_runtime(vm, "|eval: Car of eval'd cons is not a procedure!");
+// Adds <val> to the set <*values> of <*num> values
+// Returns false if it can't grow
+static bool values_push(vm_t *vm, value_t **values, size_t *num,
+                        size_t *capacity, value_t val) {
+    if (*num >= *capacity) {
+        // not vm_realloc, a collection can't start in the middle of a store
+        size_t new_capacity = *capacity ? *capacity * 2 : 64;
+        value_t *new_values = (value_t *) vm->config.realloc_fn(
+            *values, sizeof(value_t) * new_capacity);
+        if (new_values == NULL) {
+            return false;
         }
-        return apply(vm, env, fn, args);
+        *values = new_values;
+        *capacity = new_capacity;
     }
-
-    // This should be an assert
-    error_runtime(vm, "|eval: Cannot eval - unknown value type!");
-    return NIL_VAL;
+    (*values)[(*num)++] = val;
+    return true;
 }
 
-// Evaluates expressions in order, returns the last evaluated
-// or #<void> if <val> is empty (NIL)
-value_t begin(vm_t *vm, env_t *env, value_t val) {
-    value_t result = VOID_VAL;
-    if (IS_NIL(val)) {
-        return result;
+void vm_remember(vm_t *vm, value_t val) {
+    if (!values_push(vm, &vm->remembered, &vm->num_remembered,
+                     &vm->remembered_capacity, val)) {
+        error_runtime(vm, "Can't grow the remembered set!");
+        return;
     }
+    remembered_set(val, true);
+}
+
+// A permanent value pointing to another one stays in vm->permanent_refs
+// (its remembered flag tells that it's there). They are roots, so they're
+// marked again at the end of an incremental collection too.
+void vm_permanent_barrier(vm_t *vm, value_t owner, value_t val) {
+    if (pool_val_permanent(val)) {
+        return;
+    }
+    if (!remembered_get(owner)) {
+        if (!values_push(vm, &vm->permanent_refs, &vm->num_permanent_refs,
+                         &vm->permanent_refs_capacity, owner)) {
+            error_runtime(vm, "Can't grow the remembered set!");
+            return;
+        }
+        remembered_set(owner, true);
+    }
+}
+
+// Weak boxes and weak hash tables are added to vm->weak when they're made.
+// Marking doesn't follow their weak references (see mark_refs),
+// they're cleared when it's done (see gc_weak):
+// - a value with a weak key is marked if its key is, until no more
+//   of them get marked (an ephemeron - a value pointing back to its key
+//   doesn't keep the entry alive)
+// - unmarked values with a finalizer are queued with it and marked again
+//   with everything they point to (see vm_finalize)
+// - the weak references to unmarked values are cleared
+//   (the entries of hash tables are removed)
+// A minor collection only goes through the young ones and the remembered
+// ones, the rest can only point to old values, which stay marked.
+
+bool vm_weak_add(vm_t *vm, value_t val) {
+    if (!values_push(vm, &vm->weak, &vm->num_weak, &vm->weak_capacity, val)) {
+        error_runtime(vm, "Can't grow the set of weak references!");
+        return false;
+    }
+    return true;
+}
+
+bool vm_finalizer_add(vm_t *vm, value_t val, value_t fn) {
+    if (!values_push(vm, &vm->finalizers, &vm->num_finalizers,
+                     &vm->finalizers_capacity, val)) {
+        error_runtime(vm, "Can't grow the set of finalizers!");
+        return false;
+    }
+    if (!values_push(vm, &vm->finalizers, &vm->num_finalizers,
+                     &vm->finalizers_capacity, fn)) {
+        vm->num_finalizers--;
+        error_runtime(vm, "Can't grow the set of finalizers!");
+        return false;
+    }
+    return true;
+}
+
+size_t vm_finalize(vm_t *vm, env_t *env) {
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 2)) {
+        return 0;
+    }
+    // the value and its finalizer are kept on the stack while it runs
+    value_t *slots = vm->stack_top;
+    vm->stack_top += 2;
+
+    size_t count = 0;
+    while (vm->num_finalize > 0) {
+        vm->num_finalize -= 2;
+        slots[0] = vm->finalize[vm->num_finalize];
+        slots[1] = vm->finalize[vm->num_finalize + 1];
+        call(vm, env, slots[1], 1, slots);
+        count++;
+    }
+    vm_stack_restore(vm, top);
+    return count;
+}
+
+// Returns true if a weak reference to <val> stays
+static inline bool weak_alive(value_t val) {
+    return IS_VAL(val) || pool_val_marked(val);
+}
+
+// Returns true if the weak box or table vm->weak[<i>] may point
+// to values freed by this collection
+static bool weak_visited(vm_t *vm, size_t i) {
+    return !vm->gc_minor || i >= vm->num_weak_old ||
+           remembered_get(vm->weak[i]);
+}
+
+// Marks the values of the marked tables with weak keys whose keys are
+// marked, returns true if it marked any
+static bool weak_mark_ephemerons(vm_t *vm) {
+    bool marked = false;
+    for (size_t i = 0; i < vm->num_weak; i++) {
+        value_t val = vm->weak[i];
+        if (!IS_HASHTABLE(val) || !pool_val_marked(val) ||
+            !weak_visited(vm, i)) {
+            continue;
+        }
+        hashtable_t *ht = AS_HASHTABLE(val);
+        if (ht->weak != HASHTABLE_WEAK_KEYS) {
+            continue;
+        }
+        for (uint32_t j = 0; j < ht->capacity; j++) {
+            hashtable_entry_t *entry = &ht->entries[j];
+            if (weak_alive(entry->key) && !weak_alive(entry->value)) {
+                mark(&vm->marker, entry->value);
+                // (it isn't marked if the mark stack can't grow)
+                marked |= weak_alive(entry->value);
+            }
+        }
+    }
+    return marked;
+}
+
+// Marks the values with weak keys which are still reachable
+static void weak_trace(vm_t *vm) {
+    while (weak_mark_ephemerons(vm)) {
+        trace_all(vm);
+    }
+}
+
+// Queues the unmarked values with a finalizer and marks them again
+static void weak_finalize(vm_t *vm) {
+    size_t queued = vm->num_finalize;
+    size_t kept = 0;
+    for (size_t i = 0; i < vm->num_finalizers; i += 2) {
+        value_t val = vm->finalizers[i];
+        value_t fn = vm->finalizers[i + 1];
+        if (!weak_alive(val) &&
+            values_push(vm, &vm->finalize, &vm->num_finalize,
+                        &vm->finalize_capacity, val)) {
+            if (values_push(vm, &vm->finalize, &vm->num_finalize,
+                            &vm->finalize_capacity, fn)) {
+                continue;
+            }
+            vm->num_finalize--;
+        }
+        // (it's kept for the next collection if it can't be queued)
+        vm->finalizers[kept++] = val;
+        vm->finalizers[kept++] = fn;
+    }
+    vm->num_finalizers = kept;
+
+    // all of them are found first, so that a value reachable only
+    // from another one being finalized gets finalized too
+    if (vm->num_finalize > queued) {
+        for (size_t i = queued; i < vm->num_finalize; i++) {
+            mark(&vm->marker, vm->finalize[i]);
+        }
+        trace_all(vm);
+        weak_trace(vm);
+    }
+}
+
+// Clears the weak references of the weak box or table <val>
+// to unmarked values
+static void weak_clear(value_t val) {
+    if (IS_WEAKBOX(val)) {
+        weakbox_t *box = AS_WEAKBOX(val);
+        if (!weak_alive(box->value)) {
+            box->value = FALSE_VAL;
+        }
+        return;
+    }
+    hashtable_t *ht = AS_HASHTABLE(val);
+    for (uint32_t i = 0; i < ht->capacity; i++) {
+        hashtable_entry_t *entry = &ht->entries[i];
+        if (IS_UNDEFINED(entry->key)) {
+            continue;
+        }
+        // (an unmarked value with a marked key is there only
+        // if the mark stack couldn't grow, the value is freed anyway)
+        if (!weak_alive(entry->key) || !weak_alive(entry->value)) {
+            // the entry becomes a tombstone
+            entry->key = UNDEFINED_VAL;
+            entry->value = TRUE_VAL;
+            ht->count--;
+            ht->tombstones++;
+        }
+    }
+}
+
+// Ends marking with the weak references (see vm_weak_add)
+static void gc_weak(vm_t *vm) {
+    weak_trace(vm);
+    weak_finalize(vm);
+
+    // the unmarked boxes and tables are garbage
+    size_t kept = 0;
+    for (size_t i = 0; i < vm->num_weak; i++) {
+        value_t val = vm->weak[i];
+        if (!pool_val_marked(val)) {
+            continue;
+        }
+        if (weak_visited(vm, i)) {
+            weak_clear(val);
+        }
+        vm->weak[kept++] = val;
+    }
+    vm->num_weak = kept;
+    vm->num_weak_old = kept;
+}
+
+// Empties the remembered set
+// (after a collection there are no young values left)
+static void forget_all(vm_t *vm) {
+    for (size_t i = 0; i < vm->num_remembered; i++) {
+        remembered_set(vm->remembered[i], false);
+    }
+    vm->num_remembered = 0;
+}
+
+size_t vm_size(vm_t *vm, value_t val) {
+    if (IS_VAL(val)) {
+        return 0;
+    }
+    if (IS_CONS(val)) {
+        return sizeof(cons_t);
+    }
+    size_t size = ptr_size(AS_PTR(val));
+    if (IS_VECTOR(val)) {
+        size += sizeof(value_t) * AS_VECTOR(val)->capacity;
+    } else if (IS_ENV(val)) {
+        size += sizeof(variable_t) * AS_ENV(val)->variables_capacity;
+    } else if (IS_CODE(val)) {
+        code_t *code = AS_CODE(val);
+        size += sizeof(uint8_t) * code->capacity +
+                sizeof(value_t) * code->constants_capacity;
+    } else if (IS_HASHTABLE(val)) {
+        size += sizeof(hashtable_entry_t) * AS_HASHTABLE(val)->capacity;
+    }
+    return size;
+}
+
+// Returns how much the program can allocate at <fraction> of the time
+// spent in the GC, if the next cycle is like the last one
+//
+// The minor collections take the same share of the time
+// and the major one takes as long (it marks the same live values).
+static double pace_headroom(gc_pacer_t *pacer, double fraction) {
+    double minor_share = pacer->minor_time / pacer->run_time;
+    double left = fraction * (1 + minor_share) - minor_share;
+    if (left <= 0) {
+        // the minor collections alone take more than that
+        return HUGE_VAL;
+    }
+    double run_time = pacer->major_time * (1 - fraction) / left;
+    return (double) pacer->allocated / pacer->run_time * run_time;
+}
+
+// Sets the threshold of the next major collection when one ended
+//
+// The heap grows by config.heap_growth of the live values, or with
+// config.gc_cpu_fraction, by what the program allocates in the time
+// it should run until the next one. It doesn't grow over
+// config.heap_size_soft_max (or three quarters of config.heap_size_max)
+// unless the GC would take more than half of the time then.
+static void gc_pace(vm_t *vm) {
+    gc_pacer_t *pacer = &vm->gc_pacer;
+    size_t live = vm->marker.marked;
+    double fraction = vm->config.gc_cpu_fraction;
+    bool measured = pacer->run_time > 0 && pacer->major_time > 0;
+    double headroom = (double) live * vm->config.heap_growth;
+    if (fraction > 0 && fraction < 1 && measured) {
+        headroom = pace_headroom(pacer, fraction);
+    }
+    size_t max = vm->config.heap_size_soft_max;
+    if (max > 0 && (double) live + headroom > (double) max) {
+        headroom = max > live ? (double) (max - live) : 0;
+        if (measured && headroom < pace_headroom(pacer, 0.5)) {
+            headroom = pace_headroom(pacer, 0.5);
+        }
+    }
+    // the major collection should run well before the heap is full,
+    // but not so often that it takes more than half of the time
+    // (an allocation over the limit runs a full one anyway, see heap_full)
+    if (vm->config.heap_size_max > 0) {
+        double full = (double) vm->config.heap_size_max / 4 * 3 -
+                      (double) vm->gc_stats.permanent;
+        if ((double) live + headroom > full) {
+            headroom = full > (double) live ? full - (double) live : 0;
+            if (measured && headroom < pace_headroom(pacer, 0.5)) {
+                headroom = pace_headroom(pacer, 0.5);
+            }
+        }
+    }
+    // the young values have to fit in
+    if (headroom < (double) vm->config.nursery_size) {
+        headroom = (double) vm->config.nursery_size;
+    }
+    if (headroom > (double) (SIZE_MAX / 2)) {
+        headroom = (double) (SIZE_MAX / 2);
+    }
+    vm->gc_threshold = live + (size_t) headroom;
+    if (vm->gc_threshold < vm->config.heap_size_min) {
+        vm->gc_threshold = vm->config.heap_size_min;
+    }
+    // the permanent values are in vm->allocated, but they aren't marked
+    vm->gc_threshold += vm->gc_stats.permanent;
+
+    pacer->run_time = 0;
+    pacer->minor_time = 0;
+    pacer->major_time = 0;
+    pacer->allocated = 0;
+    pacer->finished = false;
+}
+
+// Updates the statistics with a pause which started at <start>
+// and reports it to config.gc_fn
+static void gc_pause_end(vm_t *vm, scm_gc_pause_t pause, double start) {
+    double end = gc_clock();
+    double time = end - start;
+    gc_stats_t *stats = &vm->gc_stats;
+    if (pause == SCM_GC_MINOR) {
+        stats->minor_count++;
+        stats->minor_time += time;
+        if (time > stats->minor_max) stats->minor_max = time;
+    } else if (pause == SCM_GC_MAJOR) {
+        stats->major_count++;
+        stats->major_time += time;
+        if (time > stats->major_max) stats->major_max = time;
+    } else {
+        stats->step_count++;
+        stats->step_time += time;
+        if (time > stats->step_max) stats->step_max = time;
+    }
+    gc_pacer_t *pacer = &vm->gc_pacer;
+    pacer->run_time += start - pacer->pause_end;
+    if (pause == SCM_GC_MINOR) {
+        pacer->minor_time += time;
+    } else {
+        pacer->major_time += time;
+    }
+    pacer->pause_end = end;
+    if (pacer->finished) {
+        gc_pace(vm);
+    }
+    if (vm->config.gc_fn != NULL) {
+        vm->config.gc_fn(vm, pause, time);
+    }
+}
+
+// The sweeper thread (config.gc_sweep_thread) sweeps the pages left
+// after a collection while the VM runs. It claims a page before sweeping
+// it like the allocator does, so the VM waits only if it needs a page
+// the thread is sweeping right now (see pool_sweep_shared).
+// It's paused during collections, they need the marks to stay the same.
+
+#if THREADS
+
+static void *sweeper_run(void *data) {
+    vm_t *vm = (vm_t *) data;
+    sweeper_t *sweeper = &vm->sweeper;
+    pthread_mutex_lock(&sweeper->lock);
+    for (;;) {
+        while (!sweeper->quit && !sweeper->work) {
+            pthread_cond_wait(&sweeper->wake, &sweeper->lock);
+        }
+        if (sweeper->quit) {
+            break;
+        }
+        sweeper->running = true;
+        pthread_mutex_unlock(&sweeper->lock);
+
+        // a page at a time, so that a pause doesn't wait long
+        size_t freed = 0;
+        while (__atomic_load_n(&sweeper->work, __ATOMIC_RELAXED) &&
+               pool_sweep_shared(vm, &freed)) {
+            __atomic_fetch_add(&sweeper->freed, freed, __ATOMIC_RELAXED);
+            freed = 0;
+        }
+
+        pthread_mutex_lock(&sweeper->lock);
+        sweeper->running = false;
+        // everything is swept (or it was paused)
+        sweeper->work = false;
+        pthread_cond_signal(&sweeper->idle);
+    }
+    pthread_mutex_unlock(&sweeper->lock);
+    return NULL;
+}
+
+#endif  // THREADS
+
+static void sweeper_start(vm_t *vm) {
+#if THREADS
+    sweeper_t *sweeper = &vm->sweeper;
+    sweeper->started = false;
+    sweeper->quit = false;
+    sweeper->running = false;
+    sweeper->work = false;
+    sweeper->freed = 0;
+    if (!vm->config.gc_sweep_thread) {
+        return;
+    }
+    pthread_mutex_init(&sweeper->lock, NULL);
+    pthread_cond_init(&sweeper->wake, NULL);
+    pthread_cond_init(&sweeper->idle, NULL);
+    // without the thread the VM just sweeps everything itself
+    if (pthread_create(&sweeper->thread, NULL, sweeper_run, vm) == 0) {
+        sweeper->started = true;
+    } else {
+        pthread_cond_destroy(&sweeper->idle);
+        pthread_cond_destroy(&sweeper->wake);
+        pthread_mutex_destroy(&sweeper->lock);
+    }
+#endif  // THREADS
+}
+
+static void sweeper_stop(vm_t *vm) {
+#if THREADS
+    sweeper_t *sweeper = &vm->sweeper;
+    if (!sweeper->started) {
+        return;
+    }
+    pthread_mutex_lock(&sweeper->lock);
+    sweeper->quit = true;
+    __atomic_store_n(&sweeper->work, false, __ATOMIC_RELAXED);
+    pthread_cond_signal(&sweeper->wake);
+    pthread_mutex_unlock(&sweeper->lock);
+    pthread_join(sweeper->thread, NULL);
+    pthread_cond_destroy(&sweeper->idle);
+    pthread_cond_destroy(&sweeper->wake);
+    pthread_mutex_destroy(&sweeper->lock);
+    sweeper->started = false;
+#endif  // THREADS
+}
+
+// Subtracts the size of the values freed by the sweeper thread
+// from vm->allocated
+static void sweeper_account(vm_t *vm) {
+#if THREADS
+    if (vm->sweeper.started &&
+        __atomic_load_n(&vm->sweeper.freed, __ATOMIC_RELAXED) != 0) {
+        vm->allocated -=
+            __atomic_exchange_n(&vm->sweeper.freed, 0, __ATOMIC_RELAXED);
+    }
+#endif  // THREADS
+}
+
+// Waits until the sweeper thread finishes its page, before a collection
+static void sweeper_pause(vm_t *vm) {
+#if THREADS
+    sweeper_t *sweeper = &vm->sweeper;
+    if (!sweeper->started) {
+        return;
+    }
+    pthread_mutex_lock(&sweeper->lock);
+    __atomic_store_n(&sweeper->work, false, __ATOMIC_RELAXED);
+    while (sweeper->running) {
+        pthread_cond_wait(&sweeper->idle, &sweeper->lock);
+    }
+    pthread_mutex_unlock(&sweeper->lock);
+    sweeper_account(vm);
+#endif  // THREADS
+}
+
+// Lets the sweeper thread sweep the garbage of the last collection
+static void sweeper_resume(vm_t *vm) {
+#if THREADS
+    sweeper_t *sweeper = &vm->sweeper;
+    if (!sweeper->started || vm->gc_phase == GC_UNMARKING ||
+        vm->gc_phase == GC_MARKING) {
+        return;
+    }
+    pthread_mutex_lock(&sweeper->lock);
+    __atomic_store_n(&sweeper->work, true, __ATOMIC_RELAXED);
+    pthread_cond_signal(&sweeper->wake);
+    pthread_mutex_unlock(&sweeper->lock);
+#endif  // THREADS
+}
+
+// Starts counting the young values again
+static void gc_young_reset(vm_t *vm) {
+    vm->gc_pacer.allocated += vm->young_allocated;
+    vm->young_allocated = 0;
+}
+
+// Ends marking, the unmarked values are garbage
+static void gc_marked_all(vm_t *vm, bool minor) {
+    // unmarked symbols are dead, they can't be interned again
+    symbols_unintern_unmarked(vm, minor);
+    // the young values are either garbage or old now
+    forget_all(vm);
+    vm->stack_old = stack_position(vm->segment, vm->stack_top);
+    vm->frames_old = vm->num_frames;
+    vm->gc_scanned = vm->stack_old;
+    vm->gc_frames_scanned = vm->frames_old;
+    pool_sweep_lazily(vm, minor);
+}
+
+// A generational mark and sweep GC (values are never moved)
+//
+// Values are young until they survive a collection, then they are old
+// and stay marked (see pool.h).
+// A minor collection marks only young values reachable from the roots
+// and the remembered set - old values which may point to young ones
+// (the write barrier adds them there). Unmarked young values are garbage.
+// It runs every time config.nursery_size bytes were allocated.
+//
+// A major collection unmarks all values and marks both generations,
+// it runs when the heap grows over vm->gc_threshold.
+//
+// The garbage is swept lazily, a page at a time when the allocator needs
+// space (or by the sweeper thread). The rest is swept before a major
+// collection unmarks everything.
+void vm_gc_minor(vm_t *vm) {
+#if NOGC
+    return;
+#endif  // NOGC
+    double start = gc_clock();
+    sweeper_pause(vm);
+    vm->marker.overflow = false;
+    vm->marker.marked = 0;
+    vm->gc_minor = true;
+    markall(vm);
+    vm->gc_minor = false;
+    vm->gc_stats.promoted += vm->marker.marked;
+    gc_marked_all(vm, true);
+    gc_young_reset(vm);
+    sweeper_resume(vm);
+    gc_pause_end(vm, SCM_GC_MINOR, start);
+}
+
+// If config.gc_step_time is set, a major collection is incremental.
+// It runs in steps taking at most that long, one every GC_STEP_ALLOCATED
+// bytes allocated. The last step of marking has to finish, but the steps
+// before leave it only a few stack slots and values (see gc_rescan),
+// gc-stats tells how many.
+// Minor collections wait until it's done.
+//
+// The garbage of the last collection is swept first (GC_SWEEPING),
+// then all values are unmarked a page at a time (GC_UNMARKING, the empty
+// pages may be given back meanwhile) and marked again (GC_MARKING).
+// It uses the tri-color abstraction: unmarked values are white,
+// marked values on the mark stack are gray and the rest is black.
+// Marking starts with the stack and goes on until there are no gray
+// values. A black value can't point to a white one - the write barrier
+// marks a white value stored into a marked one. Roots aren't watched,
+// so they are marked again in the last step (see gc_remark) - but only
+// the stack slots and frames which changed since the steps marked them
+// (see gc_scan), the other roots are few.
+// Values allocated while marking are white, they survive only if they
+// are reachable at the end - the steps mark them once more if there
+// are many of them (see gc_rescan), so the last step doesn't have to.
+
+// Sweeps the garbage of the last collection until there is none
+// or it's <deadline> (a <deadline> of 0 means none)
+// Returns true if everything was swept
+static bool gc_sweep_until(vm_t *vm, double deadline) {
+    while (pool_sweep_next(vm)) {
+        if (deadline != 0 && gc_clock() >= deadline) {
+            return false;
+        }
+    }
+    sweeper_account(vm);
+    return true;
+}
+
+// Starts unmarking all values (everything is swept)
+static void gc_unmark_start(vm_t *vm) {
+    // the empty pages are given back if the heap stays much bigger
+    // than the threshold (which is about what the program needs)
+    if (vm->num_pages * POOL_PAGE_SIZE > 2 * vm->gc_threshold) {
+        vm->gc_pacer.oversized++;
+    } else {
+        vm->gc_pacer.oversized = 0;
+    }
+    bool release = vm->config.gc_release_after > 0 &&
+                   vm->gc_pacer.oversized >= vm->config.gc_release_after;
+    if (release) {
+        vm->gc_pacer.oversized = 0;
+    }
+    pool_unmark_start(vm, release);
+    vm->gc_phase = GC_UNMARKING;
+}
+
+// Unmarks values (and gives back the empty pages) until there are
+// none left or it's <deadline> (0 is none), returns true if all are unmarked
+static bool gc_unmark_until(vm_t *vm, double deadline) {
+    while (pool_unmark_next(vm, &vm->gc_stats.released)) {
+        // giving a page back to the OS may take a while
+        if (deadline != 0 && gc_clock() >= deadline) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Starts marking (everything is unmarked)
+static void gc_mark_start(vm_t *vm) {
+    vm->gc_phase = GC_MARKING;
+    vm->marker.overflow = false;
+    vm->marker.marked = 0;
+    // the stack is marked from the bottom, the slots which change
+    // meanwhile are marked again at the end (see mark_stack)
+    vm->stack_old = stack_position(vm->segment, vm->stack_top);
+    vm->frames_old = vm->num_frames;
+    vm->gc_scanned = 0;
+    vm->gc_frames_scanned = 0;
+    vm->gc_rescans = 0;
+    vm->gc_rescan_allocated = vm->gc_pacer.allocated + vm->young_allocated;
+}
+
+// Marks the stack slots and the frames up to the top until it's <deadline>
+// Returns true if it got there. The ones which changed since marking
+// started are marked again at the end (see mark_stack), but the values
+// they point to are mostly marked by then - even if the program keeps
+// building a big structure on top of the stack.
+static bool gc_scan(vm_t *vm, double deadline) {
+    size_t to = stack_position(vm->segment, vm->stack_top);
+    mark_slots(vm, &vm->gc_scanned, to, deadline);
+    if (vm->gc_scanned < to || gc_clock() >= deadline) {
+        return false;
+    }
+    mark_frames(vm, &vm->gc_frames_scanned, vm->num_frames, deadline);
+    return vm->gc_frames_scanned >= vm->num_frames;
+}
+
+// Returns the number of stack slots and frames which changed
+// since the steps marked them (see stack_changed)
+static size_t stack_changed_count(vm_t *vm) {
+    size_t from, from_frame;
+    stack_changed(vm, &from, &from_frame);
+    return stack_position(vm->segment, vm->stack_top) - from +
+           vm->num_frames - from_frame;
+}
+
+// Lets the steps mark the stack slots and frames which changed since
+// they were marked once more, unless there are only a few of them
+// and the program allocated little meanwhile (the values it allocated
+// are unmarked, gc_remark would mark all the reachable ones)
+// Returns false if they're left to gc_remark
+static bool gc_rescan(vm_t *vm) {
+    size_t from, from_frame;
+    stack_changed(vm, &from, &from_frame);
+    size_t top = stack_position(vm->segment, vm->stack_top);
+    size_t allocated = vm->gc_pacer.allocated + vm->young_allocated;
+    if (vm->gc_rescans >= GC_RESCANS ||
+        (stack_changed_count(vm) <= GC_RESCAN_MIN &&
+         allocated - vm->gc_rescan_allocated <= GC_RESCAN_ALLOCATED)) {
+        return false;
+    }
+    vm->gc_rescans++;
+    vm->gc_rescan_allocated = allocated;
+    vm->gc_scanned = from;
+    vm->gc_frames_scanned = from_frame;
+    vm->stack_old = top;
+    vm->frames_old = vm->num_frames;
+    mark_globals(vm);
+    return true;
+}
+
+// Marks the next GC_STEP_CHECK elements of the vector m->vector
+static void mark_vector_part(marker_t *m) {
+    vector_t *vec = m->vector;
+    uint32_t i = m->vector_from;
+    for (; i < vec->count && i - m->vector_from < GC_STEP_CHECK; i++) {
+        mark(m, vec->data[i]);
+    }
+    m->vector_from = i;
+    if (i >= vec->count) {
+        m->vector = NULL;
+    }
+}
+
+// Marks gray values until there are none or it's <deadline>
+// Returns true if there are none
+static bool trace_until(vm_t *vm, double deadline) {
+    marker_t *m = &vm->marker;
+    for (unsigned n = 1; m->num_gray > 0 || m->vector != NULL; n++) {
+        if (m->vector != NULL) {
+            mark_vector_part(m);
+            if (gc_clock() >= deadline) {
+                return false;
+            }
+            continue;
+        }
+        value_t val = m->gray[--m->num_gray];
+        if (!IS_CONS(val) && AS_PTR(val)->type == T_VECTOR &&
+            ((vector_t *) AS_PTR(val))->count > GC_STEP_CHECK) {
+            // a big vector is marked a part at a time, the write barrier
+            // marks what's stored into it meanwhile (it's marked already)
+            m->vector = (vector_t *) AS_PTR(val);
+            m->vector_from = 0;
+            continue;
+        }
+        mark_refs(m, val);
+        if (n % GC_STEP_CHECK == 0 && gc_clock() >= deadline) {
+            return m->num_gray == 0;
+        }
+    }
+    return true;
+}
+
+// Finishes marking and ends a major collection
+static void gc_remark(vm_t *vm) {
+    // vm_gc may finish it in the middle of a big vector
+    while (vm->marker.vector != NULL) {
+        mark_vector_part(&vm->marker);
+    }
+    markall(vm);
+    gc_marked_all(vm, false);
+    vm->gc_phase = GC_IDLE;
+    gc_young_reset(vm);
+    // the new threshold is set when the pause ends (see gc_pace)
+    vm->gc_pacer.finished = true;
+}
+
+// Runs a step of the incremental major collection
+static void gc_step(vm_t *vm) {
+    double start = gc_clock();
+    double deadline = start + (double) vm->config.gc_step_time / 1000000;
+    sweeper_pause(vm);
+    if (vm->gc_phase == GC_SWEEPING) {
+        if (gc_sweep_until(vm, deadline)) {
+            if (vm->allocated > vm->gc_threshold) {
+                gc_unmark_start(vm);
+            } else {
+                // it was just garbage left unswept
+                vm->gc_phase = GC_IDLE;
+            }
+        }
+    } else if (vm->gc_phase == GC_UNMARKING) {
+        if (gc_unmark_until(vm, deadline)) {
+            gc_mark_start(vm);
+            mark_globals(vm);
+        }
+    } else if (gc_scan(vm, deadline) && trace_until(vm, deadline) &&
+               !gc_rescan(vm)) {
+        // the deadline doesn't bound the last step, the work gc_rescan
+        // left to it does
+        gc_stats_t *stats = &vm->gc_stats;
+        size_t scanned = stack_changed_count(vm);
+        size_t marked = vm->marker.marked;
+        gc_remark(vm);
+        marked = vm->marker.marked - marked;
+        if (scanned > stats->remark_scanned) stats->remark_scanned = scanned;
+        if (marked > stats->remark_marked) stats->remark_marked = marked;
+    }
+    gc_young_reset(vm);
+    sweeper_resume(vm);
+    gc_pause_end(vm, SCM_GC_STEP, start);
+}
+
+// Starts an incremental major collection
+static void gc_start(vm_t *vm) {
+    vm->gc_phase = GC_SWEEPING;
+    gc_step(vm);
+}
+
+// Runs a whole major collection (or finishes the incremental one)
+void vm_gc(vm_t *vm) {
+#if NOGC
+    return;
+#endif  // NOGC
+#if DEBUG
+    fprintf(stdout, "GC started\n");
+#endif  // DEBUG
+    double start = gc_clock();
+    sweeper_pause(vm);
+    if (vm->gc_phase != GC_MARKING) {
+        gc_sweep_until(vm, 0);
+        if (vm->gc_phase != GC_UNMARKING) {
+            gc_unmark_start(vm);
+        }
+        gc_unmark_until(vm, 0);
+        gc_mark_start(vm);
+    }
+    gc_remark(vm);
+    sweeper_resume(vm);
+    gc_pause_end(vm, SCM_GC_MAJOR, start);
+#if DEBUG
+    fprintf(stdout, "GC finished: %zuB allocated, %zuB alive, "
+                    "new threshold at %zuB! Time delta: %.3lfs.\n",
+            vm->allocated, vm->marker.marked, vm->gc_threshold,
+            gc_clock() - start);
+#endif  // DEBUG
+}
+
+// Runs a whole major collection and sweeps all the garbage right away
+// (the heap is full, see heap_full)
+static void gc_full(vm_t *vm) {
+    vm_gc(vm);
+    sweeper_pause(vm);
+    gc_sweep_until(vm, 0);
+    sweeper_resume(vm);
+}
+
+/* *** ENV *** */
+
+// Finds the entry of <sym> in the hash table <variables> of <capacity>
+// (a power of two), or the empty entry where it belongs if it isn't there
+static variable_t *variable_entry(variable_t *variables, uint32_t capacity,
+                                  symbol_t *sym) {
+    uint32_t index = sym->hash & (capacity - 1);
+    while (variables[index].sym != NULL && variables[index].sym != sym) {
+        index = (index + 1) & (capacity - 1);
+    }
+    return &variables[index];
+}
+
+// Grows the hash table of <env> if it's too full to add another variable
+static bool variables_grow(vm_t *vm, env_t *env) {
+    // keep the load factor under 3/4
+    if ((env->num_variables + 1) * 4 <= env->variables_capacity * 3) {
+        return true;
+    }
+
+    uint32_t capacity =
+        env->variables_capacity ? env->variables_capacity << 1 : 8;
+    variable_t *variables = (variable_t *) vm_realloc(
+        vm, NULL, 0, capacity * sizeof(variable_t));
+    if (variables == NULL) {
+        return false;
+    }
+    for (uint32_t i = 0; i < capacity; i++) {
+        variables[i].sym = NULL;
+        variables[i].val = UNDEFINED_VAL;
+    }
+
+    for (uint32_t i = 0; i < env->variables_capacity; i++) {
+        variable_t *var = &env->variables[i];
+        if (var->sym != NULL) {
+            *variable_entry(variables, capacity, var->sym) = *var;
+        }
+    }
+    vm_realloc(vm, env->variables,
+               env->variables_capacity * sizeof(variable_t), 0);
+
+    env->variables = variables;
+    env->variables_capacity = capacity;
+    return true;
+}
+
+// Adds a variable (symbol and its value) to the env. frame
+// (or replaces the value if the frame already has it)
+void variable_add(vm_t *vm, env_t *env, symbol_t *sym, value_t val) {
+    // growing the table can trigger the gc, <sym> and <val> have to survive
+    bool grown;
+    if (vm_native_scanned(vm)) {
+        grown = variables_grow(vm, env);
+    } else {
+        value_t *top = vm->stack_top;
+        if (!vm_stack_check(vm, 2)) {
+            return;
+        }
+        *vm->stack_top++ = PTR_VAL(sym);
+        *vm->stack_top++ = val;
+        grown = variables_grow(vm, env);
+        vm_stack_restore(vm, top);
+    }
+    if (!grown) {
+        return;
+    }
+
+    variable_t *var =
+        variable_entry(env->variables, env->variables_capacity, sym);
+    if (var->sym == NULL) {
+        var->sym = sym;
+        env->num_variables++;
+        vm_write_barrier(vm, &env->p, PTR_VAL(sym));
+    }
+    var->val = val;
+    vm_write_barrier(vm, &env->p, val);
+}
+
+// Creates a new env frame
+env_t *env_push(vm_t *vm, env_t *env, value_t vars, int argc, value_t *args) {
+    uint32_t count = 0;
+    value_t iter = vars;
+    for (; IS_CONS(iter); iter = AS_CONS(iter)->cdr) {
+        count++;
+    }
+    bool variadic = IS_SYMBOL(iter);
+
+    value_t *top = vm->stack_top;
+    bool rooted = !vm_native_scanned(vm);
+    if (rooted && !vm_stack_check(vm, 1)) {
+        return env;
+    }
+
+    env_t *new_env = env_new(vm, vars, false, count + variadic, env);
+    if (rooted) {
+        *vm->stack_top++ = PTR_VAL(new_env);
+    }
+
+    uint32_t i = 0;
+    for (; i < count && i < (uint32_t) argc; i++) {
+        new_env->slots[i] = args[i];
+    }
+
+    if (variadic) {
+        // the rest of the arguments is put into a list
+        // (which is kept in its slot while it's being built)
+        new_env->slots[count] = NIL_VAL;
+        for (int j = argc - 1; j >= (int) count; j--) {
+            new_env->slots[count] = cons_fn(vm, args[j], new_env->slots[count]);
+            vm_write_barrier(vm, &new_env->p, new_env->slots[count]);
+        }
+    }
+    if (i != count || (!variadic && (uint32_t) argc != count)) {
+        // TODO: Add proper function arity?
+        error_runtime(vm, "Number of arguments doesn't match!");
+    }
+
+    if (rooted) {
+        vm_stack_restore(vm, top);
+    }
+    return new_env;
+}
+
+void primitive_add(vm_t *vm, env_t *env, const char *name, size_t len,
+                   primitive_fn fn) {
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 1)) {
+        return;
+    }
+    symbol_t *sym = symbol_intern(vm, name, len);
+    *vm->stack_top++ = PTR_VAL(sym);
+
+    primitive_t *prim = primitive_new(vm, fn);
+
+    prim->name = sym;
+    // <prim> may be permanent (see scm_env_default)
+    vm_write_barrier(vm, &prim->p, PTR_VAL(sym));
+
+    variable_add(vm, env, sym, PTR_VAL(prim));
+    vm_stack_restore(vm, top);
+}
+
+void special_add(vm_t *vm, env_t *env, const char *name, size_t len,
+                 special_fn form) {
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 1)) {
+        return;
+    }
+    symbol_t *sym = symbol_intern(vm, name, len);
+    *vm->stack_top++ = PTR_VAL(sym);
+
+    primitive_t *prim = special_new(vm, form);
+
+    prim->name = sym;
+    // <prim> may be permanent (see scm_env_default)
+    vm_write_barrier(vm, &prim->p, PTR_VAL(sym));
+
+    variable_add(vm, env, sym, PTR_VAL(prim));
+    vm_stack_restore(vm, top);
+}
+
+/* *** EVAL/APPLY *** */
+
+// Applies <func> to <argc> evaluated arguments in <args>
+static value_t apply_func(vm_t *vm, function_t *func, int argc,
+                          value_t *args) {
+    if (vm->config.engine == SCM_ENGINE_BYTECODE) {
+        return code_call(vm, func, argc, args);
+    }
+
+    env_t *new_env = env_push(vm, func->env, func->params, argc, args);
+    if (vm_native_scanned(vm)) {
+        return begin(vm, new_env, func->body);
+    }
+
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, 1)) {
+        return UNDEFINED_VAL;
+    }
+    *vm->stack_top++ = PTR_VAL(new_env);
+    value_t result = begin(vm, new_env, func->body);
+    vm_stack_restore(vm, top);
+
+    return result;
+}
+
+// Calls the value <fn> in <env> with <argc> evaluated arguments in <args>
+value_t call(vm_t *vm, env_t *env, value_t fn, int argc, value_t *args) {
+    if (IS_PRIMITIVE(fn)) {
+        primitive_t *prim = AS_PRIMITIVE(fn);
+        if (prim->form != NULL && vm_native_scanned(vm)) {
+            value_t list = NIL_VAL;
+            for (int i = argc - 1; i >= 0; i--) {
+                list = cons_fn(vm, args[i], list);
+            }
+            return special_call(vm, env, prim, list);
+        } else if (prim->form != NULL) {
+            // special forms want a list, let's give them one
+            value_t *top = vm->stack_top;
+            if (!vm_stack_check(vm, 1)) {
+                return UNDEFINED_VAL;
+            }
+            value_t *list = vm->stack_top++;
+            *list = NIL_VAL;
+            for (int i = argc - 1; i >= 0; i--) {
+                *list = cons_fn(vm, args[i], *list);
+            }
+            value_t result = special_call(vm, env, prim, *list);
+            vm_stack_restore(vm, top);
+            return result;
+        }
+        return prim->fn(vm, env, argc, args);
+    } else if (IS_FUNCTION(fn) || IS_MACRO(fn)) {
+        return apply_func(vm, AS_FUNCTION(fn), argc, args);
+    }
+
+    error_runtime(vm, "|apply: Cannot apply something else than a procedure!");
+    return NIL_VAL;
+}
+
+// Tries to apply the value <fn> in <env> to an evaluated list <args>
+value_t apply(vm_t *vm, env_t *env, value_t fn, value_t args) {
+    int32_t argc = cons_len(args);
+    if (argc < 0) {
+        error_runtime(vm, "|apply: Cannot apply to a non-list!");
+        return NIL_VAL;
+    }
+    if (IS_SPECIAL(fn)) {
+        return special_call(vm, env, AS_PRIMITIVE(fn), args);
+    }
+    value_t *top = vm->stack_top;
+    if (!vm_stack_check(vm, argc)) {
+        return UNDEFINED_VAL;
+    }
+
+    value_t *base = vm->stack_top;
     value_t arg, iter;
-    SCM_FOREACH (arg, AS_CONS(val), iter) { result = eval(vm, env, arg); }
+    if (argc > 0) {
+        SCM_FOREACH (arg, AS_CONS(args), iter) { *vm->stack_top++ = arg; }
+    }
+
+    value_t result = call(vm, env, fn, argc, base);
+    vm_stack_restore(vm, top);
+    return result;
+}
+
+// Finds the slot of the variable <sym> in <env>, -1 if it's not there
+// (if there are more variables named <sym>, the last one wins)
+static int64_t env_slot(env_t *env, symbol_t *sym) {
+    value_t var = PTR_VAL(sym);
+    int64_t found = -1;
+    uint32_t i = 0;
+    value_t iter = env->vars;
+    for (; IS_CONS(iter) && i < env->count; iter = AS_CONS(iter)->cdr, i++) {
+        value_t name = AS_CONS(iter)->car;
+        if (env->bindings) {
+            name = AS_CONS(name)->car;
+        }
+        if (IS_EQ(name, var)) {
+            found = i;
+        }
+    }
+    if (i < env->count && IS_EQ(iter, var)) {
+        // the rest parameter
+        found = i;
+    }
+    return found;
+}
+
+// Finds where the value of <sym> is stored in <env>
+// and the env frame <*owner> where it is
+// Returns NULL if not found
+static value_t *env_find(env_t *env, symbol_t *sym, env_t **owner) {
+    for (env_t *e = env; e != NULL; e = e->up) {
+        *owner = e;
+        // variables added by define shadow the slots
+        if (e->num_variables > 0) {
+            variable_t *var =
+                variable_entry(e->variables, e->variables_capacity, sym);
+            if (var->sym != NULL) {
+                return &var->val;
+            }
+        }
+        if (e->count > 0) {
+            int64_t slot = env_slot(e, sym);
+            if (slot >= 0) {
+                return &e->slots[slot];
+            }
+        }
+    }
+    return NULL;
+}
+
+// Tries to find <sym> in <env>
+// Returns `undefined` if not found
+value_t lookup(env_t *env, symbol_t *sym) {
+    env_t *owner;
+    value_t *place = env_find(env, sym, &owner);
+    if (place == NULL) {
+        return UNDEFINED_VAL;
+    }
+    return *place;
+}
+
+// Tries to find <sym> in <env>
+// Returns `undefined` and complains if not found
+value_t find(env_t *env, symbol_t *sym) {
+    value_t result = lookup(env, sym);
+    if (IS_UNDEFINED(result)) {
+        fprintf(stderr, "|find: Error: Symbol %s not bound\n", sym->name);
+        // error_runtime(vm, "|find: Symbol %s is not bound in environment!",
+        // sym->name);
+    }
+    return result;
+}
+
+// Tries to find <sym> in <env> and replace it's val with <new_val>
+// Returns `undefined` if not found
+value_t find_replace(vm_t *vm, env_t *env, symbol_t *sym, value_t new_val) {
+    env_t *owner;
+    value_t *place = env_find(env, sym, &owner);
+    if (place == NULL) {
+        fprintf(stderr, "|find-replace: Error: Symbol %s not bound\n",
+                sym->name);
+        // error_runtime(vm, "|find: Symbol %s is not bound in environment!",
+        // sym->name);
+        return UNDEFINED_VAL;
+    }
+    *place = new_val;
+    vm_write_barrier(vm, &owner->p, new_val);
+    return new_val;
+}
+
+// Finds the env frame with the slot of <local> using its lexical address
+// Returns NULL if <env> doesn't have the expected shape
+// (the address was resolved for a different place)
+static env_t *local_env(env_t *env, local_t *local) {
+    for (uint16_t i = 0; i < local->depth && env != NULL; i++) {
+        env = env->up;
+    }
+    if (env == NULL || !IS_EQ(env->vars, local->vars) ||
+        local->slot >= env->count) {
+        return NULL;
+    }
+    return env;
+}
+
+// Gets the value of the resolved variable <local> in <env>
+// Returns `undefined` and complains if not found
+value_t local_get(env_t *env, local_t *local) {
+    env_t *owner = local_env(env, local);
+    if (owner == NULL) {
+        return find(env, local->name);
+    }
+    return owner->slots[local->slot];
+}
+
+// Replaces the value of the resolved variable <local> in <env>
+// Returns `undefined` if not found
+value_t local_set(vm_t *vm, env_t *env, local_t *local, value_t new_val) {
+    env_t *owner = local_env(env, local);
+    if (owner == NULL) {
+        return find_replace(vm, env, local->name, new_val);
+    }
+    owner->slots[local->slot] = new_val;
+    vm_write_barrier(vm, &owner->p, new_val);
+    return new_val;
+}
+
+// Evaluates all members of list and returns their return values as a list
+value_t eval_list(vm_t *vm, env_t *env, value_t list) {
+    if (IS_NIL(list)) {
+        return NIL_VAL;
+    }
+    // the list and the value being added to it are kept on the stack
+    // while it's being built (or in locals if the native stack is scanned)
+    value_t head_local, item_local;
+    value_t *head = &head_local, *item = &item_local;
+    value_t *top = vm->stack_top;
+    bool rooted = !vm_native_scanned(vm);
+    if (rooted) {
+        if (!vm_stack_check(vm, 2)) {
+            return UNDEFINED_VAL;
+        }
+        head = vm->stack_top++;
+        item = vm->stack_top++;
+    }
+    *head = NIL_VAL;
+    *item = NIL_VAL;
+    cons_t *tail = NULL;
+
+    for (cons_t *cons = AS_CONS(list);; cons = AS_CONS(cons->cdr)) {
+        *item = eval(vm, env, cons->car);
+        if (tail == NULL) {
+            *head = cons_fn(vm, *item, NIL_VAL);
+            tail = AS_CONS(*head);
+        } else {
+            tail->cdr = cons_fn(vm, *item, NIL_VAL);
+            vm_cons_barrier(vm, tail, tail->cdr);
+            tail = AS_CONS(tail->cdr);
+        }
+        if (IS_NIL(cons->cdr)) {
+            break;
+        }
+    }
+    value_t result = *head;
+    if (rooted) {
+        vm_stack_restore(vm, top);
+    }
+    return result;
+}
+
+static value_t eval_frames(vm_t *vm, env_t *env, value_t val, size_t entry,
+                           value_t *top);
+
+// Evaluates the expression <val> returned in tail position to C code,
+// which pushed the frames from <entry> up (and the values from <top> up)
+// for it (see special_fn)
+static value_t eval_tail(vm_t *vm, env_t *env, value_t val, size_t entry,
+                         value_t *top) {
+    if (vm->num_frames > entry) {
+        return eval_frames(vm, env, val, entry, top);
+    }
+    return eval(vm, env, val);
+}
+
+// Calls the special form <prim> outside of tail position
+value_t special_call(vm_t *vm, env_t *env, primitive_t *prim, value_t args) {
+    size_t entry = vm->num_frames;
+    value_t *top = vm->stack_top;
+    env_t *tail_env = NULL;
+    value_t result = prim->form(vm, env, args, &tail_env);
+    if (tail_env != NULL) {
+        return eval_tail(vm, tail_env, result, entry, top);
+    }
+    return result;
+}
+
+// Pushes a frame of eval for evaluating a body or arguments
+static frame_t *eval_frame_push(vm_t *vm, env_t *env, value_t rest, int argc) {
+    frame_t *frame = vm_push_frame(vm);
+    if (frame == NULL) {
+        return NULL;
+    }
+    frame->code = NULL;
+    frame->ip = NULL;
+    frame->env = env;
+    frame->base = vm->stack_top;
+    frame->rest = rest;
+    frame->argc = argc;
+    frame->next = NULL;
+    return frame;
+}
+
+frame_t *special_frame_push(vm_t *vm, env_t *env, value_t rest,
+                            frame_next_fn next) {
+    frame_t *frame = eval_frame_push(vm, env, rest, 0);
+    if (frame != NULL) {
+        frame->next = next;
+    }
+    return frame;
+}
+
+void special_frame_pop(vm_t *vm, frame_t *frame) {
+    vm_stack_restore(vm, frame->base);
+    vm->num_frames--;
+}
+
+// Evaluates the value <val>
+// Returns `undefined` if symbol not found
+//
+// Arguments and bodies of functions and the subexpressions of special
+// forms (see special_fn) are evaluated using frames on the heap instead
+// of recursing in C, so the depth of recursion is limited only by
+// the size of the stack (see scm_config_t).
+// Expressions in tail position (bodies of functions, branches of if, ...)
+// replace the current expression, so tail calls don't need frames at all.
+#if CONSERVATIVE
+// Evaluates <val> from outside of eval, its native stack starts here
+static value_t eval_outer(vm_t *vm, env_t *env, value_t val) {
+    volatile char base;
+    vm->native_base = (void *) &base;
+    value_t result = eval(vm, env, val);
+    vm->native_base = NULL;
+    return result;
+}
+#endif  // CONSERVATIVE
+
+value_t eval(vm_t *vm, env_t *env, value_t val) {
+#if CONSERVATIVE
+    if (vm->native_base == NULL) {
+        return eval_outer(vm, env, val);
+    }
+#endif  // CONSERVATIVE
+    if (vm->config.engine == SCM_ENGINE_BYTECODE &&
+        (IS_CONS(val) || IS_EXPANSION(val))) {
+        return code_eval(vm, env, val);
+    }
+    return eval_frames(vm, env, val, vm->num_frames, vm->stack_top);
+}
+
+// Evaluates <val>, its value goes to the frames above <entry> if there are
+// any, the stack is restored to <top> at the end
+static value_t eval_frames(vm_t *vm, env_t *env, value_t val, size_t entry,
+                           value_t *top) {
+    if (!vm_native_check(vm)) {
+        vm->num_frames = entry;
+        vm_stack_restore(vm, top);
+        return UNDEFINED_VAL;
+    }
+    vm->native_depth++;
+
+    // the current expression and env are kept in vm->regs
+    // (a conservative build finds them on the native stack instead)
+#if !CONSERVATIVE
+    value_t *regs = &vm->regs[vm->num_regs];
+    vm->num_regs += 2;
+#endif  // !CONSERVATIVE
+
+    frame_t *frame;
+    value_t result;
+
+eval:
+#if !CONSERVATIVE
+    regs[0] = val;
+    regs[1] = PTR_VAL(env);
+#endif  // !CONSERVATIVE
+
+    if (vm->config.engine == SCM_ENGINE_BYTECODE &&
+        (IS_CONS(val) || IS_EXPANSION(val))) {
+        // the value goes to the frame of a special form called by bytecode
+        result = code_eval(vm, env, val);
+    } else if (IS_VAL(val) || IS_STRING(val) || IS_PROCEDURE(val) || IS_VECTOR(val) ||
+        IS_ENV(val) || IS_HASHTABLE(val) || IS_WEAKBOX(val)) {
+        // These values are self evaluating
+        result = val;
+    } else if (IS_LOCAL(val)) {
+        // This is a variable with a known lexical address
+        local_t *local = AS_LOCAL(val);
+        result = local_get(env, local);
+        if (IS_UNDEFINED(result)) {
+            error_runtime(vm, "|eval: Can't eval %s - symbol not bound!",
+                          local->name->name);
+        }
+    } else if (IS_SYMBOL(val)) {
+        // This is a variable
+        symbol_t *sym = AS_SYMBOL(val);
+        result = find(env, sym);
+        if (IS_UNDEFINED(result)) {
+            error_runtime(vm, "|eval: Can't eval %s - symbol not bound!",
+                          sym->name);
+        }
+    } else if (IS_EXPANSION(val)) {
+        // A macro expanded in advance (see resolve.h)
+        val = AS_EXPANSION(val)->expanded;
+        goto eval;
+    } else if (IS_CONS(val)) {
+        // It's a function application
+        cons_t *cons = AS_CONS(val);
+        value_t fn = eval(vm, env, cons->car);
+
+        if (IS_MACRO(fn)) {
+            // a macro which wasn't expanded in advance,
+            // it gets its arguments unevaluated
+            val = apply(vm, env, fn, cons->cdr);
+            goto eval;
+        } else if (IS_SPECIAL(fn)) {
+            // special forms get their arguments unevaluated
+            env_t *tail_env = NULL;
+            result = AS_PRIMITIVE(fn)->form(vm, env, cons->cdr, &tail_env);
+            if (tail_env != NULL) {
+                val = result;
+                env = tail_env;
+                goto eval;
+            }
+        } else if (!IS_PROCEDURE(fn)) {
+            error_runtime(vm, "|eval: Car of eval'd cons is not a procedure!");
+            result = NIL_VAL;
+        } else if (cons_len(cons->cdr) < 0) {
+            error_runtime(vm, "|eval: Arguments are not a proper list!");
+            result = NIL_VAL;
+        } else {
+            // the procedure and its evaluated arguments go to the stack
+            if (!vm_stack_check(vm, cons_len(cons->cdr) + 1)) {
+                goto unwind;
+            }
+            frame = eval_frame_push(vm, env, cons->cdr, 0);
+            if (frame == NULL) {
+                goto unwind;
+            }
+            *vm->stack_top++ = fn;
+
+            if (IS_CONS(cons->cdr)) {
+                val = AS_CONS(cons->cdr)->car;
+                goto eval;
+            }
+            goto apply;
+        }
+    } else {
+        // This should be an assert
+        error_runtime(vm, "|eval: Cannot eval - unknown value type!");
+        result = NIL_VAL;
+    }
+
+    // <result> goes to the frame below
+    while (vm->num_frames > entry) {
+        frame = &vm->frames[vm->num_frames - 1];
+
+        if (frame->next != NULL) {
+            // a special form goes on with the value
+            env_t *tail_env = NULL;
+            result = frame->next(vm, frame, result, &tail_env);
+            if (tail_env != NULL) {
+                val = result;
+                env = tail_env;
+                goto eval;
+            }
+            continue;
+        }
+
+        if (frame->argc < 0) {
+            // a body - the result is thrown away, let's continue
+            vm_stack_restore(vm, frame->base);
+            frame->rest = AS_CONS(frame->rest)->cdr;
+            val = AS_CONS(frame->rest)->car;
+            env = frame->env;
+            if (!IS_CONS(AS_CONS(frame->rest)->cdr)) {
+                // the last expression is in tail position
+                vm->num_frames--;
+            }
+            goto eval;
+        }
+
+        // an argument
+        vm_stack_restore(vm, frame->base + 1 + frame->argc);
+        *vm->stack_top++ = result;
+        frame->argc++;
+        frame->rest = AS_CONS(frame->rest)->cdr;
+        if (IS_CONS(frame->rest)) {
+            val = AS_CONS(frame->rest)->car;
+            env = frame->env;
+            goto eval;
+        }
+
+    apply:
+        // all arguments are evaluated, let's call the procedure
+        {
+            value_t *base = frame->base;
+            value_t fn = base[0];
+            int argc = frame->argc;
+            env_t *caller_env = frame->env;
+            vm->num_frames--;
+
+            if (IS_FUNCTION(fn)) {
+                function_t *func = AS_FUNCTION(fn);
+                env = env_push(vm, func->env, func->params, argc, base + 1);
+#if !CONSERVATIVE
+                regs[1] = PTR_VAL(env);
+#endif  // !CONSERVATIVE
+                vm_stack_restore(vm, base);
+
+                value_t body = func->body;
+                if (IS_NIL(body)) {
+                    result = VOID_VAL;
+                    continue;
+                }
+                if (IS_CONS(AS_CONS(body)->cdr) &&
+                    eval_frame_push(vm, env, body, -1) == NULL) {
+                    goto unwind;
+                }
+                val = AS_CONS(body)->car;
+                goto eval;
+            }
+
+            result = call(vm, caller_env, fn, argc, base + 1);
+            vm_stack_restore(vm, base);
+        }
+    }
+
+#if !CONSERVATIVE
+    vm->num_regs -= 2;
+#endif  // !CONSERVATIVE
+    vm->native_depth--;
+    vm_stack_restore(vm, top);
     return result;
+
+unwind:
+    // an unrecoverable error, throws away all frames of this eval
+    vm->num_frames = entry;
+#if !CONSERVATIVE
+    vm->num_regs -= 2;
+#endif  // !CONSERVATIVE
+    vm->native_depth--;
+    vm_stack_restore(vm, top);
+    return UNDEFINED_VAL;
+}
+
+// Evaluates expressions in order, returns the last evaluated
+// or #<void> if <val> is empty (NIL)
+value_t begin(vm_t *vm, env_t *env, value_t val) {
+    size_t entry = vm->num_frames;
+    value_t *top = vm->stack_top;
+    env_t *tail_env = NULL;
+    value_t result = begin_tail(vm, env, val, &tail_env);
+    if (tail_env != NULL) {
+        return eval_tail(vm, tail_env, result, entry, top);
+    }
+    return result;
+}
+
+// Evaluates expressions in order but the last one, which is returned
+// to be evaluated in <*tail_env>, or #<void> if <val> is empty (NIL)
+// The others are evaluated by eval in a frame of a body, the first one
+// is returned then (see special_fn)
+value_t begin_tail(vm_t *vm, env_t *env, value_t val, env_t **tail_env) {
+    if (IS_NIL(val)) {
+        return VOID_VAL;
+    }
+    if (IS_CONS(AS_CONS(val)->cdr) &&
+        eval_frame_push(vm, env, val, -1) == NULL) {
+        return UNDEFINED_VAL;
+    }
+    *tail_env = env;
+    return AS_CONS(val)->car;
 }
 
 value_t expand(vm_t *vm, env_t *env, value_t val) {
@@ -504,12 +2629,12 @@ value_t expand(vm_t *vm, env_t *env, value_t val) {
         return val;
     }
 
-    value_t found = find(env, sym);
-    if (IS_UNDEFINED(found) || !IS_MACRO(found)) {
+    value_t found = lookup(env, sym);
+    if (!IS_MACRO(found)) {
         return val;
     }
 
-    function_t *macro = AS_MACRO(found);
-    value_t args = AS_CONS(val)->cdr;
-    return apply_func(vm, env, macro, args);
+    // the macro gets its arguments unevaluated
+    value_t args = IS_CONS(val) ? AS_CONS(val)->cdr : NIL_VAL;
+    return apply(vm, env, found, args);
 }
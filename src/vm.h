@@ -5,29 +5,225 @@
 #include <stdlib.h>  // size_t, malloc, realloc
 
 #include "config.h"
+#if THREADS
+#include <pthread.h>  // pthread_t, pthread_mutex_t, pthread_cond_t
+#endif  // THREADS
+#include "pool.h"  // pool_t
 #include "read.h"  // reader_t
 #include "scheme.h"
 #include "value.h"  // ptrvalue_t, symbol_t, env_t
 
-#define MAX_NUM_TEMP 256
+// number of values in one segment of the value stack
+#define STACK_SEGMENT_SIZE (1024 * 16)
+// initial number of call frames
+#define FRAMES_INITIAL 256
+// maximum nesting of eval in C (macros, primitives calling procedures...)
+#define MAX_NATIVE_DEPTH (1024 * 4)
 
 // Signals a runtime error
 void error_runtime(vm_t *vm, const char *format, ...);
 
+// The value stack is made of segments, so that it can grow
+// without moving the values (there are pointers to them everywhere)
+typedef struct _stack_segment_t {
+    struct _stack_segment_t *prev;
+    struct _stack_segment_t *next;
+
+    // the top of this segment when it's not the current one
+    value_t *top;
+    // the position of its first slot in the whole stack
+    size_t offset;
+
+    value_t slots[STACK_SEGMENT_SIZE];
+} stack_segment_t;
+
+struct _frame_t;
+
+// Gets the value <val> of an expression a special form returned in tail
+// position while its frame <frame> was the innermost one (see special_fn)
+// It either returns another expression to be evaluated in <*tail_env>
+// and keeps the frame, or pops it and returns like a special form
+typedef value_t (*frame_next_fn)(vm_t *vm, struct _frame_t *frame,
+                                 value_t val, env_t **tail_env);
+
+// A call frame
+// either of the bytecode interpreter (<code> is not NULL)
+// or of eval, which is evaluating arguments, a body or a special form
+typedef struct _frame_t {
+    code_t *code;
+    uint8_t *ip;
+    env_t *env;
+
+    // the first stack slot of this frame
+    value_t *base;
+    // the position in the whole stack where its values start
+    size_t position;
+
+    // eval: the arguments/expressions of the body left to evaluate,
+    // the first one is being evaluated right now
+    // (anything a special form wants to keep for <next>)
+    value_t rest;
+    // eval: the number of evaluated arguments or -1 for a body
+    int argc;
+    // eval: where the value goes if it's a frame of a special form
+    frame_next_fn next;
+} frame_t;
+
+// Phases of an incremental major collection (see vm_gc)
+typedef enum { GC_IDLE, GC_SWEEPING, GC_UNMARKING, GC_MARKING } gc_phase_t;
+
+// Statistics of the garbage collector (times are in seconds)
+typedef struct {
+    size_t minor_count, major_count, step_count;
+    double minor_time, major_time, step_time;
+    double minor_max, major_max, step_max;
+    // the total size of values promoted to the old generation
+    size_t promoted;
+    // the size of the permanent values
+    size_t permanent;
+    // the size of the chunks of pages given back
+    size_t released;
+    // the number of stack slots and frames minor collections went through
+    size_t minor_scanned;
+    // the number of times the heap was full (see heap_full)
+    size_t heap_full;
+    // the most stack slots and frames and the most bytes of values
+    // the last step of an incremental collection marked (see gc_remark)
+    size_t remark_scanned, remark_marked;
+} gc_stats_t;
+
+// The measurements of the current cycle of the GC - since the end
+// of the last major collection until the end of the next one (see gc_pace)
+typedef struct {
+    // when the last pause ended (see gc_clock)
+    double pause_end;
+    // the time the program ran, the time of minor collections and the time
+    // of the major one (or its steps), in seconds
+    double run_time, minor_time, major_time;
+    // the size the program allocated
+    size_t allocated;
+    // the major collection ended in this pause
+    bool finished;
+    // the number of major collections in a row which left
+    // the heap much bigger than needed (see gc_mark_start)
+    unsigned oversized;
+} gc_pacer_t;
+
+// A mark stack - marked values whose references weren't marked yet
+// (every thread marking values has its own, see vm_gc)
+typedef struct {
+    vm_t *vm;
+    value_t *gray;
+    size_t num_gray, gray_capacity;
+    // a value couldn't be pushed to the mark stack (see markall)
+    bool overflow;
+    // the size of the values it marked
+    size_t marked;
+    // other threads are marking too, so marks are set atomically
+    bool shared;
+    // a big vector the steps of an incremental collection mark
+    // the elements of a part at a time, from vector_from on
+    vector_t *vector;
+    uint32_t vector_from;
+} marker_t;
+
+#if THREADS
+// The thread sweeping the garbage while the VM runs
+// (config.gc_sweep_thread, see vm_gc)
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    // signals the thread that there is work (or that it should quit)
+    // and the VM that the thread stopped sweeping
+    pthread_cond_t wake, idle;
+    bool started, quit, running;
+    // there may be unswept pages (the VM clears it to pause the thread)
+    bool work;
+    // the size of the values it freed which vm->allocated still counts
+    size_t freed;
+} sweeper_t;
+#endif  // THREADS
+
 // A structure for the whole interpreter/VM
 // Already typedef'd in scheme.h
 struct _vm_t {
-    // a linked list of all allocated values
-    ptrvalue_t *head;
+    // small values and conses are allocated from these (see pool.h)
+    pool_t pools[POOL_NUM_POOLS];
+    pool_page_t *free_pages;
+    // the number of pages in the pools
+    size_t num_pages;
+    // big values, young ones weren't there during the last collection
+    pool_large_t *large, *large_young;
+    // the next old big value to unmark (see pool_unmark_next),
+    // whether the empty pages are given back meanwhile
+    // and the unused chunks left to free then
+    pool_large_t *unmark_large;
+    bool unmark_release;
+    pool_page_t *unmark_chunks;
+
+    // values allocated now are permanent - never freed and never traced
+    // by collections (a store into them has to go through the write
+    // barrier even right after they were allocated)
+    bool permanent;
+    pool_t permanent_pools[POOL_NUM_POOLS];
+    pool_large_t *large_permanent;
+#if CONSERVATIVE
+    // the pages and big values sorted for the scan of the native stack
+    pool_index_t index;
+#endif  // CONSERVATIVE
+
+    // old values which may point to young ones (see vm_write_barrier)
+    value_t *remembered;
+    size_t num_remembered, remembered_capacity;
+    // permanent values which may point to other values,
+    // roots of every collection (they're never forgotten)
+    value_t *permanent_refs;
+    size_t num_permanent_refs, permanent_refs_capacity;
+
+    // weak boxes and weak hash tables, the ones which were there
+    // during the last collection first (see gc_weak)
+    value_t *weak;
+    size_t num_weak, num_weak_old, weak_capacity;
+    // values with a finalizer, each followed by it (see vm_finalizer_add)
+    value_t *finalizers;
+    size_t num_finalizers, finalizers_capacity;
+    // collected values and their finalizers waiting to be run
+    value_t *finalize;
+    size_t num_finalize, finalize_capacity;
 
     // total size of all allocated values
     size_t allocated;
     // the size of allocated values
     // to trigger the garbage collector
     size_t gc_threshold;
+    // size allocated since the last collection
+    size_t young_allocated;
+    // the running collection is a minor one
+    bool gc_minor;
 
-    // a table of all symbols (needed for interning)
-    symbol_t *symbol_table;
+    // the mark stack of the running collection
+    // (the size of the values it marked is the size of the live ones)
+    marker_t marker;
+
+    // the phase of the running incremental major collection
+    gc_phase_t gc_phase;
+
+#if THREADS
+    sweeper_t sweeper;
+#endif  // THREADS
+
+    gc_stats_t gc_stats;
+    gc_pacer_t gc_pacer;
+
+    // a hash table of all interned symbols (open addressing)
+    // it doesn't keep them alive, freed symbols leave a tombstone
+    symbol_t **symbols;
+    uint32_t num_symbols, num_tombstones, symbols_capacity;
+    // the symbols interned since the last collection, a minor one
+    // unintern only these (all of them are checked if it couldn't grow)
+    symbol_t **young_symbols;
+    uint32_t num_young_symbols, young_symbols_capacity;
+    bool young_symbols_overflow;
 
     scm_config_t config;
 
@@ -40,10 +236,44 @@ struct _vm_t {
 
     uint32_t gensym_count;
 
-    // a stack of temporary roots
-    // these are values, that shouldn't be deleted by the gc
-    size_t num_temp;
-    ptrvalue_t *temp[MAX_NUM_TEMP];
+    // the value stack, holds evaluated arguments
+    // and operands of the bytecode interpreter
+    stack_segment_t *segment;
+    value_t *stack_top;
+    value_t *stack_end;
+
+    // call frames of eval and the bytecode interpreter
+    frame_t *frames;
+    size_t num_frames;
+    size_t frames_capacity;
+
+    // the size of the segments and frames in bytes
+    size_t stack_size;
+
+    // the stack slots below this position and the frames below this one
+    // didn't change since the last collection, so they can only point
+    // to old values and a minor collection skips them (see mark_stack)
+    size_t stack_old, frames_old;
+    // the stack slots below this position and the frames below this one
+    // were marked by the steps of an incremental collection (see gc_scan)
+    // and how many times they started marking the changed ones again
+    // (the program had allocated gc_rescan_allocated bytes then)
+    size_t gc_scanned, gc_frames_scanned;
+    unsigned gc_rescans;
+    size_t gc_rescan_allocated;
+
+    // the expression and env each nested eval is evaluating right now,
+    // they change all the time, so they aren't on the value stack
+    value_t regs[2 * MAX_NATIVE_DEPTH];
+    size_t num_regs;
+
+    // nesting of eval in C
+    size_t native_depth;
+#if CONSERVATIVE
+    // the bottom of the native stack while eval runs (NULL outside of it),
+    // collections scan the native stack from the top down to it
+    void *native_base;
+#endif  // CONSERVATIVE
 
     // indicates if the VM encountered an error
     // we want to accumulate as many errors as possible!
@@ -53,29 +283,139 @@ struct _vm_t {
 // adds a primitive function under name [name] to env
 void primitive_add(vm_t *vm, env_t *env, const char *name, size_t len,
                    primitive_fn fn);
+// adds a special form under name [name] to env
+void special_add(vm_t *vm, env_t *env, const char *name, size_t len,
+                 special_fn form);
 // adds a variable to env
 void variable_add(vm_t *vm, env_t *env, symbol_t *sym, value_t val);
 
-// pushes a new environment frame
-env_t *env_push(vm_t *vm, env_t *env, value_t vars, value_t vals);
+// pushes a new environment frame binding <vars> to <argc> values in <args>
+env_t *env_push(vm_t *vm, env_t *env, value_t vars, int argc, value_t *args);
 
 // tries to find a <sym> in <env>
 value_t find(env_t *env, symbol_t *sym);
+// same as find, but doesn't complain if <sym> is not bound
+value_t lookup(env_t *env, symbol_t *sym);
 
 // tries to find a <sym> in <env>, if found, replaces it's val with <new_val>
-value_t find_replace(env_t *env, symbol_t *sym, value_t new_val);
+value_t find_replace(vm_t *vm, env_t *env, symbol_t *sym, value_t new_val);
+
+// the same as find and find_replace for a variable resolved to <local>
+value_t local_get(env_t *env, local_t *local);
+value_t local_set(vm_t *vm, env_t *env, local_t *local, value_t new_val);
 
 // evaluates a list
 value_t eval_list(vm_t *vm, env_t *env, value_t list);
 // evaluates a value
 value_t eval(vm_t *vm, env_t *env, value_t val);
-// applies <fn> to <args>
+// applies <fn> to an (already evaluated) list <args>
 value_t apply(vm_t *vm, env_t *env, value_t fn, value_t args);
+// calls <fn> with <argc> evaluated arguments in <args>
+value_t call(vm_t *vm, env_t *env, value_t fn, int argc, value_t *args);
+// calls the special form <prim> with unevaluated <args>
+value_t special_call(vm_t *vm, env_t *env, primitive_t *prim, value_t args);
+// pushes a frame of eval for a special form evaluated in <env>
+// (see special_fn), <rest> and the slots above its base are kept for <next>
+frame_t *special_frame_push(vm_t *vm, env_t *env, value_t rest,
+                            frame_next_fn next);
+// pops the innermost frame <frame> and the slots above its base
+void special_frame_pop(vm_t *vm, frame_t *frame);
 // evaluates all arguments in [val] and returns the latest value
 value_t begin(vm_t *vm, env_t *env, value_t val);
+// evaluates all arguments in [val] but the last one,
+// which is returned to be evaluated in <*tail_env>
+value_t begin_tail(vm_t *vm, env_t *env, value_t val, env_t **tail_env);
 value_t expand(vm_t *vm, env_t *env, value_t val);
 
-void vm_push_temp(vm_t *vm, ptrvalue_t *ptr);
-void vm_pop_temp(vm_t *vm);
+// allocates a value of <size> bytes (small ones come from the pools)
+void *vm_alloc_value(vm_t *vm, size_t size);
+// allocates a cons (always from its pool)
+cons_t *vm_alloc_cons(vm_t *vm);
+// frees a value allocated by vm_alloc_value
+void vm_free_value(vm_t *vm, ptrvalue_t *ptr);
+
+// returns the size of a value including the buffers it points to
+size_t vm_size(vm_t *vm, value_t val);
+
+// collects only the young generation (see vm_gc)
+void vm_gc_minor(vm_t *vm);
+
+// adds the old value <val> to the remembered set
+void vm_remember(vm_t *vm, value_t val);
+// marks <val> during an incremental collection
+void vm_shade(vm_t *vm, value_t val);
+// the write barrier for a store of <val> into the permanent value <owner>
+void vm_permanent_barrier(vm_t *vm, value_t owner, value_t val);
+
+// lets the GC clear the weak box or weak hash table <val>,
+// returns false if it can't (then <val> can't have weak references)
+bool vm_weak_add(vm_t *vm, value_t val);
+// calls <fn> with <val> once <val> is unreachable (see vm_finalize)
+bool vm_finalizer_add(vm_t *vm, value_t val, value_t fn);
+// runs the finalizers of the collected values in <env>,
+// returns how many of them ran
+size_t vm_finalize(vm_t *vm, env_t *env);
+
+// The write barrier, has to be called after storing <val> into <ptr>
+// unless <ptr> was allocated after the last possible collection
+static inline void vm_write_barrier(vm_t *vm, ptrvalue_t *ptr, value_t val) {
+    if (IS_VAL(val) || !pool_marked(ptr)) {
+        return;
+    }
+    if (ptr->permanent) {
+        vm_permanent_barrier(vm, PTR_VAL(ptr), val);
+        return;
+    }
+    if (pool_val_marked(val)) {
+        return;
+    }
+    if (vm->gc_phase == GC_MARKING) {
+        // a marked value can't point to an unmarked one while marking
+        vm_shade(vm, val);
+    } else if (!ptr->remembered) {
+        // otherwise marked values are old and unmarked ones are young
+        vm_remember(vm, PTR_VAL(ptr));
+    }
+}
+
+// The same for a store into the cons <cons>
+static inline void vm_cons_barrier(vm_t *vm, cons_t *cons, value_t val) {
+    if (IS_VAL(val) || !pool_cons_marked(cons)) {
+        return;
+    }
+    if (pool_cons_permanent(cons)) {
+        vm_permanent_barrier(vm, CONS_VAL(cons), val);
+        return;
+    }
+    if (pool_val_marked(val)) {
+        return;
+    }
+    if (vm->gc_phase == GC_MARKING) {
+        vm_shade(vm, val);
+    } else if (!pool_bit(pool_cons_page(cons)->remembered, cons)) {
+        vm_remember(vm, CONS_VAL(cons));
+    }
+}
+
+// Checks if collections scan the native stack of the caller right now
+// (see CONSERVATIVE in config.h), C code doesn't have to push the values
+// it keeps in locals to the value stack then
+static inline bool vm_native_scanned(vm_t *vm) {
+#if CONSERVATIVE
+    return vm->native_base != NULL;
+#else
+    return false;
+#endif  // CONSERVATIVE
+}
+
+// checks if there is space for <n> more (contiguous) values on the stack
+// (the stack may move on to the next segment)
+bool vm_stack_check(vm_t *vm, size_t n);
+// pops all values above <top>
+void vm_stack_restore(vm_t *vm, value_t *top);
+// pushes a new call frame, returns NULL if there is no space left
+frame_t *vm_push_frame(vm_t *vm);
+// checks if eval can be nested once more in C
+bool vm_native_check(vm_t *vm);
 
 #endif  // _vm_h
@@ -7,7 +7,7 @@
 static void write_cons(FILE *f, cons_t *cons) {
     // First check if the list is circular
     // (we don't want to recurse forever)
-    int32_t len = cons_len(PTR_VAL(cons));
+    int32_t len = cons_len(CONS_VAL(cons));
     if (len == -1) {
         fprintf(f, "#<circular list>");
         return;
@@ -102,6 +102,13 @@ void write(FILE *f, value_t val) {
         } else if (IS_SYMBOL(val)) {
             symbol_t *sym = AS_SYMBOL(val);
             fprintf(f, "%s", sym->name);
+        } else if (IS_LOCAL(val)) {
+            // a resolved variable is written as the original symbol
+            local_t *local = AS_LOCAL(val);
+            fprintf(f, "%s", local->name->name);
+        } else if (IS_EXPANSION(val)) {
+            // and an expanded macro as its use
+            write(f, AS_EXPANSION(val)->form);
         } else if (IS_PRIMITIVE(val)) {
             // TODO: A lot of repetition going on here, can we shorten this?
             primitive_t *prim = AS_PRIMITIVE(val);
@@ -142,6 +149,10 @@ void write(FILE *f, value_t val) {
                 fprintf(f, "top level ");
             }
             fprintf(f, "environment>");
+        } else if (IS_HASHTABLE(val)) {
+            fprintf(f, "#<hash-table %u>", AS_HASHTABLE(val)->count);
+        } else if (IS_WEAKBOX(val)) {
+            fprintf(f, "#<weak-box>");
         } else {
             fprintf(f, "#<unknown ptrvalue>");
         }
@@ -0,0 +1,44 @@
+(begin
+    ; the depth of recursion isn't limited by the C stack
+    (define (sum n)
+        (if (eq? n 0)
+            0
+            (builtin+ n (sum (builtin- n 1)))))
+
+    (test (sum 15000) 112507500)
+
+    (define (count-let n)
+        (if (eq? n 0)
+            0
+            (let ((r (count-let (builtin- n 1))))
+                (builtin+ r 1))))
+
+    (test (count-let 10000) 10000)
+
+    (define (count-begin n)
+        (if (eq? n 0)
+            0
+            (begin (count-begin (builtin- n 1)) n)))
+
+    (test (count-begin 10000) 10000)
+
+    (define (count-define n)
+        (define r (if (eq? n 0) -1 (count-define (builtin- n 1))))
+        (builtin+ r 1))
+
+    (test (count-define 10000) 10000)
+
+    (define (all-true n)
+        (if (and (not (eq? n 0)) (not (all-true (builtin- n 1)))) #f #t))
+
+    (test (all-true 10000) #t)
+
+    (define (build n)
+        (if (eq? n 0)
+            '()
+            (cons n (build (builtin- n 1)))))
+
+    (define lst (build 8000))
+
+    (test (length (map (lambda (x) x) lst)) 8000)
+    (test (foldr builtin+ 0 lst) 32004000))
@@ -0,0 +1,29 @@
+(begin
+    (define (make-defines n acc)
+        (if (> n 0)
+            (make-defines (- n 1) (cons (list 'define (gensym) n) acc))
+            (cons 'begin acc)))
+    (eval (make-defines 100 '()))
+
+    (define first-var 1)
+    (eval (make-defines 100 '()))
+    (test first-var 1)
+
+    (define first-var 2)
+    (test first-var 2)
+
+    (set! first-var 3)
+    (test first-var 3)
+
+    (define (many-defines x)
+        (define a 1) (define b 2) (define c 3) (define d 4) (define e 5)
+        (define f 6) (define g 7) (define h 8) (define i 9) (define x 10)
+        (list a b c d e f g h i x))
+    (test (many-defines 0) '(1 2 3 4 5 6 7 8 9 10))
+
+    (define (redefine-param x)
+        (define y x)
+        (define x 5)
+        (list x y))
+    (test (redefine-param 1) '(5 1))
+)
@@ -0,0 +1,42 @@
+(begin
+    (define (shadow x) (define x 5) x)
+    (test (shadow 1) 5)
+
+    (define (assign a b) (set! b (+ a b)) b)
+    (test (assign 1 2) 3)
+
+    (define (nested x)
+        (let ((y 2))
+            (lambda (z) (+ x y z))))
+    (test ((nested 1) 3) 6)
+
+    (define (make-counter)
+        (let ((n 0))
+            (lambda () (set! n (+ n 1)) n)))
+    (define counter (make-counter))
+    (counter)
+    (test (counter) 2)
+
+    (define (rest a . args) args)
+    (test (rest 1 2 3) '(2 3))
+
+    (define (local-if if) (if 1 2))
+    (test (local-if (lambda (a b) (+ a b))) 3)
+
+    (define (uses-later-macro x) (later-macro x))
+    (define-macro (later-macro a) (list 'let (list (list 'unused 1)) a))
+    (test (uses-later-macro 7) 7)
+
+    (define code '(lambda (x) (+ x 1)))
+    (test ((eval code) 41) 42)
+    (test code '(lambda (x) (+ x 1)))
+
+    (define body (list (list 'builtin+ 'x 1)))
+    (test ((eval (cons 'lambda (cons (list 'x) body))) 1) 2)
+    (test (symbol? (cadr (car body))) #t)
+
+    (define let-body (list 'let (list (list 'y 'x)) (list 'builtin+ 'y 1)))
+    (test ((eval (list 'lambda (list 'x) let-body)) 1) 2)
+    (test (symbol? (cadr (car (cadr let-body)))) #t)
+    (test (symbol? (cadr (caddr let-body))) #t)
+)
@@ -0,0 +1,32 @@
+(begin
+    ; these would overflow the C stack without proper tail calls
+    (define (count-down n)
+        (if (eq? n 0)
+            'done
+            (count-down (builtin- n 1))))
+
+    (test (count-down 30000) 'done)
+
+    (define (my-even? n)
+        (if (eq? n 0) #t (my-odd? (builtin- n 1))))
+    (define (my-odd? n)
+        (if (eq? n 0) #f (my-even? (builtin- n 1))))
+
+    (test (my-even? 15000) #t)
+    (test (my-odd? 15001) #t)
+
+    (define (count-let n)
+        (let ((m (builtin- n 1)))
+            (begin
+                (if (eq? m 0)
+                    'done
+                    (count-let m)))))
+
+    (test (count-let 15000) 'done)
+
+    (define (count-else n)
+        (if (not (eq? n 0))
+            (count-else (builtin- n 1))
+            'done))
+
+    (test (count-else 15000) 'done))
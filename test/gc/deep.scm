@@ -0,0 +1,22 @@
+(begin
+    ; marking a long list or a deep tree doesn't exhaust the C stack
+    (define (nest n acc)
+        (if (eq? n 0)
+            acc
+            (nest (builtin- n 1) (cons acc n))))
+
+    (define (depth x n)
+        (if (pair? x)
+            (depth (car x) (builtin+ n 1))
+            n))
+
+    (define lst (vector->list (make-vector 10000000 0)))
+    (define tree (nest 200000 '()))
+    (gc)
+
+    (test (length lst) 10000000)
+    (test (depth tree 0) 200000)
+
+    (set! lst '())
+    (set! tree '())
+    (gc))
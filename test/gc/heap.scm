@@ -0,0 +1,11 @@
+(begin
+    ; with --heap-max-grow the limit of --heap-max is raised when the heap is full
+    (define (stat name) (cdr (assq name (gc-stats))))
+    (define max (stat 'heap-max))
+    (define full (stat 'heap-full))
+    (define count (/ max 16))
+    (define lst (vector->list (make-vector count 0)))
+
+    (test (length lst) count)
+    (test (or (eq? max 0) (> (stat 'heap-full) full)) #t)
+    (test (or (eq? max 0) (> (stat 'heap-max) max)) #t))
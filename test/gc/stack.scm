@@ -0,0 +1,11 @@
+(begin
+    ; minor collections don't scan the stack of a deep recursion again
+    (define (sum n)
+        (if (eq? n 0)
+            0
+            (builtin+ n (sum (builtin- n 1)))))
+    (define (stat name) (cdr (assq name (gc-stats))))
+    (define scanned (stat 'minor-scanned))
+
+    (test (sum 300000) 45000150000)
+    (test (< (- (stat 'minor-scanned) scanned) 3000000) #t))
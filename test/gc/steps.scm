@@ -0,0 +1,18 @@
+(begin
+    ; the steps of an incremental collection leave little work to the last one
+    (define (stat name) (cdr (assq name (gc-stats))))
+    (define budget (stat 'step-budget))
+    (define steps (stat 'step-count))
+    (define (build n acc)
+        (if (eq? n 0)
+            (length acc)
+            (build (builtin- n 1) (cons (make-vector 10 n) acc))))
+    (define (deep n)
+        (if (eq? n 0)
+            (build 100000 '())
+            (builtin+ 1 (deep (builtin- n 1)))))
+
+    (test (deep 200000) 300000)
+    (test (or (eq? budget 0) (> (stat 'step-count) steps)) #t)
+    (test (or (eq? budget 0) (< (stat 'remark-scanned) 10000)) #t)
+    (test (or (eq? budget 0) (< (stat 'remark-marked) 1000000)) #t))
@@ -0,0 +1,69 @@
+(begin
+    ; weak boxes, tables with weak keys (ephemerons) or values, finalizers
+    (define (garbage) (list 1 2 3))
+    (define (collect) (gc) (gc))
+    (define kept (list 4 5 6))
+    (define (stat name) (cdr (assq name (gc-stats))))
+    (define conservative (eq? (stat 'conservative) 1))
+    (define nogc (begin (gc) (eq? (stat 'major-count) 0)))
+    (define (left count expected)
+        (if nogc
+            #t
+            (if conservative
+                (and (>= count expected) (<= count (builtin+ expected 2)))
+                (eq? count expected))))
+
+    (define box (make-weak-box (garbage)))
+    (define kept-box (make-weak-box kept))
+    (collect)
+    (test (weak-box? box) #t)
+    (test (weak-box? kept) #f)
+    (test (or nogc conservative (not (weak-box-value box))) #t)
+    (test (weak-box-value kept-box) '(4 5 6))
+    (test (weak-box-value (make-weak-box 42)) 42)
+
+    (define keys (make-weak-key-hash eq?))
+    (hash-set! keys kept 'kept)
+    (hash-set! keys (garbage) 'garbage)
+    (hash-set! keys 42 'number)
+    (collect)
+    (test (left (hash-count keys) 2) #t)
+    (test (hash-ref keys kept) 'kept)
+    (test (hash-ref keys 42) 'number)
+
+    (hash-set! keys kept (garbage))
+    (let ((key (list 7)))
+        (hash-set! keys key (cons key 'back)))
+    (collect)
+    (test (left (hash-count keys) 2) #t)
+    (test (hash-ref keys kept) '(1 2 3))
+
+    (define vals (make-weak-value-hash equal?))
+    (hash-set! vals "kept" kept)
+    (hash-set! vals "garbage" (garbage))
+    (collect)
+    (test (left (hash-count vals) 1) #t)
+    (test (hash-ref vals "kept") '(4 5 6))
+    (test (or nogc conservative (equal? (hash->alist vals) '(("kept" 4 5 6)))) #t)
+
+    (define cache (make-weak-key-hash eq?))
+    (define (fill n)
+        (if (eq? n 0)
+            'done
+            (begin
+                (hash-set! cache (list n) n)
+                (fill (builtin- n 1)))))
+    (fill 20000)
+    (collect)
+    (test (left (hash-count cache) 0) #t)
+
+    (define finalized '())
+    (register-finalizer! (garbage)
+                         (lambda (val) (set! finalized (cons val finalized))))
+    (register-finalizer! kept
+                         (lambda (val) (set! finalized 'kept)))
+    (collect)
+    (test (left (- 1 (run-finalizers)) 0) #t)
+    (test (or nogc conservative (equal? finalized '((1 2 3)))) #t)
+    (collect)
+    (test (left (run-finalizers) 0) #t))
@@ -0,0 +1,11 @@
+(begin
+    (let ()
+        (load "test/load/symbols_data.scm")
+        (define first loaded)
+        (load "test/load/symbols_data.scm")
+        (test (eq? first loaded) #f)
+        (test (eq? (car first) (car loaded)) #t)
+        (test (eq? (car loaded) (list-ref loaded 4)) #t)
+        (test (eq? (cadr loaded) 'beta) #t)
+        (test (hash 'gamma) (hash "gamma"))
+        (test (eq? (gensym) (gensym)) #f)))
@@ -0,0 +1,2 @@
+(begin
+    (define loaded '(alpha beta gamma delta alpha)))
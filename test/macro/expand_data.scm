@@ -0,0 +1,16 @@
+(begin
+    (define code (list 'lambda (list 'x) (list 'when 'x (list 'builtin+ 'x 1))))
+    (define f (eval code))
+    (test (f 1) 2)
+    (test (car (caddr code)) 'when)
+    (test (caddr code) '(when x (builtin+ x 1)))
+
+    (define expansions 0)
+    (define-macro (counted x)
+        (set! expansions (+ expansions 1))
+        x)
+    (define let-code (list 'let (list (list 'y 1)) (list 'counted 5)))
+    (test (eval let-code) 5)
+    (test (car (caddr let-code)) 'counted)
+    (test expansions 1)
+)
@@ -0,0 +1,38 @@
+(begin
+    (define expansions 0)
+    (define-macro (counted x)
+        (set! expansions (+ expansions 1))
+        x)
+
+    (define (uses-counted n) (counted n))
+    (uses-counted 1)
+    (uses-counted 2)
+    (test (uses-counted 3) 3)
+    (test expansions 1)
+
+    (define (loop n acc)
+        (if (> n 0)
+            (loop (- n 1) (+ acc (counted 1)))
+            acc))
+    (test (loop 10 0) 10)
+    (test expansions 2)
+
+    (test (expand (counted 5)) 5)
+    (test expansions 3)
+
+    (define (shadowed counted) (counted 1))
+    (test (shadowed (lambda (x) (+ x 1))) 2)
+
+    (define (uses-later x) (later x))
+    (define-macro (later x) (list '+ x 1))
+    (test (uses-later 1) 2)
+    (test (uses-later 2) 3)
+
+    (define-macro (define-y v) (list 'define 'y v))
+    (define (defines-y y) (define-y 5) y)
+    (test (defines-y 1) 5)
+
+    (define (quoted) '(counted 1))
+    (test (quoted) '(counted 1))
+    (test (car (quoted)) 'counted)
+)
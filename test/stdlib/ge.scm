@@ -6,4 +6,10 @@
     (test (>= -1 -1) #t)
     (test (>= -1 -2) #t)
     (test (>= -2 -1) #f)
+    (test (>=) #t)
+    (test (>= 1) #t)
+    (test (>= 3 2 2 1) #t)
+    (test (>= 1 2 0) #f)
+    (test (>= (/ 1 0) 1) #t)
+    (test (>= (/ 0 0) 1) #f)
 )
@@ -0,0 +1,34 @@
+(begin
+    (let ((ht (make-hash equal?)))
+        (test (hash? ht) #t)
+        (test (hash? '()) #f)
+        (hash-set! ht '(1 2) 'a)
+        (hash-set! ht "key" 'b)
+        (test (hash-ref ht (list 1 2)) 'a)
+        (test (hash-ref ht "key") 'b)
+        (test (hash-count ht) 2)
+        (test (length (hash->alist ht)) 2)
+        (test (cdr (car (filter (lambda (p) (equal? (car p) "key")) (hash->alist ht)))) (quote b)))
+
+    (let ((ht (make-hash eq?))
+          (sum 0))
+        (hash-set! ht 1 10)
+        (hash-set! ht 2 20)
+        (hash-set! ht 3 30)
+        (hash-walk ht (lambda (k v) (set! sum (+ sum k v))))
+        (test sum 66))
+
+    (define (hash-native-range from to fn)
+        (when (< from to)
+            (fn from)
+            (hash-native-range (+ from 1) to fn)))
+
+    (let ((ht (make-hash (lambda (a b) (= a b)))))
+        (hash-native-range 0 100 (lambda (i) (hash-set! ht i (* i i))))
+        (test (hash-count ht) 100)
+        (test (hash-ref ht 7) 49)
+        (test (>= (hash-capacity ht) 128) #t)
+        (hash-native-range 0 95 (lambda (i) (hash-delete! ht i)))
+        (test (hash-count ht) 5)
+        (test (hash-ref ht 99) 9801)
+        (test (< (hash-capacity ht) 128) #t)))
@@ -7,4 +7,10 @@
     (test (<= -1 -1) #t)
     (test (<= -2 -1) #t)
     (test (<= -2 -3) #f)
+    (test (<=) #t)
+    (test (<= 1) #t)
+    (test (<= 1 2 2 3) #t)
+    (test (<= 2 1 3) #f)
+    (test (<= (/ -1 0) -1) #t)
+    (test (<= (/ 0 0) 1) #f)
 )
@@ -0,0 +1,37 @@
+(begin
+    (define lst '(1 2 3 4 5))
+
+    (test (map (lambda (x) (* x x)) lst) '(1 4 9 16 25))
+    (test (map car '()) '())
+    (test (filter (lambda (x) (> x 2)) lst) '(3 4 5))
+    (test (foldl cons '() '(1 2 3)) '(((() . 1) . 2) . 3))
+    (test (foldr cons '() '(1 2 3)) '(1 2 3))
+    (test (reduce + lst) 15)
+
+    (test (reverse lst) '(5 4 3 2 1))
+    (test (reverse '()) '())
+    (test (append) '())
+    (test (append '(1) '(2 3) '() '(4)) '(1 2 3 4))
+    (test (append '(1 2) 3) '(1 2 . 3))
+    (test (append '() lst) lst)
+    (test (eq? (append '(1) lst) lst) #f)
+    (test (eq? (cdr (append '(1) lst)) lst) #t)
+
+    (test (list-copy lst) lst)
+    (test (eq? (list-copy lst) lst) #f)
+    (test (drop 2 lst) '(3 4 5))
+    (test (drop 10 lst) '())
+    (test (list-tail lst 5) '())
+    (test (list-ref lst 0) 1)
+    (test (list-ref lst 4) 5)
+
+    (test (member? lst 3) #t)
+    (test (member? lst 6) #f)
+    (test (member '(2) '((1) (2) (3))) '((2) (3)))
+    (test (memq 'c '(a b c d)) '(c d))
+    (test (memq 'e '(a b c d)) #f)
+
+    (test (assq 'b '((a 1) (b 2))) '(b 2))
+    (test (assq 'c '((a 1) (b 2))) #f)
+    (test (assoc "b" '(("a" . 1) ("b" . 2))) '("b" . 2))
+    (test (assv 2 '((1 . one) (2 . two))) '(2 . two)))
@@ -5,4 +5,8 @@
     (test (< -1 1) #t)
     (test (< -1 -1) #f)
     (test (< -2 -1) #t)
+    (test (< 1 2 3) #t)
+    (test (< 1 3 2) #f)
+    (test (< (/ 0 0) 1) #f)
+    (test (< 1 (/ 1 0)) #t)
 )
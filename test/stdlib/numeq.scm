@@ -9,4 +9,8 @@
     (test (equal? (= 0 0) #t) #t)
     (test (equal? (= 1 -1) #f) #t)
     (test (equal? (= 1e40 1e40) #t) #t)
+    (test (equal? (= 1 1 1) #t) #t)
+    (test (equal? (= 1 1 2) #f) #t)
+    (test (equal? (= (/ 0 0) (/ 0 0)) #f) #t)
+    (test (equal? (= (/ 1 0) (/ 2 0)) #t) #t)
 )
@@ -0,0 +1,34 @@
+(begin
+    (define vec (vector 1 2 3 4))
+
+    (test (vector) #())
+    (test (list->vector '()) #())
+    (test (list->vector '(1 (2) "3")) #(1 (2) "3"))
+    (test (vector->list #()) '())
+    (test (vector->list vec) '(1 2 3 4))
+    (test (vector-map (lambda (x) (* x 10)) vec) #(10 20 30 40))
+
+    (define sum 0)
+    (vector-for-each (lambda (x) (set! sum (+ sum x))) vec)
+    (test sum 10)
+
+    (test (vector-append) #())
+    (test (vector-append #(1) #(2 3) #() #(4)) #(1 2 3 4))
+    (test (vector-copy vec) vec)
+    (test (eq? (vector-copy vec) vec) #f)
+    (test (vector-copy vec 2) #(3 4))
+    (test (vector-copy vec 1 3) #(2 3))
+    (test (subvector vec 0 0) #())
+    (test (subvector vec 1 4) #(2 3 4))
+
+    (define grown (vector-grow vec 6))
+    (test (vector-length grown) 6)
+    (test (subvector grown 0 4) vec)
+    (test (vector-length vec) 4)
+
+    (define stack (vector))
+    (vector-push! stack 'a)
+    (vector-push! stack 'b)
+    (test stack #(a b))
+    (test (vector-empty? (vector)) #t)
+    (test (vector-empty? stack) #f))
@@ -59,12 +59,17 @@
     (tests-start)
 
     (test-run "test/load/test.scm")
+    (test-run "test/load/symbols.scm")
 
     (test-run "test/func/variadic_lambda.scm")
     (test-run "test/func/anon.scm")
     (test-run "test/func/variadic.scm")
     (test-run "test/func/anon_no_args.scm")
     (test-run "test/func/closure.scm")
+    (test-run "test/func/tail_call.scm")
+    (test-run "test/func/deep_recursion.scm")
+    (test-run "test/func/lexical.scm")
+    (test-run "test/func/globals.scm")
 
     (test-run "test/core/multiply.scm")
     (test-run "test/core/car.scm")
@@ -83,20 +88,30 @@
     (test-run "test/macro/variadic.scm")
     (test-run "test/macro/gensym.scm")
     (test-run "test/macro/ifpos.scm")
+    (test-run "test/macro/expand_once.scm")
+    (test-run "test/macro/expand_data.scm")
 
     (test-run "test/stdlib/vector_fill.scm")
     (test-run "test/stdlib/le.scm")
     (test-run "test/stdlib/hash_table.scm")
+    (test-run "test/stdlib/hash_native.scm")
     (test-run "test/stdlib/list_pred.scm")
     (test-run "test/stdlib/infinite.scm")
     (test-run "test/stdlib/vector_append.scm")
+    (test-run "test/stdlib/vector_ops.scm")
     (test-run "test/stdlib/nan.scm")
     (test-run "test/stdlib/gt.scm")
     (test-run "test/stdlib/lt.scm")
     (test-run "test/stdlib/length.scm")
+    (test-run "test/stdlib/list_ops.scm")
     (test-run "test/stdlib/numeq.scm")
     (test-run "test/stdlib/ge.scm")
     (test-run "test/syntax/begin.scm")
     (test-run "test/syntax/cons.scm")
     (test-run "test/syntax/vector.scm")
+    (test-run "test/gc/heap.scm")
+    (test-run "test/gc/deep.scm")
+    (test-run "test/gc/stack.scm")
+    (test-run "test/gc/steps.scm")
+    (test-run "test/gc/weak.scm")
     (tests-end)))